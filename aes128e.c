@@ -14,9 +14,13 @@
   // ************************************************************************//
  // Includes		                                                        //
 // ************************************************************************//
-#include <stdio.h>		// Used for printing and debugging
 #include <stdint.h>
+#include <string.h>
 #include "aes128e.h"
+#include "aes128e_aesni.h"
+#include "aes128e_bitsliced.h"
+#include "aes128e_vaes.h"
+#include "aes128e_armce.h"
 
   // ************************************************************************//
  // Definitions		                                                        //
@@ -29,38 +33,72 @@
 /* Number of Rounds */
 #define Nr 10
 
-  // ************************************************************************ //
- // Private variables                                                        //
-// ************************************************************************ //
-
-/* State array */
-static unsigned char stateMatrix[4][4];
-/* All the Round Keys */
-static unsigned char roundKeys[Nb * Nk * (Nr + 1)];
-/* Round counter */
-static unsigned char roundNumber;
-
 /* Multiplication by two in GF(2^8). Multiplication by three is xtime(a) ^ a */
 #define xtime(a) ( ((a) & 0x80) ? (((a) << 1) ^ 0x1b) : ((a) << 1) )
 
+/* The S-box values, listed once as an X-macro so that the S-box table and the
+   T-tables below are both generated from them at compile time */
+#define SBOX_VALUES(X) \
+    X(0x63) X(0x7c) X(0x77) X(0x7b) X(0xf2) X(0x6b) X(0x6f) X(0xc5) X(0x30) X(0x01) X(0x67) X(0x2b) X(0xfe) X(0xd7) X(0xab) X(0x76) /* 0 */ \
+    X(0xca) X(0x82) X(0xc9) X(0x7d) X(0xfa) X(0x59) X(0x47) X(0xf0) X(0xad) X(0xd4) X(0xa2) X(0xaf) X(0x9c) X(0xa4) X(0x72) X(0xc0) /* 1 */ \
+    X(0xb7) X(0xfd) X(0x93) X(0x26) X(0x36) X(0x3f) X(0xf7) X(0xcc) X(0x34) X(0xa5) X(0xe5) X(0xf1) X(0x71) X(0xd8) X(0x31) X(0x15) /* 2 */ \
+    X(0x04) X(0xc7) X(0x23) X(0xc3) X(0x18) X(0x96) X(0x05) X(0x9a) X(0x07) X(0x12) X(0x80) X(0xe2) X(0xeb) X(0x27) X(0xb2) X(0x75) /* 3 */ \
+    X(0x09) X(0x83) X(0x2c) X(0x1a) X(0x1b) X(0x6e) X(0x5a) X(0xa0) X(0x52) X(0x3b) X(0xd6) X(0xb3) X(0x29) X(0xe3) X(0x2f) X(0x84) /* 4 */ \
+    X(0x53) X(0xd1) X(0x00) X(0xed) X(0x20) X(0xfc) X(0xb1) X(0x5b) X(0x6a) X(0xcb) X(0xbe) X(0x39) X(0x4a) X(0x4c) X(0x58) X(0xcf) /* 5 */ \
+    X(0xd0) X(0xef) X(0xaa) X(0xfb) X(0x43) X(0x4d) X(0x33) X(0x85) X(0x45) X(0xf9) X(0x02) X(0x7f) X(0x50) X(0x3c) X(0x9f) X(0xa8) /* 6 */ \
+    X(0x51) X(0xa3) X(0x40) X(0x8f) X(0x92) X(0x9d) X(0x38) X(0xf5) X(0xbc) X(0xb6) X(0xda) X(0x21) X(0x10) X(0xff) X(0xf3) X(0xd2) /* 7 */ \
+    X(0xcd) X(0x0c) X(0x13) X(0xec) X(0x5f) X(0x97) X(0x44) X(0x17) X(0xc4) X(0xa7) X(0x7e) X(0x3d) X(0x64) X(0x5d) X(0x19) X(0x73) /* 8 */ \
+    X(0x60) X(0x81) X(0x4f) X(0xdc) X(0x22) X(0x2a) X(0x90) X(0x88) X(0x46) X(0xee) X(0xb8) X(0x14) X(0xde) X(0x5e) X(0x0b) X(0xdb) /* 9 */ \
+    X(0xe0) X(0x32) X(0x3a) X(0x0a) X(0x49) X(0x06) X(0x24) X(0x5c) X(0xc2) X(0xd3) X(0xac) X(0x62) X(0x91) X(0x95) X(0xe4) X(0x79) /* A */ \
+    X(0xe7) X(0xc8) X(0x37) X(0x6d) X(0x8d) X(0xd5) X(0x4e) X(0xa9) X(0x6c) X(0x56) X(0xf4) X(0xea) X(0x65) X(0x7a) X(0xae) X(0x08) /* B */ \
+    X(0xba) X(0x78) X(0x25) X(0x2e) X(0x1c) X(0xa6) X(0xb4) X(0xc6) X(0xe8) X(0xdd) X(0x74) X(0x1f) X(0x4b) X(0xbd) X(0x8b) X(0x8a) /* C */ \
+    X(0x70) X(0x3e) X(0xb5) X(0x66) X(0x48) X(0x03) X(0xf6) X(0x0e) X(0x61) X(0x35) X(0x57) X(0xb9) X(0x86) X(0xc1) X(0x1d) X(0x9e) /* D */ \
+    X(0xe1) X(0xf8) X(0x98) X(0x11) X(0x69) X(0xd9) X(0x8e) X(0x94) X(0x9b) X(0x1e) X(0x87) X(0xe9) X(0xce) X(0x55) X(0x28) X(0xdf) /* E */ \
+    X(0x8c) X(0xa1) X(0x89) X(0x0d) X(0xbf) X(0xe6) X(0x42) X(0x68) X(0x41) X(0x99) X(0x2d) X(0x0f) X(0xb0) X(0x54) X(0xbb) X(0x16) /* F */
+
 /* The S-box table */
-static const unsigned char sbox[256] = {
-    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76, // 0
-    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0, // 1
-    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15, // 2
-    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75, // 3
-    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84, // 4
-    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf, // 5
-    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8, // 6
-    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2, // 7
-    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73, // 8
-    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb, // 9
-    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79, // A
-    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08, // B
-    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a, // C
-    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e, // D
-    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf, // E
-    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16 }; // F
+#define SBOX_BYTE(s) s,
+static const unsigned char sbox[256] = { SBOX_VALUES(SBOX_BYTE) };
+
+#ifndef AES128E_REFERENCE
+
+/* T-tables: Te0[x] is the column ({02}•S[x], S[x], S[x], {03}•S[x]) packed big-endian
+   into a 32-bit word, and Te1..Te3 are the same column rotated by 1..3 bytes. One
+   lookup in each table merges SubBytes, ShiftRows and MixColumns for a column. */
+#define MUL2(s) ((uint32_t)(xtime(s) & 0xff))
+#define MUL3(s) ((uint32_t)((xtime(s) ^ (s)) & 0xff))
+#define TE0(s) ((MUL2(s) << 24) | ((uint32_t)(s) << 16) | ((uint32_t)(s) << 8) | MUL3(s)),
+#define TE1(s) ((MUL3(s) << 24) | (MUL2(s) << 16) | ((uint32_t)(s) << 8) | (uint32_t)(s)),
+#define TE2(s) (((uint32_t)(s) << 24) | (MUL3(s) << 16) | (MUL2(s) << 8) | (uint32_t)(s)),
+#define TE3(s) (((uint32_t)(s) << 24) | ((uint32_t)(s) << 16) | (MUL3(s) << 8) | MUL2(s)),
+
+static const uint32_t Te0[256] = { SBOX_VALUES(TE0) };
+static const uint32_t Te1[256] = { SBOX_VALUES(TE1) };
+static const uint32_t Te2[256] = { SBOX_VALUES(TE2) };
+static const uint32_t Te3[256] = { SBOX_VALUES(TE3) };
+
+/* One inner T-table round from the column words s0..s3 into t0..t3. Column j takes row r
+   from column j + r (ShiftRows), and the tables do SubBytes and MixColumns */
+#define TTableRound(t0, t1, t2, t3, s0, s1, s2, s3, rk) do { \
+	t0 = Te0[(s0) >> 24] ^ Te1[((s1) >> 16) & 0xff] ^ Te2[((s2) >> 8) & 0xff] ^ Te3[(s3) & 0xff] ^ GETU32((rk)     ); \
+	t1 = Te0[(s1) >> 24] ^ Te1[((s2) >> 16) & 0xff] ^ Te2[((s3) >> 8) & 0xff] ^ Te3[(s0) & 0xff] ^ GETU32((rk) +  4); \
+	t2 = Te0[(s2) >> 24] ^ Te1[((s3) >> 16) & 0xff] ^ Te2[((s0) >> 8) & 0xff] ^ Te3[(s1) & 0xff] ^ GETU32((rk) +  8); \
+	t3 = Te0[(s3) >> 24] ^ Te1[((s0) >> 16) & 0xff] ^ Te2[((s1) >> 8) & 0xff] ^ Te3[(s2) & 0xff] ^ GETU32((rk) + 12); \
+	} while (0)
+
+/* Column word j of the last round, which has no MixColumns, so plain S-box bytes are used */
+#define TTableLast(s0, s1, s2, s3, rk) \
+	(((uint32_t)sbox[(s0) >> 24] << 24) ^ ((uint32_t)sbox[((s1) >> 16) & 0xff] << 16) ^ ((uint32_t)sbox[((s2) >> 8) & 0xff] << 8) ^ sbox[(s3) & 0xff] ^ GETU32(rk))
+
+#endif
+
+/* Big-endian load and store of a 32-bit word */
+#define GETU32(p) (((uint32_t)(p)[0] << 24) | ((uint32_t)(p)[1] << 16) | ((uint32_t)(p)[2] << 8) | (uint32_t)(p)[3])
+#define PUTU32(p, v) do { uint32_t w_ = (v); (p)[0] = (unsigned char)(w_ >> 24); (p)[1] = (unsigned char)(w_ >> 16); \
+	(p)[2] = (unsigned char)(w_ >> 8); (p)[3] = (unsigned char)w_; } while (0)
+
+/* Counter blocks encrypted together by the portable CTR loop */
+#define CTRLanes 4
 
 /* The round constant table (needed in KeyExpansion) */
 static const unsigned char rcon[10] = {
@@ -71,33 +109,6 @@ static const unsigned char rcon[10] = {
  // Private functions                                                        //
 // ************************************************************************ //
 
-/* Method used for printing arrays with 4 by 4 values in Hex format 
-static void Print(unsigned char myarray[4][4]) {		
-	
-	unsigned char i, j;
-
-	for(i = 0; i < Nb; i++) 
-	{
-		for(j = 0; j < Nb; j++) 
-		{
-			printf("%#x ", myarray[i][j]);		// Print state array 
-		}
-		printf("%s\n", "");
-	}
-	printf("%s\n", "");
-}*/
-
-/* Method used for printing values in one dimension arrays 
-static void PrintVector(unsigned char *myArray, unsigned char arraySize) {		
-	
-	unsigned char i, j;
-
-	for(i = 0; i < arraySize; i++) 
-	{
-		printf("%#X ", myArray[i]);
-	}
-}*/
-
 /* Return the Sbox translated value of a word, submethod of KeyExpansion function  */
 static void SubWord(unsigned char word[4]) {
 	word[0] = sbox[word[0]];
@@ -118,8 +129,8 @@ static void RotWord(unsigned char word[4]) {
 	word[3] = tempRot;
 }
 
-/* Method to expand the key, only for AES128 */
-static void KeyExpansion128(const unsigned char *key) {	
+/* Method to expand the key into roundKeys, only for AES128 */
+static void KeyExpansion128(unsigned char *roundKeys, const unsigned char *key) {	
 
 	unsigned char temp[4], i, j;
 
@@ -155,11 +166,12 @@ static void KeyExpansion128(const unsigned char *key) {
 			roundKeys[i] = roundKeys[i - Nk] ^ roundKeys[i - (Nb * Nk)]; // Current byte == roundKeys 4 positions before XORed with roundKeys of 16 positions before
 		}
 	}
-	//PrintVector(roundKeys, sizeof(roundKeys) / sizeof(roundKeys[0]));
 }
 
+#ifdef AES128E_REFERENCE
+
 /* Method used to add the roundKeys to the state array */
-static void AddRoundKey() {
+static void AddRoundKey(unsigned char stateMatrix[4][4], const unsigned char *roundKeys, unsigned char roundNumber) {
 
 	unsigned char tempRoundKeys[4][4], i, j, tempArray[4];
 
@@ -178,9 +190,6 @@ static void AddRoundKey() {
 		}
 	}
 
-	//printf("%s\n", "");
-	//Print(tempRoundKeys);
-
 	for(i = 0; i < Nb; i++) 
 	{
 		for(j = 0; j < Nb; j++) 
@@ -188,12 +197,10 @@ static void AddRoundKey() {
 			stateMatrix[i][j] = stateMatrix[i][j] ^ tempRoundKeys[i][j];	// Round keys of the current round (tempRoundKeys) are XORed with state matrix
 		}
 	}
-	//printf("%s\n", "");
-	//Print(stateMatrix);
 }
 
 /* State values are mapped to the Sbox values */
-static void SubBytes() {
+static void SubBytes(unsigned char stateMatrix[4][4]) {
 
 	unsigned char i, j;
 
@@ -204,11 +211,10 @@ static void SubBytes() {
 			stateMatrix[i][j] = sbox[stateMatrix[i][j]];
 		}
 	}
-	//Print(stateMatrix);
 }
 
 /* Row bytes are shifted. Row N[i][] is shifted to the left by i bytes */
-static void ShiftRows() {
+static void ShiftRows(unsigned char stateMatrix[4][4]) {
 
 	unsigned char tempRow;
 
@@ -236,7 +242,7 @@ static void ShiftRows() {
 	stateMatrix[3][0] = tempRow;
 }
 
-static void MixColumns() {
+static void MixColumns(unsigned char stateMatrix[4][4]) {
 
 	unsigned char i, j, tempCell[4];
 
@@ -269,10 +275,11 @@ static void MixColumns() {
 	}
 }
 
-/* Under the 16-byte key at k, encrypt the 16-byte plaintext at p and store it at c. */
-void aes128e(unsigned char *c, const unsigned char *p, const unsigned char *k) {
+/* Reference cipher: the FIPS-197 rounds applied byte by byte on the 4x4 state array */
+static void Cipher(unsigned char *c, const unsigned char *p, const unsigned char *roundKeys) {
 
-	KeyExpansion128(k);
+	unsigned char stateMatrix[4][4];				// State array, local so that concurrent calls never share it
+	unsigned char roundNumber;						// Round counter
 
 	for(unsigned char i = 0; i < Nb; i++) 
 	{
@@ -283,25 +290,22 @@ void aes128e(unsigned char *c, const unsigned char *p, const unsigned char *k) {
 	}
 	
 	roundNumber = 0;								// Initialize roundNumber to 0
-	AddRoundKey();									// First key added
+	AddRoundKey(stateMatrix, roundKeys, roundNumber);	// First key added
 
 	// Iterate the process by Nr - 1 times which is 9 (10 - 1) times for 128 AES 
 	for (roundNumber = 1; roundNumber < Nr; ++roundNumber) 
 	{
-		SubBytes();									// Bytes are substituted by Sbox values
-		ShiftRows();								// Bytes rows are shifted to the left by N bytes 
-		MixColumns();								// Byte columns are multiplied by a constant to mix the columns
-		AddRoundKey();								// Round key added to the stateMatrix
-		//Print(stateMatrix);
-		//printf("%s%d\n", "Round: ", roundNumber);		
+		SubBytes(stateMatrix);					// Bytes are substituted by Sbox values
+		ShiftRows(stateMatrix);					// Bytes rows are shifted to the left by N bytes 
+		MixColumns(stateMatrix);				// Byte columns are multiplied by a constant to mix the columns
+		AddRoundKey(stateMatrix, roundKeys, roundNumber);	// Round key added to the stateMatrix
 	}
 
 	// The last round does not include MixColumns but adds a final round key
-	SubBytes();
-	ShiftRows();
-	AddRoundKey();
+	SubBytes(stateMatrix);
+	ShiftRows(stateMatrix);
+	AddRoundKey(stateMatrix, roundKeys, roundNumber);
 
-	//Print(stateMatrix);
 
 	for(unsigned char i = 0; i < Nb; i++)
 	{
@@ -310,5 +314,287 @@ void aes128e(unsigned char *c, const unsigned char *p, const unsigned char *k) {
 			c[(i * Nb) + j] = stateMatrix[j][i];	// stateMatrix values are stored in c
 		}
 	}
-	//PrintVector(c, sizeof(c) / sizeof(c[0]));	
-}
\ No newline at end of file
+}
+
+/* The reference rounds have no interleaved form, the blocks are simply encrypted in turn */
+static void Cipher4(unsigned char *c, const unsigned char *p, const unsigned char *roundKeys) {
+
+	for (int b = 0; b < CTRLanes; b++)
+	{
+		Cipher(c + 16 * b, p + 16 * b, roundKeys);
+	}
+}
+
+#else
+
+/* T-table cipher: the state is kept as four big-endian column words, and every inner
+   round costs 16 table lookups plus the round key XOR */
+static void Cipher(unsigned char *c, const unsigned char *p, const unsigned char *roundKeys) {
+
+	uint32_t s0, s1, s2, s3, t0, t1, t2, t3;
+	const unsigned char *rk = roundKeys;
+
+	s0 = GETU32(p     ) ^ GETU32(rk     );	// Initial AddRoundKey on the four column words
+	s1 = GETU32(p +  4) ^ GETU32(rk +  4);
+	s2 = GETU32(p +  8) ^ GETU32(rk +  8);
+	s3 = GETU32(p + 12) ^ GETU32(rk + 12);
+
+	for (unsigned char roundNumber = 1; roundNumber < Nr; ++roundNumber)
+	{
+		rk += Nb * Nk;					// Next round key
+		TTableRound(t0, t1, t2, t3, s0, s1, s2, s3, rk);
+
+		s0 = t0;
+		s1 = t1;
+		s2 = t2;
+		s3 = t3;
+	}
+
+	rk += Nb * Nk;
+
+	PUTU32(c     , TTableLast(s0, s1, s2, s3, rk     ));
+	PUTU32(c +  4, TTableLast(s1, s2, s3, s0, rk +  4));
+	PUTU32(c +  8, TTableLast(s2, s3, s0, s1, rk +  8));
+	PUTU32(c + 12, TTableLast(s3, s0, s1, s2, rk + 12));
+}
+
+/* Four independent blocks through the T-table rounds in lockstep, so the lookups of
+   one block are in flight while the others wait on theirs. Every state word is a named
+   local, sb_j being column j of block b, so that the compiler can keep them in registers */
+static void Cipher4(unsigned char *c, const unsigned char *p, const unsigned char *roundKeys) {
+
+	uint32_t s0_0, s0_1, s0_2, s0_3, s1_0, s1_1, s1_2, s1_3, s2_0, s2_1, s2_2, s2_3, s3_0, s3_1, s3_2, s3_3;
+	uint32_t t0_0, t0_1, t0_2, t0_3, t1_0, t1_1, t1_2, t1_3, t2_0, t2_1, t2_2, t2_3, t3_0, t3_1, t3_2, t3_3;
+	const unsigned char *rk = roundKeys;
+
+#define Cipher4Load(b) do { \
+	s##b##_0 = GETU32(p + 16 * b     ) ^ GETU32(rk     ); \
+	s##b##_1 = GETU32(p + 16 * b +  4) ^ GETU32(rk +  4); \
+	s##b##_2 = GETU32(p + 16 * b +  8) ^ GETU32(rk +  8); \
+	s##b##_3 = GETU32(p + 16 * b + 12) ^ GETU32(rk + 12); \
+	} while (0)
+#define Cipher4Round(b) do { \
+	TTableRound(t##b##_0, t##b##_1, t##b##_2, t##b##_3, s##b##_0, s##b##_1, s##b##_2, s##b##_3, rk); \
+	s##b##_0 = t##b##_0; s##b##_1 = t##b##_1; s##b##_2 = t##b##_2; s##b##_3 = t##b##_3; \
+	} while (0)
+#define Cipher4Store(b) do { \
+	PUTU32(c + 16 * b     , TTableLast(s##b##_0, s##b##_1, s##b##_2, s##b##_3, rk     )); \
+	PUTU32(c + 16 * b +  4, TTableLast(s##b##_1, s##b##_2, s##b##_3, s##b##_0, rk +  4)); \
+	PUTU32(c + 16 * b +  8, TTableLast(s##b##_2, s##b##_3, s##b##_0, s##b##_1, rk +  8)); \
+	PUTU32(c + 16 * b + 12, TTableLast(s##b##_3, s##b##_0, s##b##_1, s##b##_2, rk + 12)); \
+	} while (0)
+
+	Cipher4Load(0); Cipher4Load(1); Cipher4Load(2); Cipher4Load(3);
+
+	for (unsigned char roundNumber = 1; roundNumber < Nr; ++roundNumber)
+	{
+		rk += Nb * Nk;
+		Cipher4Round(0); Cipher4Round(1); Cipher4Round(2); Cipher4Round(3);	// The same round of every block before the next round
+	}
+
+	rk += Nb * Nk;
+	Cipher4Store(0); Cipher4Store(1); Cipher4Store(2); Cipher4Store(3);	// Every block is read before any is written, so c may be p
+
+#undef Cipher4Load
+#undef Cipher4Round
+#undef Cipher4Store
+}
+
+#endif
+
+/* Keystream blocks at stream are XORed into in, 8 bytes at a time */
+static void XorBlocks(unsigned char *out, const unsigned char *in, const unsigned char *stream, unsigned long nblocks) {
+
+	uint64_t x, y;
+
+	for (unsigned long i = 0; i < nblocks * 16; i += 8)
+	{
+		memcpy(&x, in + i, 8);			// memcpy compiles to plain loads for any alignment
+		memcpy(&y, stream + i, 8);
+		x ^= y;
+		memcpy(out + i, &x, 8);
+	}
+}
+
+/* Under the 16-byte key at k, encrypt the 16-byte plaintext at p and store it at c. */
+void aes128e(unsigned char *c, const unsigned char *p, const unsigned char *k) {
+
+	aes128e_key ks;
+
+	aes128e_setkey(&ks, k);
+	aes128e_encrypt(c, p, &ks);
+}
+
+/* Expand the 16-byte key at k into ks, so ks can encrypt any number of blocks. */
+void aes128e_setkey(aes128e_key *ks, const unsigned char *k) {
+
+	if (aes128e_setkey_backend(ks, k, AES128E_VAES) != 0 &&		// VAES when CPUID reports it
+		aes128e_setkey_backend(ks, k, AES128E_AESNI) != 0 &&		// Then AES-NI
+		aes128e_setkey_backend(ks, k, AES128E_ARMCE) != 0)		// Or the ARMv8 AES instructions
+	{
+		aes128e_setkey_backend(ks, k, AES128E_PORTABLE);		// Otherwise the T-table (or reference) C
+	}
+}
+
+/* Expand the key for the implementation given by backend, if this build and CPU support it */
+int aes128e_setkey_backend(aes128e_key *ks, const unsigned char *k, int backend) {
+
+	switch (backend)
+	{
+		case AES128E_PORTABLE:
+			KeyExpansion128(ks->roundKeys, k);
+			break;
+#ifdef AES128E_HAVE_AESNI
+		case AES128E_AESNI:
+			if (!__builtin_cpu_supports("aes") || !__builtin_cpu_supports("ssse3"))	// CPUID, read once by the runtime at startup
+				return -1;
+			aes128e_aesni_setkey(ks->roundKeys, k);
+			break;
+#endif
+#if defined(AES128E_HAVE_VAES) && defined(AES128E_HAVE_AESNI)
+		case AES128E_VAES:
+			if (!__builtin_cpu_supports("aes") || !__builtin_cpu_supports("vaes") || !__builtin_cpu_supports("avx2"))
+				return -1;
+			aes128e_aesni_setkey(ks->roundKeys, k);		// Same schedule; single blocks also go through AES-NI
+			break;
+#endif
+#ifdef AES128E_HAVE_ARMCE
+		case AES128E_ARMCE:
+			if (!aes128e_armce_available())		// AT_HWCAP, as reported by the kernel
+				return -1;
+			aes128e_armce_setkey(ks->roundKeys, k);
+			break;
+#endif
+		case AES128E_BITSLICED:
+			aes128e_bitsliced_setkey(ks->roundKeys, k);
+			break;
+		default:
+			return -1;
+	}
+	ks->backend = backend;
+	return 0;
+}
+
+/* Under the expanded key ks, encrypt the 16-byte plaintext at p and store it at c. */
+void aes128e_encrypt(unsigned char *c, const unsigned char *p, const aes128e_key *ks) {
+
+#ifdef AES128E_HAVE_AESNI
+	if (ks->backend == AES128E_AESNI || ks->backend == AES128E_VAES)
+	{
+		aes128e_aesni_encrypt(c, p, ks->roundKeys);
+		return;
+	}
+#endif
+#ifdef AES128E_HAVE_ARMCE
+	if (ks->backend == AES128E_ARMCE)
+	{
+		aes128e_armce_encrypt(c, p, ks->roundKeys);
+		return;
+	}
+#endif
+	if (ks->backend == AES128E_BITSLICED)
+	{
+		aes128e_bitsliced_encrypt(c, p, ks->roundKeys);
+		return;
+	}
+	Cipher(c, p, ks->roundKeys);	// The key schedule was expanded once by aes128e_setkey
+}
+
+/* CTR with the 32-bit counter in the last 4 bytes of CB, CTRLanes counter blocks at a time */
+void aes128e_ctr32(unsigned char *out, const unsigned char *in, unsigned long nblocks, unsigned char *CB, const aes128e_key *ks) {
+
+	unsigned char counters[CTRLanes * 16], stream[CTRLanes * 16];
+	uint32_t counter;
+	unsigned long n;
+
+#ifdef AES128E_HAVE_VAES
+	if (ks->backend == AES128E_VAES)
+	{
+		aes128e_vaes_ctr32(out, in, nblocks, CB, ks->roundKeys);	// 16 blocks in flight
+		return;
+	}
+#endif
+#ifdef AES128E_HAVE_AESNI
+	if (ks->backend == AES128E_AESNI)
+	{
+		aes128e_aesni_ctr32(out, in, nblocks, CB, ks->roundKeys);	// 8 blocks in flight
+		return;
+	}
+#endif
+#ifdef AES128E_HAVE_ARMCE
+	if (ks->backend == AES128E_ARMCE)
+	{
+		aes128e_armce_ctr32(out, in, nblocks, CB, ks->roundKeys);	// 8 blocks in flight
+		return;
+	}
+#endif
+	if (ks->backend == AES128E_BITSLICED)
+	{
+		aes128e_bitsliced_ctr32(out, in, nblocks, CB, ks->roundKeys);
+		return;
+	}
+
+	counter = GETU32(CB + 12);
+
+	for (; nblocks > 0; nblocks -= n, in += 16 * n, out += 16 * n)
+	{
+		n = nblocks < CTRLanes ? nblocks : CTRLanes;
+
+		for (unsigned long b = 0; b < n; b++)		// Counter blocks are independent, so they are built up front
+		{
+			memcpy(counters + 16 * b, CB, 12);
+			PUTU32(counters + 16 * b + 12, counter);
+			counter++;								// inc32: the upper 96 bits never change
+		}
+
+		if (n == CTRLanes)
+			Cipher4(stream, counters, ks->roundKeys);
+		else
+			for (unsigned long b = 0; b < n; b++)
+				Cipher(stream + 16 * b, counters + 16 * b, ks->roundKeys);
+
+		XorBlocks(out, in, stream, n);
+	}
+
+	PUTU32(CB + 12, counter);
+}
+
+/* Independent blocks, CTRLanes at a time through the interleaved cipher */
+void aes128e_encrypt_blocks(unsigned char *c, const unsigned char *p, unsigned long nblocks, const aes128e_key *ks) {
+
+#ifdef AES128E_HAVE_VAES
+	if (ks->backend == AES128E_VAES)
+	{
+		aes128e_vaes_encrypt_blocks(c, p, nblocks, ks->roundKeys);
+		return;
+	}
+#endif
+#ifdef AES128E_HAVE_AESNI
+	if (ks->backend == AES128E_AESNI)
+	{
+		aes128e_aesni_encrypt_blocks(c, p, nblocks, ks->roundKeys);
+		return;
+	}
+#endif
+#ifdef AES128E_HAVE_ARMCE
+	if (ks->backend == AES128E_ARMCE)
+	{
+		aes128e_armce_encrypt_blocks(c, p, nblocks, ks->roundKeys);
+		return;
+	}
+#endif
+	if (ks->backend == AES128E_BITSLICED)
+	{
+		aes128e_bitsliced_encrypt_blocks(c, p, nblocks, ks->roundKeys);
+		return;
+	}
+
+	for (; nblocks >= CTRLanes; nblocks -= CTRLanes, p += 16 * CTRLanes, c += 16 * CTRLanes)
+	{
+		Cipher4(c, p, ks->roundKeys);
+	}
+	for (; nblocks > 0; nblocks--, p += 16, c += 16)
+	{
+		Cipher(c, p, ks->roundKeys);
+	}
+}
@@ -1,3 +1,6 @@
+#ifndef AES128E_H
+#define AES128E_H
+
 /* Implement the following API.
  * You can add your own functions, but don't modify below this line.
  */
@@ -5,3 +8,50 @@
 /* Under the 16-byte key at k, encrypt the 16-byte plaintext at p and store it at c. */
 void aes128e(unsigned char *c, const unsigned char *p, const unsigned char *k);
 
+/* AES implementations. AES128E_PORTABLE is the C code chosen at build time
+ * (T-table or reference), AES128E_AESNI uses the x86 AES instructions,
+ * AES128E_BITSLICED is constant-time C without lookup tables, AES128E_VAES
+ * runs the AES instructions on 256-bit registers (VAES, AVX2), and AES128E_ARMCE
+ * uses the ARMv8 Crypto Extensions (AESE, AESMC).
+ * AES128E_BACKENDS is their count. */
+enum {
+	AES128E_PORTABLE = 0,
+	AES128E_AESNI = 1,
+	AES128E_BITSLICED = 2,
+	AES128E_VAES = 3,
+	AES128E_ARMCE = 4,
+	AES128E_BACKENDS
+};
+
+/* Expanded AES-128 key: the 11 round keys derived once from the 16-byte key,
+ * and the implementation that encrypts with them. */
+typedef struct {
+	unsigned char roundKeys[176];
+	int backend;
+} aes128e_key;
+
+/* Expand the 16-byte key at k into ks, so ks can encrypt any number of blocks.
+ * The widest AES instructions the CPU supports are picked at runtime (VAES, then
+ * AES-NI, or the ARMv8 AES instructions), otherwise the portable C code. The
+ * portable T-tables are indexed by key and data bytes; the constant-time bitsliced
+ * code must be asked for with aes128e_setkey_backend(). */
+void aes128e_setkey(aes128e_key *ks, const unsigned char *k);
+
+/* Same as aes128e_setkey(), but force the implementation given by backend.
+ * Returns 0, or -1 if this build or CPU does not support it. */
+int aes128e_setkey_backend(aes128e_key *ks, const unsigned char *k, int backend);
+
+/* Under the expanded key ks, encrypt the 16-byte plaintext at p and store it at c. */
+void aes128e_encrypt(unsigned char *c, const unsigned char *p, const aes128e_key *ks);
+
+/* CTR mode under ks with the 16-byte counter block CB, whose last 4 bytes are a big-endian
+ * counter incremented modulo 2^32 (inc32 of GCM): each of the nblocks 16-byte blocks at in
+ * is XORed with the encryption of CB into out, and CB is incremented. On return CB holds the
+ * next unused counter block. out may be equal to in. */
+void aes128e_ctr32(unsigned char *out, const unsigned char *in, unsigned long nblocks, unsigned char *CB, const aes128e_key *ks);
+
+/* Encrypt the nblocks independent 16-byte blocks at p under ks and store them at c, several
+ * blocks in flight at a time. c may be equal to p. */
+void aes128e_encrypt_blocks(unsigned char *c, const unsigned char *p, unsigned long nblocks, const aes128e_key *ks);
+
+#endif
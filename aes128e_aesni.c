@@ -0,0 +1,199 @@
+/*****************************************************************************/
+/* AES-NI backend of AES 128 bit
+
+	The rounds are run with AESENC/AESENCLAST and the key schedule with
+	AESKEYGENASSIST. The round keys are stored in the same 176-byte layout
+	as KeyExpansion128 in aes128e.c, so both backends share aes128e_key.
+
+	This file is compiled with -maes, but nothing in it runs unless CPUID
+	reports AES-NI (see aes128e_setkey).
+
+																			 */
+/*****************************************************************************/
+
+  // ************************************************************************//
+ // Includes		                                                        //
+// ************************************************************************//
+#include "aes128e_aesni.h"
+
+#ifdef AES128E_HAVE_AESNI
+
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#include <wmmintrin.h>
+
+  // ************************************************************************//
+ // Definitions		                                                        //
+// ************************************************************************//
+
+/* Number of Rounds */
+#define Nr 10
+
+/* Counter blocks encrypted together by the CTR loop */
+#define CTRLanes 8
+
+/* Reverses the 16 bytes of a block, so that the big-endian counter becomes the low 32-bit lane */
+#define BSWAP_MASK _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15)
+
+/* AESKEYGENASSIST needs the round constant as an immediate, hence a macro */
+#define KeyExpansionRound(key, rcon) KeyExpansionStep(key, _mm_aeskeygenassist_si128(key, rcon))
+
+  // ************************************************************************ //
+ // Private functions                                                        //
+// ************************************************************************ //
+
+/* Next round key from the previous one and the RotWord(SubWord(w3)) ^ rcon word of AESKEYGENASSIST */
+static __m128i KeyExpansionStep(__m128i key, __m128i keygened) {
+
+	keygened = _mm_shuffle_epi32(keygened, _MM_SHUFFLE(3, 3, 3, 3));	// Broadcast the transformed last word
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));					// w[i] = w[i-4] ^ w[i-1], as a prefix XOR of the four words
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	return _mm_xor_si128(key, keygened);
+}
+
+  // ************************************************************************ //
+ // Public functions                                                         //
+// ************************************************************************ //
+
+/* Expand the 16-byte key at k into the 176-byte roundKeys with AESKEYGENASSIST. */
+void aes128e_aesni_setkey(unsigned char *roundKeys, const unsigned char *k) {
+
+	__m128i *rk = (__m128i *)roundKeys;
+	__m128i key = _mm_loadu_si128((const __m128i *)k);
+
+	_mm_storeu_si128(rk + 0, key);
+	key = KeyExpansionRound(key, 0x01); _mm_storeu_si128(rk + 1, key);
+	key = KeyExpansionRound(key, 0x02); _mm_storeu_si128(rk + 2, key);
+	key = KeyExpansionRound(key, 0x04); _mm_storeu_si128(rk + 3, key);
+	key = KeyExpansionRound(key, 0x08); _mm_storeu_si128(rk + 4, key);
+	key = KeyExpansionRound(key, 0x10); _mm_storeu_si128(rk + 5, key);
+	key = KeyExpansionRound(key, 0x20); _mm_storeu_si128(rk + 6, key);
+	key = KeyExpansionRound(key, 0x40); _mm_storeu_si128(rk + 7, key);
+	key = KeyExpansionRound(key, 0x80); _mm_storeu_si128(rk + 8, key);
+	key = KeyExpansionRound(key, 0x1b); _mm_storeu_si128(rk + 9, key);
+	key = KeyExpansionRound(key, 0x36); _mm_storeu_si128(rk + 10, key);
+}
+
+/* Under the expanded roundKeys, encrypt the 16-byte block at p and store it at c. */
+void aes128e_aesni_encrypt(unsigned char *c, const unsigned char *p, const unsigned char *roundKeys) {
+
+	const __m128i *rk = (const __m128i *)roundKeys;
+	__m128i state = _mm_loadu_si128((const __m128i *)p);
+
+	state = _mm_xor_si128(state, _mm_loadu_si128(rk));				// Initial AddRoundKey
+
+	for (int roundNumber = 1; roundNumber < Nr; roundNumber++)
+	{
+		state = _mm_aesenc_si128(state, _mm_loadu_si128(rk + roundNumber));	// SubBytes, ShiftRows, MixColumns, AddRoundKey
+	}
+
+	state = _mm_aesenclast_si128(state, _mm_loadu_si128(rk + Nr));	// Last round without MixColumns
+	_mm_storeu_si128((__m128i *)c, state);
+}
+
+/* CTR with 8 counter blocks in flight: each AESENC has a latency of several cycles but
+   a throughput of one or two per cycle, so 8 independent blocks keep the unit busy */
+void aes128e_aesni_ctr32(unsigned char *out, const unsigned char *in, unsigned long nblocks, unsigned char *CB, const unsigned char *roundKeys) {
+
+	const __m128i bswap = BSWAP_MASK;
+	const __m128i one = _mm_set_epi32(0, 0, 0, 1);
+	__m128i rk[Nr + 1], b[CTRLanes];
+	__m128i counter = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)CB), bswap);	// Counter in the low lane
+	int i, roundNumber;
+
+	for (roundNumber = 0; roundNumber <= Nr; roundNumber++)
+	{
+		rk[roundNumber] = _mm_loadu_si128((const __m128i *)roundKeys + roundNumber);	// Round keys stay in registers
+	}
+
+	for (; nblocks >= CTRLanes; nblocks -= CTRLanes, in += 16 * CTRLanes, out += 16 * CTRLanes)
+	{
+		for (i = 0; i < CTRLanes; i++)
+		{
+			b[i] = _mm_xor_si128(_mm_shuffle_epi8(counter, bswap), rk[0]);
+			counter = _mm_add_epi32(counter, one);		// inc32: a 32-bit lane add never carries into the IV bytes
+		}
+
+		for (roundNumber = 1; roundNumber < Nr; roundNumber++)
+		{
+			for (i = 0; i < CTRLanes; i++)
+			{
+				b[i] = _mm_aesenc_si128(b[i], rk[roundNumber]);	// Round r of all 8 blocks back to back
+			}
+		}
+
+		for (i = 0; i < CTRLanes; i++)
+		{
+			b[i] = _mm_aesenclast_si128(b[i], rk[Nr]);
+			_mm_storeu_si128((__m128i *)out + i, _mm_xor_si128(b[i], _mm_loadu_si128((const __m128i *)in + i)));
+		}
+	}
+
+	for (; nblocks > 0; nblocks--, in += 16, out += 16)	// Fewer than 8 blocks left
+	{
+		b[0] = _mm_xor_si128(_mm_shuffle_epi8(counter, bswap), rk[0]);
+		counter = _mm_add_epi32(counter, one);
+		for (roundNumber = 1; roundNumber < Nr; roundNumber++)
+		{
+			b[0] = _mm_aesenc_si128(b[0], rk[roundNumber]);
+		}
+		b[0] = _mm_aesenclast_si128(b[0], rk[Nr]);
+		_mm_storeu_si128((__m128i *)out, _mm_xor_si128(b[0], _mm_loadu_si128((const __m128i *)in)));
+	}
+
+	_mm_storeu_si128((__m128i *)CB, _mm_shuffle_epi8(counter, bswap));
+}
+
+/* Independent blocks, 8 in flight like the CTR loop */
+void aes128e_aesni_encrypt_blocks(unsigned char *c, const unsigned char *p, unsigned long nblocks, const unsigned char *roundKeys) {
+
+	__m128i rk[Nr + 1], b[CTRLanes];
+	int i, roundNumber;
+
+	for (roundNumber = 0; roundNumber <= Nr; roundNumber++)
+	{
+		rk[roundNumber] = _mm_loadu_si128((const __m128i *)roundKeys + roundNumber);
+	}
+
+	for (; nblocks >= CTRLanes; nblocks -= CTRLanes, p += 16 * CTRLanes, c += 16 * CTRLanes)
+	{
+		for (i = 0; i < CTRLanes; i++)			// A constant lane count keeps the 8 blocks in registers
+		{
+			b[i] = _mm_xor_si128(_mm_loadu_si128((const __m128i *)p + i), rk[0]);
+		}
+		for (roundNumber = 1; roundNumber < Nr; roundNumber++)
+		{
+			for (i = 0; i < CTRLanes; i++)
+			{
+				b[i] = _mm_aesenc_si128(b[i], rk[roundNumber]);
+			}
+		}
+		for (i = 0; i < CTRLanes; i++)
+		{
+			_mm_storeu_si128((__m128i *)c + i, _mm_aesenclast_si128(b[i], rk[Nr]));
+		}
+	}
+
+	if (nblocks > 0)							// The tail still takes all 8 lanes: one pass costs about as much as a single block
+	{
+		for (i = 0; i < CTRLanes; i++)
+		{
+			b[i] = _mm_xor_si128((unsigned long)i < nblocks ? _mm_loadu_si128((const __m128i *)p + i) : _mm_setzero_si128(), rk[0]);
+		}
+		for (roundNumber = 1; roundNumber < Nr; roundNumber++)
+		{
+			for (i = 0; i < CTRLanes; i++)
+			{
+				b[i] = _mm_aesenc_si128(b[i], rk[roundNumber]);
+			}
+		}
+		for (i = 0; i < CTRLanes; i++)
+		{
+			if ((unsigned long)i < nblocks)
+				_mm_storeu_si128((__m128i *)c + i, _mm_aesenclast_si128(b[i], rk[Nr]));
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef AES128E_AESNI_H
+#define AES128E_AESNI_H
+
+/* AES-NI backend of aes128e. It is compiled on x86 only, and aes128e_setkey() only
+ * selects it when CPUID reports the AES instructions.
+ */
+
+#if defined(__x86_64__) || defined(__i386__)
+#define AES128E_HAVE_AESNI 1
+
+/* Expand the 16-byte key at k into the 176-byte roundKeys with AESKEYGENASSIST.
+ * The layout is the same as the portable key schedule. */
+void aes128e_aesni_setkey(unsigned char *roundKeys, const unsigned char *k);
+
+/* Under the expanded roundKeys, encrypt the 16-byte block at p and store it at c. */
+void aes128e_aesni_encrypt(unsigned char *c, const unsigned char *p, const unsigned char *roundKeys);
+
+/* aes128e_ctr32() with AES-NI: 8 counter blocks are encrypted with interleaved rounds. */
+void aes128e_aesni_ctr32(unsigned char *out, const unsigned char *in, unsigned long nblocks, unsigned char *CB, const unsigned char *roundKeys);
+
+/* aes128e_encrypt_blocks() with AES-NI, 8 blocks with interleaved rounds. */
+void aes128e_aesni_encrypt_blocks(unsigned char *c, const unsigned char *p, unsigned long nblocks, const unsigned char *roundKeys);
+
+#endif
+
+#endif
@@ -0,0 +1,189 @@
+/*****************************************************************************/
+/* ARMv8 Crypto Extensions backend of AES 128 bit
+
+	AESE is AddRoundKey, ShiftRows and SubBytes, and AESMC is MixColumns,
+	so a FIPS-197 round r is AESMC(AESE(state, rk[r-1])) and the last round
+	key is a plain XOR. The round keys are stored in the same 176-byte
+	layout as KeyExpansion128 in aes128e.c.
+
+	This file is compiled with -march=armv8-a+crypto, but nothing in it runs
+	unless the hwcaps report the AES instructions (see aes128e_setkey).
+
+																			 */
+/*****************************************************************************/
+
+  // ************************************************************************//
+ // Includes		                                                        //
+// ************************************************************************//
+#include "aes128e_armce.h"
+
+#ifdef AES128E_HAVE_ARMCE
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#include <arm_neon.h>
+
+  // ************************************************************************//
+ // Definitions		                                                        //
+// ************************************************************************//
+
+/* Number of Rounds */
+#define Nr 10
+
+/* Counter blocks encrypted together by the CTR loop */
+#define CTRLanes 8
+
+static const unsigned char rcon[10] = {
+	0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36
+};
+
+  // ************************************************************************ //
+ // Private functions                                                        //
+// ************************************************************************ //
+
+/* SubWord through AESE: with the word in all four columns, ShiftRows leaves it unchanged */
+static uint32_t SubWord (uint32_t w) {
+
+	uint8x16_t x = vaeseq_u8(vreinterpretq_u8_u32(vdupq_n_u32(w)), vdupq_n_u8(0));
+
+	return vgetq_lane_u32(vreinterpretq_u32_u8(x), 0);
+}
+
+/* The 11 round keys in registers */
+static void LoadRoundKeys (uint8x16_t rk[Nr + 1], const unsigned char *roundKeys) {
+
+	for (int r = 0; r <= Nr; r++)
+	{
+		rk[r] = vld1q_u8(roundKeys + 16 * r);
+	}
+}
+
+/* The 10 rounds of one block */
+static inline uint8x16_t Rounds (uint8x16_t b, const uint8x16_t rk[Nr + 1]) {
+
+	for (int r = 0; r < Nr - 1; r++)
+	{
+		b = vaesmcq_u8(vaeseq_u8(b, rk[r]));	// AESE then AESMC: fused into one operation by most cores
+	}
+	return veorq_u8(vaeseq_u8(b, rk[Nr - 1]), rk[Nr]);
+}
+
+/* Counter block with the 32-bit big-endian counter in the last 4 bytes */
+static inline uint8x16_t CounterBlock (uint8x16_t iv, uint32_t counter) {
+
+	return vreinterpretq_u8_u32(vsetq_lane_u32(__builtin_bswap32(counter), vreinterpretq_u32_u8(iv), 3));
+}
+
+  // ************************************************************************ //
+ // Public functions                                                         //
+// ************************************************************************ //
+
+/* The kernel reports the AES instructions in AT_HWCAP */
+int aes128e_armce_available(void) {
+
+	return (getauxval(AT_HWCAP) & HWCAP_AES) != 0;
+}
+
+/* FIPS-197 key expansion on little-endian words, with SubWord through AESE */
+void aes128e_armce_setkey(unsigned char *roundKeys, const unsigned char *k) {
+
+	uint32_t w[4 * (Nr + 1)], tmp;
+	int i;
+
+	memcpy(w, k, 16);
+	for (i = 4; i < 4 * (Nr + 1); i++)
+	{
+		tmp = w[i - 1];
+		if (i % 4 == 0)
+			tmp = SubWord((tmp >> 8) | (tmp << 24)) ^ rcon[i / 4 - 1];	// RotWord of a little-endian word
+		w[i] = w[i - 4] ^ tmp;
+	}
+	memcpy(roundKeys, w, sizeof(w));
+}
+
+/* Under the expanded roundKeys, encrypt the 16-byte block at p and store it at c. */
+void aes128e_armce_encrypt(unsigned char *c, const unsigned char *p, const unsigned char *roundKeys) {
+
+	uint8x16_t rk[Nr + 1];
+
+	LoadRoundKeys(rk, roundKeys);
+	vst1q_u8(c, Rounds(vld1q_u8(p), rk));
+}
+
+/* CTR with 8 counter blocks in flight */
+void aes128e_armce_ctr32(unsigned char *out, const unsigned char *in, unsigned long nblocks, unsigned char *CB, const unsigned char *roundKeys) {
+
+	uint8x16_t rk[Nr + 1], b[CTRLanes];
+	uint8x16_t iv = vld1q_u8(CB);
+	uint32_t counter = (uint32_t)CB[12] << 24 | (uint32_t)CB[13] << 16 | (uint32_t)CB[14] << 8 | CB[15];
+	int i, r;
+
+	LoadRoundKeys(rk, roundKeys);
+
+	for (; nblocks >= CTRLanes; nblocks -= CTRLanes, in += 16 * CTRLanes, out += 16 * CTRLanes)
+	{
+		for (i = 0; i < CTRLanes; i++)
+		{
+			b[i] = CounterBlock(iv, counter++);		// inc32: the upper 96 bits never change
+		}
+		for (r = 0; r < Nr - 1; r++)
+		{
+			for (i = 0; i < CTRLanes; i++)
+			{
+				b[i] = vaesmcq_u8(vaeseq_u8(b[i], rk[r]));	// Round r of all 8 blocks back to back
+			}
+		}
+		for (i = 0; i < CTRLanes; i++)
+		{
+			b[i] = veorq_u8(vaeseq_u8(b[i], rk[Nr - 1]), rk[Nr]);
+			vst1q_u8(out + 16 * i, veorq_u8(b[i], vld1q_u8(in + 16 * i)));
+		}
+	}
+
+	for (; nblocks > 0; nblocks--, in += 16, out += 16)	// Fewer than 8 blocks left
+	{
+		vst1q_u8(out, veorq_u8(Rounds(CounterBlock(iv, counter++), rk), vld1q_u8(in)));
+	}
+
+	CB[12] = (unsigned char)(counter >> 24);
+	CB[13] = (unsigned char)(counter >> 16);
+	CB[14] = (unsigned char)(counter >> 8);
+	CB[15] = (unsigned char)counter;
+}
+
+/* Independent blocks, 8 in flight like the CTR loop */
+void aes128e_armce_encrypt_blocks(unsigned char *c, const unsigned char *p, unsigned long nblocks, const unsigned char *roundKeys) {
+
+	uint8x16_t rk[Nr + 1], b[CTRLanes];
+	int i, r;
+
+	LoadRoundKeys(rk, roundKeys);
+
+	for (; nblocks >= CTRLanes; nblocks -= CTRLanes, p += 16 * CTRLanes, c += 16 * CTRLanes)
+	{
+		for (i = 0; i < CTRLanes; i++)
+		{
+			b[i] = vld1q_u8(p + 16 * i);
+		}
+		for (r = 0; r < Nr - 1; r++)
+		{
+			for (i = 0; i < CTRLanes; i++)
+			{
+				b[i] = vaesmcq_u8(vaeseq_u8(b[i], rk[r]));
+			}
+		}
+		for (i = 0; i < CTRLanes; i++)
+		{
+			vst1q_u8(c + 16 * i, veorq_u8(vaeseq_u8(b[i], rk[Nr - 1]), rk[Nr]));
+		}
+	}
+
+	for (; nblocks > 0; nblocks--, p += 16, c += 16)
+	{
+		vst1q_u8(c, Rounds(vld1q_u8(p), rk));
+	}
+}
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef AES128E_ARMCE_H
+#define AES128E_ARMCE_H
+
+/* ARMv8 Crypto Extensions backend of aes128e (AESE/AESMC). It is compiled on
+ * little-endian aarch64 Linux only, and aes128e_setkey() only selects it when the
+ * kernel reports the AES instructions in the hwcaps.
+ */
+
+#if defined(__aarch64__) && defined(__linux__) && !defined(__ARM_BIG_ENDIAN)
+#define AES128E_HAVE_ARMCE 1
+
+/* Returns 1 if the CPU has the AES instructions (HWCAP_AES), 0 otherwise. */
+int aes128e_armce_available(void);
+
+/* Expand the 16-byte key at k into the 176-byte roundKeys, with AESE for SubWord.
+ * The layout is the same as the portable key schedule. */
+void aes128e_armce_setkey(unsigned char *roundKeys, const unsigned char *k);
+
+/* Under the expanded roundKeys, encrypt the 16-byte block at p and store it at c. */
+void aes128e_armce_encrypt(unsigned char *c, const unsigned char *p, const unsigned char *roundKeys);
+
+/* aes128e_ctr32() with AESE/AESMC: 8 counter blocks are encrypted with interleaved rounds. */
+void aes128e_armce_ctr32(unsigned char *out, const unsigned char *in, unsigned long nblocks, unsigned char *CB, const unsigned char *roundKeys);
+
+/* aes128e_encrypt_blocks() with AESE/AESMC, 8 blocks with interleaved rounds. */
+void aes128e_armce_encrypt_blocks(unsigned char *c, const unsigned char *p, unsigned long nblocks, const unsigned char *roundKeys);
+
+#endif
+
+#endif
@@ -0,0 +1,420 @@
+/*****************************************************************************/
+/* Bitsliced backend of AES 128 bit
+
+	The state of 4 blocks is spread over 8 64-bit words: word i holds bit i
+	of all 64 state bytes. SubBytes is then the 113-gate Boyar-Peralta
+	circuit evaluated on whole words, ShiftRows and MixColumns are shifts
+	and rotations within a word, and nothing indexes memory with secret
+	data. Two such groups are processed side by side, 8 blocks per pass.
+
+	The key schedule also uses the circuit for SubWord. Round keys are
+	stored with one bit per nibble (22 words, the 176 bytes of
+	aes128e_key) and widened at the start of each call.
+
+																			 */
+/*****************************************************************************/
+
+  // ************************************************************************//
+ // Includes		                                                        //
+// ************************************************************************//
+#include <stdint.h>
+#include <string.h>
+#include "aes128e_bitsliced.h"
+
+  // ************************************************************************//
+ // Definitions		                                                        //
+// ************************************************************************//
+
+/* Number of Rounds */
+#define Nr 10
+
+/* Blocks per bitsliced group, and blocks per pass (two groups) */
+#define GroupBlocks 4
+#define Lanes 8
+
+/* Exchanges the bits of x selected by cl with the bits of y selected by ch, s positions apart */
+#define SwapBits(cl, ch, s, x, y) do { \
+	uint64_t a_ = (x), b_ = (y); \
+	(x) = (a_ & (cl)) | ((b_ & (cl)) << (s)); \
+	(y) = ((a_ & (ch)) >> (s)) | (b_ & (ch)); } while (0)
+
+/* Swaps the 32-bit halves of a word */
+#define Rotr32(x) (((x) << 32) | ((x) >> 32))
+
+static const unsigned char rcon[10] = {
+	0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36
+};
+
+  // ************************************************************************ //
+ // Private functions                                                        //
+// ************************************************************************ //
+
+/* Key material and keystream are cleared through a volatile pointer, so the stores are not optimized away */
+static void Zeroize (void *p, unsigned long len) {
+
+	volatile unsigned char *v = p;
+
+	while (len--)
+	{
+		*v++ = 0;
+	}
+}
+
+static uint32_t Load32LE (const unsigned char *p) {
+
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void Store32LE (unsigned char *p, uint32_t w) {
+
+	p[0] = (unsigned char)w;
+	p[1] = (unsigned char)(w >> 8);
+	p[2] = (unsigned char)(w >> 16);
+	p[3] = (unsigned char)(w >> 24);
+}
+
+/* Transposes the 8 words, so that bit j of byte k of word i moves to bit i of byte k of word j
+   (the orthogonalization is its own inverse) */
+static void Ortho (uint64_t q[8]) {
+
+	SwapBits(0x5555555555555555, 0xaaaaaaaaaaaaaaaa, 1, q[0], q[1]);
+	SwapBits(0x5555555555555555, 0xaaaaaaaaaaaaaaaa, 1, q[2], q[3]);
+	SwapBits(0x5555555555555555, 0xaaaaaaaaaaaaaaaa, 1, q[4], q[5]);
+	SwapBits(0x5555555555555555, 0xaaaaaaaaaaaaaaaa, 1, q[6], q[7]);
+
+	SwapBits(0x3333333333333333, 0xcccccccccccccccc, 2, q[0], q[2]);
+	SwapBits(0x3333333333333333, 0xcccccccccccccccc, 2, q[1], q[3]);
+	SwapBits(0x3333333333333333, 0xcccccccccccccccc, 2, q[4], q[6]);
+	SwapBits(0x3333333333333333, 0xcccccccccccccccc, 2, q[5], q[7]);
+
+	SwapBits(0x0f0f0f0f0f0f0f0f, 0xf0f0f0f0f0f0f0f0, 4, q[0], q[4]);
+	SwapBits(0x0f0f0f0f0f0f0f0f, 0xf0f0f0f0f0f0f0f0, 4, q[1], q[5]);
+	SwapBits(0x0f0f0f0f0f0f0f0f, 0xf0f0f0f0f0f0f0f0, 4, q[2], q[6]);
+	SwapBits(0x0f0f0f0f0f0f0f0f, 0xf0f0f0f0f0f0f0f0, 4, q[3], q[7]);
+}
+
+/* The four little-endian words of one block are spread over two words, 16 bits apart, so
+   that after Ortho() each row of the state sits in one 16-bit lane */
+static void InterleaveIn (uint64_t *q0, uint64_t *q1, const uint32_t w[4]) {
+
+	uint64_t x0 = w[0], x1 = w[1], x2 = w[2], x3 = w[3];
+
+	x0 |= x0 << 16; x1 |= x1 << 16; x2 |= x2 << 16; x3 |= x3 << 16;
+	x0 &= 0x0000ffff0000ffff; x1 &= 0x0000ffff0000ffff; x2 &= 0x0000ffff0000ffff; x3 &= 0x0000ffff0000ffff;
+	x0 |= x0 << 8; x1 |= x1 << 8; x2 |= x2 << 8; x3 |= x3 << 8;
+	x0 &= 0x00ff00ff00ff00ff; x1 &= 0x00ff00ff00ff00ff; x2 &= 0x00ff00ff00ff00ff; x3 &= 0x00ff00ff00ff00ff;
+	*q0 = x0 | (x2 << 8);
+	*q1 = x1 | (x3 << 8);
+}
+
+/* Inverse of InterleaveIn() */
+static void InterleaveOut (uint32_t w[4], uint64_t q0, uint64_t q1) {
+
+	uint64_t x0 = q0 & 0x00ff00ff00ff00ff, x1 = q1 & 0x00ff00ff00ff00ff;
+	uint64_t x2 = (q0 >> 8) & 0x00ff00ff00ff00ff, x3 = (q1 >> 8) & 0x00ff00ff00ff00ff;
+
+	x0 |= x0 >> 8; x1 |= x1 >> 8; x2 |= x2 >> 8; x3 |= x3 >> 8;
+	x0 &= 0x0000ffff0000ffff; x1 &= 0x0000ffff0000ffff; x2 &= 0x0000ffff0000ffff; x3 &= 0x0000ffff0000ffff;
+	w[0] = (uint32_t)x0 | (uint32_t)(x0 >> 16);
+	w[1] = (uint32_t)x1 | (uint32_t)(x1 >> 16);
+	w[2] = (uint32_t)x2 | (uint32_t)(x2 >> 16);
+	w[3] = (uint32_t)x3 | (uint32_t)(x3 >> 16);
+}
+
+/* SubBytes on all 64 bytes at once: the S-box as the Boyar-Peralta circuit (32 AND, 83 XOR/XNOR).
+   q[7] holds the most significant bit of each byte */
+static void SubBytes (uint64_t q[8]) {
+
+	uint64_t x0, x1, x2, x3, x4, x5, x6, x7;
+	uint64_t y1, y2, y3, y4, y5, y6, y7, y8, y9, y10, y11, y12, y13, y14, y15, y16, y17, y18, y19, y20, y21;
+	uint64_t z0, z1, z2, z3, z4, z5, z6, z7, z8, z9, z10, z11, z12, z13, z14, z15, z16, z17;
+	uint64_t t0, t1, t2, t3, t4, t5, t6, t7, t8, t9, t10, t11, t12, t13, t14, t15, t16, t17, t18, t19;
+	uint64_t t20, t21, t22, t23, t24, t25, t26, t27, t28, t29, t30, t31, t32, t33, t34, t35, t36, t37, t38, t39;
+	uint64_t t40, t41, t42, t43, t44, t45, t46, t47, t48, t49, t50, t51, t52, t53, t54, t55, t56, t57, t58, t59;
+	uint64_t t60, t61, t62, t63, t64, t65, t66, t67;
+	uint64_t s0, s1, s2, s3, s4, s5, s6, s7;
+
+	x0 = q[7]; x1 = q[6]; x2 = q[5]; x3 = q[4];
+	x4 = q[3]; x5 = q[2]; x6 = q[1]; x7 = q[0];
+
+	/* Top linear transformation */
+	y14 = x3 ^ x5;   y13 = x0 ^ x6;   y9 = x0 ^ x3;    y8 = x0 ^ x5;
+	t0 = x1 ^ x2;    y1 = t0 ^ x7;    y4 = y1 ^ x3;    y12 = y13 ^ y14;
+	y2 = y1 ^ x0;    y5 = y1 ^ x6;    y3 = y5 ^ y8;    t1 = x4 ^ y12;
+	y15 = t1 ^ x5;   y20 = t1 ^ x1;   y6 = y15 ^ x7;   y10 = y15 ^ t0;
+	y11 = y20 ^ y9;  y7 = x7 ^ y11;   y17 = y10 ^ y11; y19 = y10 ^ y8;
+	y16 = t0 ^ y11;  y21 = y13 ^ y16; y18 = x0 ^ y16;
+
+	/* Non-linear section: inversion in GF(2^4)^2 */
+	t2 = y12 & y15;  t3 = y3 & y6;    t4 = t3 ^ t2;    t5 = y4 & x7;
+	t6 = t5 ^ t2;    t7 = y13 & y16;  t8 = y5 & y1;    t9 = t8 ^ t7;
+	t10 = y2 & y7;   t11 = t10 ^ t7;  t12 = y9 & y11;  t13 = y14 & y17;
+	t14 = t13 ^ t12; t15 = y8 & y10;  t16 = t15 ^ t12; t17 = t4 ^ t14;
+	t18 = t6 ^ t16;  t19 = t9 ^ t14;  t20 = t11 ^ t16; t21 = t17 ^ y20;
+	t22 = t18 ^ y19; t23 = t19 ^ y21; t24 = t20 ^ y18;
+
+	t25 = t21 ^ t22; t26 = t21 & t23; t27 = t24 ^ t26; t28 = t25 & t27;
+	t29 = t28 ^ t22; t30 = t23 ^ t24; t31 = t22 ^ t26; t32 = t31 & t30;
+	t33 = t32 ^ t24; t34 = t23 ^ t33; t35 = t27 ^ t33; t36 = t24 & t35;
+	t37 = t36 ^ t34; t38 = t27 ^ t36; t39 = t29 & t38; t40 = t25 ^ t39;
+
+	t41 = t40 ^ t37; t42 = t29 ^ t33; t43 = t29 ^ t40; t44 = t33 ^ t37;
+	t45 = t42 ^ t41;
+	z0 = t44 & y15;  z1 = t37 & y6;   z2 = t33 & x7;   z3 = t43 & y16;
+	z4 = t40 & y1;   z5 = t29 & y7;   z6 = t42 & y11;  z7 = t45 & y17;
+	z8 = t41 & y10;  z9 = t44 & y12;  z10 = t37 & y3;  z11 = t33 & y4;
+	z12 = t43 & y13; z13 = t40 & y5;  z14 = t29 & y2;  z15 = t42 & y9;
+	z16 = t45 & y14; z17 = t41 & y8;
+
+	/* Bottom linear transformation, with the affine constant 0x63 as the complements */
+	t46 = z15 ^ z16; t47 = z10 ^ z11; t48 = z5 ^ z13;  t49 = z9 ^ z10;
+	t50 = z2 ^ z12;  t51 = z2 ^ z5;   t52 = z7 ^ z8;   t53 = z0 ^ z3;
+	t54 = z6 ^ z7;   t55 = z16 ^ z17; t56 = z12 ^ t48; t57 = t50 ^ t53;
+	t58 = z4 ^ t46;  t59 = z3 ^ t54;  t60 = t46 ^ t57; t61 = z14 ^ t57;
+	t62 = t52 ^ t58; t63 = t49 ^ t58; t64 = z4 ^ t59;  t65 = t61 ^ t62;
+	t66 = z1 ^ t63;  s0 = t59 ^ t63;  s6 = t56 ^ ~t62; s7 = t48 ^ ~t60;
+	t67 = t64 ^ t65; s3 = t53 ^ t66;  s4 = t51 ^ t66;  s5 = t47 ^ t65;
+	s1 = t64 ^ ~s3;  s2 = t55 ^ ~t67;
+
+	q[7] = s0; q[6] = s1; q[5] = s2; q[4] = s3;
+	q[3] = s4; q[2] = s5; q[1] = s6; q[0] = s7;
+}
+
+/* Each row of the state is a 16-bit lane of every word: rows 1..3 rotate by 1..3 nibbles */
+static void ShiftRows (uint64_t q[8]) {
+
+	for (int i = 0; i < 8; i++)
+	{
+		uint64_t x = q[i];
+
+		q[i] = (x & 0x000000000000ffff)
+			| ((x & 0x00000000fff00000) >> 4)
+			| ((x & 0x00000000000f0000) << 12)
+			| ((x & 0x0000ff0000000000) >> 8)
+			| ((x & 0x000000ff00000000) << 8)
+			| ((x & 0xf000000000000000) >> 12)
+			| ((x & 0x0fff000000000000) << 4);
+	}
+}
+
+/* MixColumns: r is the state with rows rotated by one, and xtime() folds q[7] into bits 0, 1, 3 and 4 */
+static void MixColumns (uint64_t q[8]) {
+
+	uint64_t q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3], q4 = q[4], q5 = q[5], q6 = q[6], q7 = q[7];
+	uint64_t r0 = (q0 >> 16) | (q0 << 48), r1 = (q1 >> 16) | (q1 << 48);
+	uint64_t r2 = (q2 >> 16) | (q2 << 48), r3 = (q3 >> 16) | (q3 << 48);
+	uint64_t r4 = (q4 >> 16) | (q4 << 48), r5 = (q5 >> 16) | (q5 << 48);
+	uint64_t r6 = (q6 >> 16) | (q6 << 48), r7 = (q7 >> 16) | (q7 << 48);
+
+	q[0] = q7 ^ r7 ^ r0 ^ Rotr32(q0 ^ r0);
+	q[1] = q0 ^ r0 ^ q7 ^ r7 ^ r1 ^ Rotr32(q1 ^ r1);
+	q[2] = q1 ^ r1 ^ r2 ^ Rotr32(q2 ^ r2);
+	q[3] = q2 ^ r2 ^ q7 ^ r7 ^ r3 ^ Rotr32(q3 ^ r3);
+	q[4] = q3 ^ r3 ^ q7 ^ r7 ^ r4 ^ Rotr32(q4 ^ r4);
+	q[5] = q4 ^ r4 ^ r5 ^ Rotr32(q5 ^ r5);
+	q[6] = q5 ^ r5 ^ r6 ^ Rotr32(q6 ^ r6);
+	q[7] = q6 ^ r6 ^ r7 ^ Rotr32(q7 ^ r7);
+}
+
+static void AddRoundKey (uint64_t q[8], const uint64_t *sk) {
+
+	for (int i = 0; i < 8; i++)
+	{
+		q[i] ^= sk[i];
+	}
+}
+
+/* SubWord of the key schedule through the circuit: the word is the first row of a state */
+static uint32_t SubWord (uint32_t w) {
+
+	uint64_t q[8] = { w };
+
+	Ortho(q);
+	SubBytes(q);
+	Ortho(q);
+	return (uint32_t)q[0];
+}
+
+/* The 22 compressed words at roundKeys become the 88 words of the 11 bitsliced round keys:
+   each nibble holds one bit, copied to the four blocks of a group */
+static void ExpandRoundKeys (uint64_t sk[8 * (Nr + 1)], const unsigned char *roundKeys) {
+
+	uint64_t x0, x1, x2, x3;
+
+	for (int u = 0; u < 2 * (Nr + 1); u++)
+	{
+		memcpy(&x0, roundKeys + 8 * u, 8);
+		x1 = (x0 & 0x2222222222222222) >> 1;
+		x2 = (x0 & 0x4444444444444444) >> 2;
+		x3 = (x0 & 0x8888888888888888) >> 3;
+		x0 &= 0x1111111111111111;
+		sk[4 * u + 0] = (x0 << 4) - x0;		// 0x1 becomes 0xf within each nibble, without carries
+		sk[4 * u + 1] = (x1 << 4) - x1;
+		sk[4 * u + 2] = (x2 << 4) - x2;
+		sk[4 * u + 3] = (x3 << 4) - x3;
+	}
+}
+
+/* The 8 blocks at p are encrypted into c: two groups of 4, each round applied to both. The
+   state q belongs to the caller, which clears it once when it is done with every pass */
+static void Cipher8 (unsigned char *c, const unsigned char *p, const uint64_t *sk, uint64_t q[2][8]) {
+
+	uint32_t w[4];
+	int g, i, roundNumber;
+
+	for (g = 0; g < 2; g++)
+	{
+		for (i = 0; i < GroupBlocks; i++)
+		{
+			const unsigned char *block = p + 16 * (GroupBlocks * g + i);
+
+			w[0] = Load32LE(block); w[1] = Load32LE(block + 4); w[2] = Load32LE(block + 8); w[3] = Load32LE(block + 12);
+			InterleaveIn(&q[g][i], &q[g][i + 4], w);
+		}
+		Ortho(q[g]);
+		AddRoundKey(q[g], sk);
+	}
+
+	for (roundNumber = 1; roundNumber < Nr; roundNumber++)
+	{
+		for (g = 0; g < 2; g++)				// Two independent groups keep more of the circuit in flight
+		{
+			SubBytes(q[g]);
+			ShiftRows(q[g]);
+			MixColumns(q[g]);
+			AddRoundKey(q[g], sk + 8 * roundNumber);
+		}
+	}
+
+	for (g = 0; g < 2; g++)
+	{
+		SubBytes(q[g]);
+		ShiftRows(q[g]);
+		AddRoundKey(q[g], sk + 8 * Nr);
+		Ortho(q[g]);
+		for (i = 0; i < GroupBlocks; i++)
+		{
+			unsigned char *block = c + 16 * (GroupBlocks * g + i);
+
+			InterleaveOut(w, q[g][i], q[g][i + 4]);
+			Store32LE(block, w[0]); Store32LE(block + 4, w[1]); Store32LE(block + 8, w[2]); Store32LE(block + 12, w[3]);
+		}
+	}
+}
+
+  // ************************************************************************ //
+ // Public functions                                                         //
+// ************************************************************************ //
+
+/* FIPS-197 key expansion on little-endian words, then each round key is bitsliced and compressed */
+void aes128e_bitsliced_setkey(unsigned char *roundKeys, const unsigned char *k) {
+
+	uint32_t w[4 * (Nr + 1)], tmp;
+	uint64_t q[8], x;
+	int i;
+
+	for (i = 0; i < 4; i++)
+	{
+		w[i] = Load32LE(k + 4 * i);
+	}
+	for (i = 4; i < 4 * (Nr + 1); i++)
+	{
+		tmp = w[i - 1];
+		if (i % 4 == 0)
+			tmp = SubWord((tmp << 24) | (tmp >> 8)) ^ rcon[i / 4 - 1];	// RotWord of a little-endian word
+		w[i] = w[i - 4] ^ tmp;
+	}
+
+	for (i = 0; i < Nr + 1; i++)
+	{
+		InterleaveIn(&q[0], &q[4], w + 4 * i);
+		q[1] = q[2] = q[3] = q[0];			// Same key for every block of the group
+		q[5] = q[6] = q[7] = q[4];
+		Ortho(q);
+		x = (q[0] & 0x1111111111111111) | (q[1] & 0x2222222222222222) | (q[2] & 0x4444444444444444) | (q[3] & 0x8888888888888888);
+		memcpy(roundKeys + 16 * i, &x, 8);
+		x = (q[4] & 0x1111111111111111) | (q[5] & 0x2222222222222222) | (q[6] & 0x4444444444444444) | (q[7] & 0x8888888888888888);
+		memcpy(roundKeys + 16 * i + 8, &x, 8);
+	}
+	Zeroize(w, sizeof(w));					// Uncompressed key schedule
+	Zeroize(q, sizeof(q));
+}
+
+/* One block still takes a full pass of the circuit */
+void aes128e_bitsliced_encrypt(unsigned char *c, const unsigned char *p, const unsigned char *roundKeys) {
+
+	aes128e_bitsliced_encrypt_blocks(c, p, 1, roundKeys);
+}
+
+/* CTR with the counter blocks built 8 at a time; the counter is public, only the keystream is secret */
+void aes128e_bitsliced_ctr32(unsigned char *out, const unsigned char *in, unsigned long nblocks, unsigned char *CB, const unsigned char *roundKeys) {
+
+	uint64_t sk[8 * (Nr + 1)], q[2][8];
+	unsigned char counters[Lanes * 16], stream[Lanes * 16];
+	uint32_t counter = ((uint32_t)CB[12] << 24) | ((uint32_t)CB[13] << 16) | ((uint32_t)CB[14] << 8) | (uint32_t)CB[15];
+	unsigned long n, b, i;
+	uint64_t x, y;
+
+	ExpandRoundKeys(sk, roundKeys);
+
+	for (b = 0; b < Lanes; b++)
+	{
+		memcpy(counters + 16 * b, CB, 12);
+	}
+
+	for (; nblocks > 0; nblocks -= n, in += 16 * n, out += 16 * n)
+	{
+		n = nblocks < Lanes ? nblocks : Lanes;
+
+		for (b = 0; b < Lanes; b++, counter++)	// inc32; unused lanes of the last pass are discarded
+		{
+			counters[16 * b + 12] = (unsigned char)(counter >> 24);
+			counters[16 * b + 13] = (unsigned char)(counter >> 16);
+			counters[16 * b + 14] = (unsigned char)(counter >> 8);
+			counters[16 * b + 15] = (unsigned char)counter;
+		}
+		counter -= (uint32_t)(Lanes - n);
+
+		Cipher8(stream, counters, sk, q);
+
+		for (i = 0; i < 16 * n; i += 8)
+		{
+			memcpy(&x, in + i, 8);
+			memcpy(&y, stream + i, 8);
+			x ^= y;
+			memcpy(out + i, &x, 8);
+		}
+	}
+
+	CB[12] = (unsigned char)(counter >> 24);
+	CB[13] = (unsigned char)(counter >> 16);
+	CB[14] = (unsigned char)(counter >> 8);
+	CB[15] = (unsigned char)counter;
+	Zeroize(sk, sizeof(sk));
+	Zeroize(q, sizeof(q));					// Last state is the keystream
+	Zeroize(stream, sizeof(stream));
+}
+
+/* Independent blocks, 8 per pass; a short tail is padded to a full pass */
+void aes128e_bitsliced_encrypt_blocks(unsigned char *c, const unsigned char *p, unsigned long nblocks, const unsigned char *roundKeys) {
+
+	uint64_t sk[8 * (Nr + 1)], q[2][8];
+	unsigned char buf[Lanes * 16];
+
+	ExpandRoundKeys(sk, roundKeys);
+
+	for (; nblocks >= Lanes; nblocks -= Lanes, p += 16 * Lanes, c += 16 * Lanes)
+	{
+		Cipher8(c, p, sk, q);					// Every block is read before any is written, so c may be p
+	}
+	if (nblocks > 0)
+	{
+		memset(buf, 0, sizeof(buf));
+		memcpy(buf, p, 16 * nblocks);
+		Cipher8(buf, buf, sk, q);
+		memcpy(c, buf, 16 * nblocks);
+		Zeroize(buf, sizeof(buf));
+	}
+	Zeroize(sk, sizeof(sk));
+	Zeroize(q, sizeof(q));
+}
@@ -0,0 +1,22 @@
+#ifndef AES128E_BITSLICED_H
+#define AES128E_BITSLICED_H
+
+/* Constant-time bitsliced backend of aes128e, in portable 64-bit C. The S-box is a
+ * Boolean circuit instead of a table, so no memory address or branch depends on the key
+ * or the data. Blocks are encrypted 8 at a time; a single block costs as much as 8.
+ */
+
+/* Expand the 16-byte key at k into roundKeys. The 176 bytes hold the 11 round keys
+ * in the compressed bitsliced layout, not the FIPS-197 one. */
+void aes128e_bitsliced_setkey(unsigned char *roundKeys, const unsigned char *k);
+
+/* Under the expanded roundKeys, encrypt the 16-byte block at p and store it at c. */
+void aes128e_bitsliced_encrypt(unsigned char *c, const unsigned char *p, const unsigned char *roundKeys);
+
+/* aes128e_ctr32() with the bitsliced cipher, 8 counter blocks per pass. */
+void aes128e_bitsliced_ctr32(unsigned char *out, const unsigned char *in, unsigned long nblocks, unsigned char *CB, const unsigned char *roundKeys);
+
+/* aes128e_encrypt_blocks() with the bitsliced cipher, 8 blocks per pass. */
+void aes128e_bitsliced_encrypt_blocks(unsigned char *c, const unsigned char *p, unsigned long nblocks, const unsigned char *roundKeys);
+
+#endif
@@ -0,0 +1,168 @@
+/*****************************************************************************/
+/* VAES backend of AES 128 bit
+
+	VAESENC runs one AES round on each 128-bit lane of a 256-bit register,
+	so 8 registers keep 16 blocks in flight. The round keys are the AES-NI
+	schedule, broadcast to both lanes once per call.
+
+	This file is compiled with -mvaes -mavx2, but nothing in it runs unless
+	CPUID reports them (see aes128e_setkey).
+
+																			 */
+/*****************************************************************************/
+
+  // ************************************************************************//
+ // Includes		                                                        //
+// ************************************************************************//
+#include "aes128e_vaes.h"
+
+#ifdef AES128E_HAVE_VAES
+
+#include <stdint.h>
+#include <immintrin.h>
+
+  // ************************************************************************//
+ // Definitions		                                                        //
+// ************************************************************************//
+
+/* Number of Rounds */
+#define Nr 10
+
+/* Registers per pass */
+#define Registers (AES128E_VAES_LANES / 2)
+
+/* Reverses the 16 bytes of each lane, so that the big-endian counter becomes the low 32-bit word */
+#define BSWAP_MASK _mm256_broadcastsi128_si256(_mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15))
+
+  // ************************************************************************ //
+ // Private functions                                                        //
+// ************************************************************************ //
+
+/* The 11 round keys, each in both lanes */
+static void LoadRoundKeys (__m256i rk[Nr + 1], const unsigned char *roundKeys) {
+
+	for (int r = 0; r <= Nr; r++)
+	{
+		rk[r] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)roundKeys + r));
+	}
+}
+
+/* The rounds of n registers, interleaved */
+static inline void Rounds (__m256i *b, int n, const __m256i rk[Nr + 1]) {
+
+	int i, r;
+
+	for (i = 0; i < n; i++)
+	{
+		b[i] = _mm256_xor_si256(b[i], rk[0]);
+	}
+	for (r = 1; r < Nr; r++)
+	{
+		for (i = 0; i < n; i++)
+		{
+			b[i] = _mm256_aesenc_epi128(b[i], rk[r]);
+		}
+	}
+	for (i = 0; i < n; i++)
+	{
+		b[i] = _mm256_aesenclast_epi128(b[i], rk[Nr]);
+	}
+}
+
+  // ************************************************************************ //
+ // Public functions                                                         //
+// ************************************************************************ //
+
+/* CTR with 16 counter blocks in flight; a tail is encrypted as whole registers and only
+   its blocks are used */
+void aes128e_vaes_ctr32(unsigned char *out, const unsigned char *in, unsigned long nblocks, unsigned char *CB, const unsigned char *roundKeys) {
+
+	const __m256i bswap = BSWAP_MASK;
+	const __m256i two = _mm256_set_epi32(0, 0, 0, 2, 0, 0, 0, 2);
+	__m256i rk[Nr + 1], b[Registers];
+	__m256i counter = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)CB)), bswap);
+	uint32_t last;
+	unsigned long i, n;
+
+	LoadRoundKeys(rk, roundKeys);
+	counter = _mm256_add_epi32(counter, _mm256_set_epi32(0, 0, 0, 1, 0, 0, 0, 0));	// Lanes hold counters c and c + 1
+	last = ((uint32_t)CB[12] << 24 | (uint32_t)CB[13] << 16 | (uint32_t)CB[14] << 8 | CB[15]) + (uint32_t)nblocks;
+
+	for (; nblocks >= AES128E_VAES_LANES; nblocks -= AES128E_VAES_LANES, in += 16 * AES128E_VAES_LANES, out += 16 * AES128E_VAES_LANES)
+	{
+		for (i = 0; i < Registers; i++)
+		{
+			b[i] = _mm256_shuffle_epi8(counter, bswap);
+			counter = _mm256_add_epi32(counter, two);	// inc32 in each lane, never carrying into the IV bytes
+		}
+		Rounds(b, Registers, rk);
+		for (i = 0; i < Registers; i++)
+		{
+			_mm256_storeu_si256((__m256i *)out + i, _mm256_xor_si256(b[i], _mm256_loadu_si256((const __m256i *)in + i)));
+		}
+	}
+
+	if (nblocks > 0)								// Whole registers of keystream; an odd last block uses one lane
+	{
+		n = (nblocks + 1) / 2;
+		for (i = 0; i < n; i++)
+		{
+			b[i] = _mm256_shuffle_epi8(counter, bswap);
+			counter = _mm256_add_epi32(counter, two);
+		}
+		Rounds(b, (int)n, rk);
+		for (i = 0; i < nblocks / 2; i++)
+		{
+			_mm256_storeu_si256((__m256i *)out + i, _mm256_xor_si256(b[i], _mm256_loadu_si256((const __m256i *)in + i)));
+		}
+		if (nblocks % 2)
+			_mm_storeu_si128((__m128i *)out + nblocks - 1, _mm_xor_si128(_mm256_castsi256_si128(b[n - 1]), _mm_loadu_si128((const __m128i *)in + nblocks - 1)));
+	}
+
+	CB[12] = (unsigned char)(last >> 24);		// The counter after the last block used
+	CB[13] = (unsigned char)(last >> 16);
+	CB[14] = (unsigned char)(last >> 8);
+	CB[15] = (unsigned char)last;
+}
+
+/* Independent blocks, 16 in flight like the CTR loop */
+void aes128e_vaes_encrypt_blocks(unsigned char *c, const unsigned char *p, unsigned long nblocks, const unsigned char *roundKeys) {
+
+	__m256i rk[Nr + 1], b[Registers];
+	unsigned long i, n;
+
+	LoadRoundKeys(rk, roundKeys);
+
+	for (; nblocks >= AES128E_VAES_LANES; nblocks -= AES128E_VAES_LANES, p += 16 * AES128E_VAES_LANES, c += 16 * AES128E_VAES_LANES)
+	{
+		for (i = 0; i < Registers; i++)
+		{
+			b[i] = _mm256_loadu_si256((const __m256i *)p + i);
+		}
+		Rounds(b, Registers, rk);
+		for (i = 0; i < Registers; i++)
+		{
+			_mm256_storeu_si256((__m256i *)c + i, b[i]);
+		}
+	}
+
+	if (nblocks > 0)							// The tail in whole registers; an odd last block uses one lane
+	{
+		n = (nblocks + 1) / 2;
+		for (i = 0; i < nblocks / 2; i++)
+		{
+			b[i] = _mm256_loadu_si256((const __m256i *)p + i);
+		}
+		if (nblocks % 2)
+			b[n - 1] = _mm256_inserti128_si256(_mm256_setzero_si256(), _mm_loadu_si128((const __m128i *)p + nblocks - 1), 0);
+		Rounds(b, (int)n, rk);
+		for (i = 0; i < nblocks / 2; i++)
+		{
+			_mm256_storeu_si256((__m256i *)c + i, b[i]);
+		}
+		if (nblocks % 2)
+			_mm_storeu_si128((__m128i *)c + nblocks - 1, _mm256_castsi256_si128(b[n - 1]));
+	}
+}
+
+#endif
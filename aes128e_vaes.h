@@ -0,0 +1,24 @@
+#ifndef AES128E_VAES_H
+#define AES128E_VAES_H
+
+/* VAES backend of aes128e: the AES-NI rounds on 256-bit registers, two blocks per
+ * instruction. It is compiled on x86 only, and aes128e_setkey() only selects it when
+ * CPUID reports VAES and AVX2. The key schedule and single blocks are those of the
+ * AES-NI backend (see aes128e_aesni.h).
+ */
+
+#if defined(__x86_64__) || defined(__i386__)
+#define AES128E_HAVE_VAES 1
+
+/* Blocks in flight per pass: 8 registers of 2 blocks */
+#define AES128E_VAES_LANES 16
+
+/* aes128e_ctr32() with VAES: 16 counter blocks are encrypted with interleaved rounds. */
+void aes128e_vaes_ctr32(unsigned char *out, const unsigned char *in, unsigned long nblocks, unsigned char *CB, const unsigned char *roundKeys);
+
+/* aes128e_encrypt_blocks() with VAES, 16 blocks with interleaved rounds. */
+void aes128e_vaes_encrypt_blocks(unsigned char *c, const unsigned char *p, unsigned long nblocks, const unsigned char *roundKeys);
+
+#endif
+
+#endif
@@ -27,9 +27,13 @@
   // ************************************************************************//
  // Includes		                                                        //
 // ************************************************************************//
-#include <stdio.h>		// Used for printing and debugging
 #include <stdint.h>
+#include <pthread.h>
 #include "aes128gcm.h"
+#include "aes128gcm_clmul.h"
+#include "aes128gcm_vpclmul.h"
+#include "aes128gcm_pmull.h"
+#include "aes128gcm_table.h"
 
   // ************************************************************************//
  // Definitions		                                                        //
@@ -41,87 +45,86 @@
 /* IV Length in bytes */
 #define IVlen 12
 
-  // ************************************************************************ //
- // Private variables                                                        //
-// ************************************************************************ //
-
-/* Hash subkey */
-static unsigned char H[Block] = {0};
+/* Bytes hashed then decrypted together by the fused decryption loop (one 8-block GHASH reduction) */
+#define FusedChunk (8 * Block)
 
-/* J0 = IV || 0^31 ||1 */
-static unsigned char J0[Block] = {0};
+/* Upper bound on the threads of the parallel API, and the fewest bytes given to each */
+#define ParallelThreads 64
+#define ParallelMinimum (64 * 1024)
 
-/* CB Block used in the CTR */
-static unsigned char CB[Block] = {0};
+  // ************************************************************************ //
+ // Private constants                                                        //
+// ************************************************************************ //
 
-/* OUTPUT of the GHASH function */
-static unsigned char OUTPUT[Block] = {0};
+/* All working state (J0, CB, Z, V, the GHASH output and the length block) lives
+   on the stack of the calling function or in the caller's aes128gcm_key, so
+   independent sessions can run concurrently without any locking. */
 
 /* R used for the multiplication in GF(2^128) */
 /* R = 11100001 || 0^120 */
-static unsigned char R[Block] = {0xe1};
-
-/* Z "zero" variable used in the multiplication function */
-static unsigned char Z[Block] = {0};
-
-/* V used inside the GCTR function */
-static unsigned char V[Block] = {0};
-
-/* 16 byte array of the concatenation of len(A) and len(C) */
-static unsigned char len_concat[Block] = {0};
-
-/* Hold and shift the values of len(A) */
-static unsigned int len_ad_bits;
-static unsigned char len_a[Block/2] = {0};
-
-/* Hold and shift the values of len(C) */
-static unsigned int len_c_bits;
-static unsigned char len_c[Block/2] = {0};
-
-/* 32 bit variable to hold the increments modulus 32 bits */
-static unsigned long increment;
+static const unsigned char R[Block] = {0xe1};
 
   // ************************************************************************ //
  // Private functions                                                        //
 // ************************************************************************ //
 
-/* Prints the array blocks */
-static void PrintVector(unsigned char *myArray, unsigned char arraySize) {		
-	
-	unsigned char i, j;
+/* Hash subkey is created. H = E(K, 0^128) */
+static void InitialHashSubkey (unsigned char *ENC, const aes128e_key *ks) {
+	memset(ENC, 0, Block);			// H variable is set to 0
+	aes128e_encrypt(ENC, ENC, ks);	// H (all zeros) is encrypted with the Key
+}
 
-	for(i = 0; i < arraySize; i++) 
+/* Per-key data derived from H for the GHASH implementation given by backend */
+static int HashSubkeyTables (aes128gcm_key *gk, int backend) {
+
+	switch (backend)
 	{
-		printf("%#X ", myArray[i]);
+		case AES128GCM_GHASH_PORTABLE:
+			break;								// The bit-serial multiplication only needs H
+#ifdef AES128GCM_HAVE_CLMUL
+		case AES128GCM_GHASH_CLMUL:
+			if (!__builtin_cpu_supports("pclmul") || !__builtin_cpu_supports("ssse3"))
+				return -1;
+			aes128gcm_clmul_init(gk->tables.Hpow, gk->H);	// H^1..H^8 for the aggregated reduction
+			break;
+#endif
+#ifdef AES128GCM_HAVE_VPCLMUL
+		case AES128GCM_GHASH_VPCLMUL:
+			if (!__builtin_cpu_supports("pclmul") || !__builtin_cpu_supports("vpclmulqdq") || !__builtin_cpu_supports("avx2"))
+				return -1;
+			aes128gcm_vpclmul_init(gk->tables.Hpow, gk->H);	// H^1..H^16, paired for 256-bit loads
+			break;
+#endif
+#ifdef AES128GCM_HAVE_PMULL
+		case AES128GCM_GHASH_PMULL:
+			if (!aes128gcm_pmull_available())
+				return -1;
+			aes128gcm_pmull_init(gk->tables.Hpow, gk->H);	// H^1..H^8, bit-reversed
+			break;
+#endif
+		case AES128GCM_GHASH_TABLE:
+			aes128gcm_table_init(gk->tables.Htable, gk->H);	// Multiples of H, built once per key
+			break;
+		default:
+			return -1;
 	}
-
-	printf("%s\n", "");
+	gk->ghash_backend = backend;
+	return 0;
 }
 
-/* Hash subkey is created. H = E(K, 0^128) */
-static void InitialHashSubkey (unsigned char *ENC, const unsigned char *k) {
-	memset(ENC, 0, Block);	// H variable is set to 0
-	aes128e(ENC, ENC, k);	// H (all zeros) is encrypted with the Key
-}
-
-/* J0 is defined. len(IV)=96, then let J0 = IV || 0^31 || 1 */
-static void J0Definition (unsigned char *J0, const unsigned char *IV) {
-	
-	memcpy(J0, IV, IVlen);		// IV is copied to J0
-	increment = 1;				// increment variable set to 1
-	J0[Block - 1] = increment;	// increment is added to the end of J0
-}
 
 /*  Byte block is incremented by 1. Incrementing Function incs(X)=MSBlen(X)-s(X) || [int(LSBs(X))+1 mod 2s]s Fixed to 32 */
 static void IncrementingFunction(unsigned char *INC) {
 
-	increment += 1;										// Array received is increased by 1
+	uint32_t increment;										// The counter is read back from the block itself
+
+	increment = ((uint32_t)INC[Block - 4] << 24) | ((uint32_t)INC[Block - 3] << 16) | ((uint32_t)INC[Block - 2] << 8) | INC[Block - 1];
+	increment += 1;										// Array received is increased by 1 mod 2^32
 
 	for (int i = 0; i < 4; ++i)
 	{
 		INC[Block - 1 - i] = increment >> 8 * i & 0xFF;	// increment value is pushed to the last 4 bytes of the INC array (J0)	
 	}
-	//PrintVector(INC, 16);
 }
 
 /* The bit representation of position value is returned */
@@ -174,10 +177,6 @@ static void ShiftRight(unsigned char *SHFT) {
 		SHFT[i] >>= 0x01;					// We shift the byte to the right by 1 position
 		SHFT[i] += prevcarry;				// And we add the previous carry to the byte
 	}
-
-	/*
-	printf("%s\n", "Shift: ");
-	PrintVector(V, Block);*/
 }
 
 /* Byte blocks received are XORed */
@@ -188,32 +187,17 @@ static void xor_block(unsigned char *ZBLOCK, unsigned char *VBLOCK) {
 	}
 }
 
-/* GCTR function computed with the key K */
-static void GCTR (unsigned char *C, const unsigned char *J0, const unsigned char *plaintext, const unsigned char *k, const unsigned long len_p) {
+/* GCTR function computed with the key K, CB is the first counter block and is left at the next unused one */
+static void GCTR (unsigned char *C, unsigned char *CB, const unsigned char *plaintext, const aes128e_key *ks, const unsigned long len_p) {
 
-	unsigned char tempCB[Block] = {0};	// Used to save the last state of CB
-
-	memcpy(CB, J0, Block);
-
-	for (int i = 0; i < len_p; i++)		// Index i used to iterate from 0 to len_p and later access values with index j 
-	{
-		 
-		aes128e(tempCB, CB, k);			// CIPHK(CBi)
-		
-		/*printf("%s\n", "CB Encrypted value:");
-		PrintVector(tempCB, Block);*/
-
-		for (int j = 0; j < Block; j++)	// Along with index i, we access the values of the plaintext up to the len_p
-		{
-		 	C[(i * Block) + j] = plaintext[(i * Block) + j] ^ tempCB[j];	// Yi = Xi XOR CIPHK(CBi)
-		} 
-		IncrementingFunction(CB);	// For i = 2 to n, let CBi = inc32(CBi-1)
-	}	
+	aes128e_ctr32(C, plaintext, len_p, CB, ks);	// Yi = Xi XOR CIPHK(CBi), several counter blocks in flight
 }
 
 /* Multiplication in GF(2^128) */
 static void GFMult128 (unsigned char *Z, const unsigned char *X, const unsigned char *YBLOCK) {
 	
+	unsigned char V[Block];								// V holds the shifted multiplicand
+
 	memset(Z, 0, Block);
 	memcpy(V, YBLOCK, Block);
 
@@ -239,124 +223,763 @@ static void GFMult128 (unsigned char *Z, const unsigned char *X, const unsigned
 	}
 }
 
-/* Creation of the block concatenating A, C, len(A), len(C) */
-static void ByteConcatenation (unsigned char *concat, const unsigned char *A, const unsigned char *C, int len_ad, int len_p, int len_total) {
+/* Creation of the last GHASH block, len(A) || len(C), both as 64-bit big-endian bit counts */
+static void LengthBlock (unsigned char *len_concat, uint64_t len_ad_bits, uint64_t len_c_bits) {
+
+	for (int i = 0; i < Block / 2; i++)				// Iterate over the 8 bytes of each length, least significant byte last
+	{
+		len_concat[7 - i] = (len_ad_bits >> 8 * i) & 0xFF;		// len(A) in the first half
+		len_concat[15 - i] = (len_c_bits >> 8 * i) & 0xFF;		// len(C) in the second half
+	}
+}
+
+/* GHASH over whole blocks: Y = (...((Y ^ X1) * H ^ X2) * H ...) * H */
+static void GHASHBlocks (unsigned char *Y, const aes128gcm_key *gk, const unsigned char *X, unsigned long nblocks) {
+
+	// GHASH Variables
+	unsigned char tempX[Block] = {0};
+	unsigned char Z[Block];								// Product of the GF(2^128) multiplication
+
+#ifdef AES128GCM_HAVE_VPCLMUL
+	if (gk->ghash_backend == AES128GCM_GHASH_VPCLMUL)
+	{
+		aes128gcm_vpclmul_ghash(Y, gk->tables.Hpow, X, nblocks);	// 16 blocks per reduction, 2 per multiply
+		return;
+	}
+#endif
+#ifdef AES128GCM_HAVE_CLMUL
+	if (gk->ghash_backend == AES128GCM_GHASH_CLMUL)
+	{
+		aes128gcm_clmul_ghash(Y, gk->tables.Hpow, X, nblocks);		// 8 blocks per reduction with the H powers
+		return;
+	}
+#endif
+#ifdef AES128GCM_HAVE_PMULL
+	if (gk->ghash_backend == AES128GCM_GHASH_PMULL)
+	{
+		aes128gcm_pmull_ghash(Y, gk->tables.Hpow, X, nblocks);		// Same aggregation with PMULL
+		return;
+	}
+#endif
+	if (gk->ghash_backend == AES128GCM_GHASH_TABLE)
+	{
+		aes128gcm_table_ghash(Y, gk->tables.Htable, X, nblocks);	// One lookup per nibble (or byte)
+		return;
+	}
+
+	for (unsigned long i = 0; i < nblocks; i++)
+	{
+		for (int j = 0; j < Block; j++)					// From 0 to size of Block in bytes (16)
+		{
+			tempX[j] = X[(i * Block) + j];				// Get the block from X and add it to tempX
+		}
+		
+		xor_block(Y, tempX);							// XOR current block (tempX) with Y (initially is all zeroes)
+		
+		GFMult128(Z, gk->H, Y);							// Multiply H and Y in GF 2^128, Z is a zero array
+
+		memcpy(Y, Z, Block);							// The result of the multiplication is copied to Y
+	}
+}
+
+/* GHASH of len bytes read in place at X and zero-padded to a whole block, continuing from Y */
+static void GHASH (unsigned char *Y, const aes128gcm_key *gk, const unsigned char *X, unsigned long len) {
 
-	memset(len_c, 0, 8);					// len_c is set to 0
-	memset(len_a, 0, 8);					// len_a is set to 0
-	memset(concat, 0, len_total);			// concat is set to 0
+	unsigned char last[Block] = {0};					// Only a partial last block is ever copied
 
-	len_c_bits = len_p * 8 * Block;			// Bit len of C in Dec	(stored in an int)
-	len_ad_bits = len_ad * 8 * Block;		// Bit len of AD in Dec (stored in an int)
+	GHASHBlocks(Y, gk, X, len / Block);					// Whole blocks straight from the caller's buffer
 
-	for (int i = 0; i < len_ad; i++)
+	if (len % Block)
 	{
-		len_a[i] = (len_ad_bits >> 8 * i) & 0xFF;	// Len in hex is shifted to the right and ANDed with 0xFF to get the value
+		memcpy(last, X + len - len % Block, len % Block);
+		GHASHBlocks(Y, gk, last, 1);
 	}
+}
+
+/* J0 is defined. If len(IV)=96, then let J0 = IV || 0^31 || 1,
+   otherwise J0 = GHASH(IV || 0^(s+64) || [len(IV)]64), s padding IV to a whole block */
+static void J0Definition (unsigned char *J0, const aes128gcm_key *gk, const unsigned char *IV, const unsigned long len_iv) {
+
+	unsigned char len_concat[Block];
 
-	for (int i = 0; i < len_p; i++)
+	if (len_iv == IVlen)
 	{
-		len_c[i] = ( len_c_bits >> 8 * i) & 0xFF;	// Len in hex is shifted to the right and ANDed with 0xFF to get the value
+		memcpy(J0, IV, IVlen);					// IV is copied to J0
+		memset(J0 + IVlen, 0, Block - IVlen);	// 0^31
+		J0[Block - 1] = 1;						// 1 is added to the end of J0
+		return;
 	}
 
-	for (int i = (Block - 1); i > -1; i--)			// Iterate from 15 to 0 to store the two 8 bytes arrays with the lenght
+	memset(J0, 0, Block);
+	GHASH(J0, gk, IV, len_iv);					// IV zero-padded to a whole block
+	LengthBlock(len_concat, 0, (uint64_t)len_iv * 8);	// 0^64 || [len(IV)]64
+	GHASH(J0, gk, len_concat, Block);
+}
+
+/* Data is added to the running GHASH; a partial block is kept in ctx->buf until more data arrives */
+static void HashStream (aes128gcm_ctx *ctx, const unsigned char *X, unsigned long len) {
+
+	unsigned long n;
+
+	if (ctx->buf_len > 0)									// Complete the partial block left by the previous call
 	{
-		if (i > 7)									
+		n = Block - ctx->buf_len < len ? Block - ctx->buf_len : len;
+		memcpy(ctx->buf + ctx->buf_len, X, n);
+		ctx->buf_len += n;
+		X += n;
+		len -= n;
+		if (ctx->buf_len < Block)
+			return;
+		GHASHBlocks(ctx->Y, ctx->gk, ctx->buf, 1);
+		ctx->buf_len = 0;
+	}
+
+	GHASHBlocks(ctx->Y, ctx->gk, X, len / Block);			// Whole blocks are read in place
+
+	if (len % Block)
+		memcpy(ctx->buf, X + len - len % Block, len % Block);	// The tail waits for the next call; X may be NULL when len is 0
+	ctx->buf_len = len % Block;
+}
+
+/* The partial block in ctx->buf is zero-padded and hashed */
+static void HashFlush (aes128gcm_ctx *ctx) {
+
+	if (ctx->buf_len > 0)
+	{
+		memset(ctx->buf + ctx->buf_len, 0, Block - ctx->buf_len);
+		GHASHBlocks(ctx->Y, ctx->gk, ctx->buf, 1);
+		ctx->buf_len = 0;
+	}
+}
+
+/* GCTR over a stream: keystream left from the previous call first, then whole blocks, then a new keystream block for the tail */
+static void CTRStream (aes128gcm_ctx *ctx, unsigned char *out, const unsigned char *in, unsigned long len) {
+
+	unsigned long n = ctx->ks_len < len ? ctx->ks_len : len;
+
+	for (unsigned long i = 0; i < n; i++)
+	{
+		out[i] = in[i] ^ ctx->keystream[Block - ctx->ks_len + i];
+	}
+	ctx->ks_len -= n;
+	out += n;
+	in += n;
+	len -= n;
+
+	GCTR(out, ctx->CB, in, &ctx->gk->aes, len / Block);
+	out += len - len % Block;
+	in += len - len % Block;
+
+	if (len % Block)
+	{
+		aes128e_encrypt(ctx->keystream, ctx->CB, &ctx->gk->aes);	// CIPHK(CBi) for the partial block
+		IncrementingFunction(ctx->CB);
+		for (unsigned long i = 0; i < len % Block; i++)
 		{
-			len_concat[i] = len_c[7 - i % 8];		// Starting from right to left, first the ciphertext is added
+			out[i] = in[i] ^ ctx->keystream[i];
 		}
-		else 										
+		ctx->ks_len = Block - len % Block;
+	}
+}
+
+/* nblocks whole blocks go through the stitched AES-NI and PCLMULQDQ kernel, or its VAES and
+   VPCLMULQDQ or ARMv8 AESE and PMULL counterpart, advancing CB and hashing into Y;
+   returns 0 if the key has no such kernel */
+static int StitchedBlocks (const aes128gcm_key *gk, unsigned char *out, const unsigned char *in, unsigned long nblocks, unsigned char *CB, unsigned char *Y, int decrypt) {
+
+#ifdef AES128GCM_HAVE_VPCLMUL
+	if (gk->aes.backend == AES128E_VAES && gk->ghash_backend == AES128GCM_GHASH_VPCLMUL)
+	{
+		if (decrypt)
+			aes128gcm_vpclmul_decrypt(out, in, nblocks, CB, gk->aes.roundKeys, Y, gk->tables.Hpow);
+		else
+			aes128gcm_vpclmul_encrypt(out, in, nblocks, CB, gk->aes.roundKeys, Y, gk->tables.Hpow);
+		return 1;
+	}
+#endif
+#ifdef AES128GCM_HAVE_CLMUL
+	if ((gk->aes.backend == AES128E_AESNI || gk->aes.backend == AES128E_VAES) && gk->ghash_backend == AES128GCM_GHASH_CLMUL)
+	{
+		if (decrypt)
+			aes128gcm_clmul_decrypt(out, in, nblocks, CB, gk->aes.roundKeys, Y, gk->tables.Hpow);
+		else
+			aes128gcm_clmul_encrypt(out, in, nblocks, CB, gk->aes.roundKeys, Y, gk->tables.Hpow);
+		return 1;
+	}
+#endif
+#ifdef AES128GCM_HAVE_PMULL
+	if (gk->aes.backend == AES128E_ARMCE && gk->ghash_backend == AES128GCM_GHASH_PMULL)
+	{
+		if (decrypt)
+			aes128gcm_pmull_decrypt(out, in, nblocks, CB, gk->aes.roundKeys, Y, gk->tables.Hpow);
+		else
+			aes128gcm_pmull_encrypt(out, in, nblocks, CB, gk->aes.roundKeys, Y, gk->tables.Hpow);
+		return 1;
+	}
+#endif
+	return 0;
+}
+
+/* Whole blocks at a block-aligned stream position go through the stitched kernel;
+   returns the number of bytes done, 0 if the key has no such kernel */
+static unsigned long StitchedStream (aes128gcm_ctx *ctx, unsigned char *out, const unsigned char *in, unsigned long len, int decrypt) {
+
+	if (ctx->ks_len != 0 || ctx->buf_len != 0 || len < Block)
+		return 0;
+
+	return StitchedBlocks(ctx->gk, out, in, len / Block, ctx->CB, ctx->Y, decrypt) ? len - len % Block : 0;
+}
+
+/* Length of the next chunk of the generic path: FusedChunk bytes, or fewer so that the
+   stream reaches a block boundary where the stitched kernel can take over */
+static unsigned long ChunkLength (const aes128gcm_ctx *ctx, unsigned long len) {
+
+	unsigned long n = len < FusedChunk ? len : FusedChunk;
+
+	return ctx->ks_len > 0 && ctx->ks_len < n ? ctx->ks_len : n;
+}
+
+/* The GHASH output S is completed with the length block */
+static void HashLengths (aes128gcm_ctx *ctx) {
+
+	unsigned char len_concat[Block];		// len(A) || len(C)
+
+	HashFlush(ctx);							// Partial AAD or ciphertext block, zero-padded
+	LengthBlock(len_concat, ctx->len_ad * 8, ctx->len_c * 8);
+	GHASHBlocks(ctx->Y, ctx->gk, len_concat, 1);
+}
+
+/* The length block is hashed and the tag T = GCTR(J0, S) is computed */
+static void ComputeTag (aes128gcm_ctx *ctx, unsigned char *tag) {
+
+	HashLengths(ctx);
+	GCTR(tag, ctx->J0, ctx->Y, &ctx->gk->aes, 1);	// The length is always 16 bytes long
+}
+
+/* Whether a message of len payload bytes and len_ad bytes of additional data is within the GCM limits */
+static int LengthsValid (uint64_t len, uint64_t len_ad) {
+
+	return len <= AES128GCM_MAX_PAYLOAD && len_ad <= AES128GCM_MAX_AAD;
+}
+
+/* Tags are compared in constant time: 0 if equal, -1 otherwise */
+static int TagCompare (const unsigned char *a, const unsigned char *b) {
+
+	unsigned int diff = 0;
+
+	for (int i = 0; i < Block; i++)
+	{
+		diff |= a[i] ^ b[i];				// No early exit, every byte is always compared
+	}
+	return (int)((diff + 0xff) >> 8) * -1;	// diff == 0 gives 0, any other byte value gives -1
+}
+
+/* One contiguous range of the message for the parallel API, hashed from a zero accumulator */
+typedef struct {
+	aes128gcm_ctx ctx;				// Own CB and Y; J0, lengths and AAD are left to the caller
+	unsigned char *out;
+	const unsigned char *in;
+	unsigned long len;
+	int decrypt;
+} ParallelRange;
+
+/* Z = X * H^m, by square-and-multiply on the public exponent m */
+static void GFMultPower (unsigned char *Z, const unsigned char *X, const unsigned char *H, unsigned long m) {
+
+	unsigned char P[Block], T[Block];
+
+	memcpy(Z, X, Block);
+	memcpy(P, H, Block);							// P = H^(2^i)
+	for (; m > 0; m >>= 1)
+	{
+		if (m & 1)
 		{
-			len_concat[i] = len_a[7 - i % 8];		// Then the AAD length is added
+			GFMult128(T, P, Z);
+			memcpy(Z, T, Block);
 		}
+		GFMult128(T, P, P);
+		memcpy(P, T, Block);
 	}
+}
+
+/* CBi = CB + n on the 32-bit counter, which wraps like inc32 */
+static void CounterAdd (unsigned char *CB, unsigned long n) {
 
-	//PrintVector(len_concat, 16);
+	uint32_t counter = ((uint32_t)CB[12] << 24 | (uint32_t)CB[13] << 16 | (uint32_t)CB[14] << 8 | CB[15]) + (uint32_t)n;
 
-	for (int i = 0; i < len_total; i++)				// Once the concatenation of the lenght is shifted and stored, we can compute the final concatenation
+	CB[12] = (unsigned char)(counter >> 24);
+	CB[13] = (unsigned char)(counter >> 16);
+	CB[14] = (unsigned char)(counter >> 8);
+	CB[15] = (unsigned char)counter;
+}
+
+/* Thread body: the range is encrypted or decrypted and hashed, the last partial block zero-padded */
+static void *ParallelWorker (void *arg) {
+
+	ParallelRange *range = arg;
+
+	if (range->decrypt)
+		aes128gcm_decrypt_update(&range->ctx, range->out, range->in, range->len);
+	else
+		aes128gcm_update(&range->ctx, range->out, range->in, range->len);
+	HashFlush(&range->ctx);
+	return NULL;
+}
+
+/* The payload of ctx is split into ranges run on up to nthreads threads; their GHASH values are
+   folded into ctx->Y as Y = Y * H^mi ^ Yi, mi being the blocks of range i. Ranges whose thread
+   could not be started are run by the calling thread */
+static void ParallelStream (aes128gcm_ctx *ctx, unsigned char *out, const unsigned char *in, unsigned long len, int decrypt, int nthreads) {
+
+	ParallelRange range[ParallelThreads];
+	pthread_t thread[ParallelThreads];
+	unsigned long nblocks = len / Block, per, start = 0;
+	unsigned char T[Block];
+	int n, started;
+
+	if (nthreads > ParallelThreads)
+		nthreads = ParallelThreads;
+	if ((unsigned long)nthreads > len / ParallelMinimum)
+		nthreads = (int)(len / ParallelMinimum);		// Short messages are not worth a thread per range
+	if (nthreads < 1)
+		nthreads = 1;
+
+	if (ctx->len_c == 0)
+		HashFlush(ctx);									// The AAD is zero-padded before the ciphertext
+	ctx->len_c += len;
+	per = nblocks / nthreads;
+
+	for (n = 0; n < nthreads; n++)
 	{
-		if (i < len_ad * Block)
+		range[n].ctx = *ctx;
+		memset(range[n].ctx.Y, 0, Block);				// Each range is hashed on its own
+		CounterAdd(range[n].ctx.CB, start);				// First counter block of the range
+		range[n].out = out + start * Block;
+		range[n].in = in + start * Block;
+		range[n].len = n == nthreads - 1 ? len - start * Block : per * Block;	// The last one also takes the tail
+		range[n].decrypt = decrypt;
+		start += per;
+	}
+
+	for (started = 1; started < nthreads; started++)	// The calling thread runs range 0
+	{
+		if (pthread_create(&thread[started], NULL, ParallelWorker, &range[started]) != 0)
+			break;
+	}
+	ParallelWorker(&range[0]);
+	for (n = started; n < nthreads; n++)			// Serially, if threads ran out
+	{
+		ParallelWorker(&range[n]);
+	}
+	for (n = 1; n < started; n++)
+	{
+		pthread_join(thread[n], NULL);
+	}
+
+	for (n = 0; n < nthreads; n++)
+	{
+		GFMultPower(T, ctx->Y, ctx->gk->H, (range[n].len + Block - 1) / Block);
+		xor_block(T, range[n].ctx.Y);
+		memcpy(ctx->Y, T, Block);
+	}
+	CounterAdd(ctx->CB, (len + Block - 1) / Block);		// Kept in step, although no more data follows
+}
+
+/* Total number of bytes in a segment list */
+static unsigned long IovLength (const aes128gcm_iovec *iov, unsigned long count) {
+
+	unsigned long len = 0;
+
+	for (unsigned long i = 0; i < count; i++)
+	{
+		len += iov[i].len;
+	}
+	return len;
+}
+
+/* The input segments are encrypted or decrypted into the output segments, walking both
+   lists at once: each step ends where the current input or output segment ends, and the
+   streaming state carries partial blocks across the boundary. out must hold len bytes */
+static void IovStream (aes128gcm_ctx *ctx, const aes128gcm_iovec *out, const aes128gcm_iovec *in, unsigned long len, int decrypt) {
+
+	unsigned long in_off = 0, out_off = 0, n;
+
+	for (; len > 0; len -= n, in_off += n, out_off += n)
+	{
+		while (in_off == in->len)			// Empty or finished segments are skipped
 		{
-			concat[i] = A[i % (len_ad * Block)];	// A is added to the concat array
+			in++;
+			in_off = 0;
 		}
-		else if (i >= len_ad * Block && i < (len_ad * Block) + (len_p * Block))
-		{																			// Then C is added to the concat array, From 0 to 31
-			concat[i] = C[(i - len_ad * Block) % (len_p * Block)];					// The index for accessing concat is reset to 0
-		}																			// i - len_ad in bits modulo len_p in bits
-		else
+		while (out_off == out->len)
 		{
-			concat[i] = len_concat[i % Block];		// Finally we add the concatenation of len(A) and len(C)
+			out++;
+			out_off = 0;
 		}
+		n = in->len - in_off < out->len - out_off ? in->len - in_off : out->len - out_off;
+
+		if (decrypt)
+			aes128gcm_decrypt_update(ctx, (unsigned char *)out->base + out_off, (const unsigned char *)in->base + in_off, n);
+		else
+			aes128gcm_update(ctx, (unsigned char *)out->base + out_off, (const unsigned char *)in->base + in_off, n);
 	}
-	
-	//printf("%s\n", "Concatenation: ");
-	//PrintVector(concat, len_total);
 }
 
-/* GHASH function computed using H and X */
-static void GHASH (unsigned char *OUT, const unsigned char *H, const unsigned char *X, const unsigned int len_total) {
+/* The first len bytes of a segment list are zeroed */
+static void IovZero (const aes128gcm_iovec *iov, unsigned long len) {
 
-	// GHASH Variables
-	unsigned char Y[Block] = {0};
-	unsigned char tempX[Block] = {0};
+	unsigned long n;
 
-	for (int i = 0; i < (len_total / Block); i++)		// For the total length of the concatenation (bits / 16)
+	for (; len > 0; len -= n, iov++)
 	{
-		for (int j = 0; j < Block; j++)					// From 0 to size of Block in bytes (16)
+		n = iov->len < len ? iov->len : len;
+		memset(iov->base, 0, n);
+	}
+}
+
+/* One message of exactly len_ad bytes of additional data and len bytes of payload under a
+   12-byte IV, its tag left in T. It is inlined into one function per fixed shape with both
+   lengths constant, so the branches on partial blocks and the length block fold away, J0 and
+   the counter blocks are set up without GHASH or inc32, and there is no streaming state.
+   E(K, J0) and the keystream of a partial last block come from one AES call, and the padded
+   last block and the length block are hashed together. The whole blocks still go through the
+   runtime stitched, GCTR and GHASH kernels with a block count */
+static inline void FixedMessage (unsigned char *out, unsigned char *T, const aes128gcm_key *gk, const unsigned char *IV, const unsigned char *in, const unsigned char *add_data, const unsigned long len_ad, const unsigned long len, const int decrypt) {
+
+	const unsigned long nblocks = len / Block, tail = len % Block;
+	unsigned char mask[2 * Block];				// E(K, J0), then the keystream of the partial last block
+	unsigned char last[2 * Block] = {0};		// Partial last block zero-padded, then len(A) || len(C)
+	unsigned char CB[Block];
+	unsigned long i;
+
+	memset(T, 0, Block);						// GHASH accumulator
+	memcpy(mask, IV, IVlen);
+	memset(mask + IVlen, 0, Block - IVlen);
+	mask[Block - 1] = 1;						// J0 = IV || 0^31 || 1
+	memcpy(CB, mask, Block);
+	CB[Block - 1] = 2;							// inc32(J0)
+
+	GHASH(T, gk, add_data, len_ad);				// A, zero-padded
+
+	if (nblocks > 0 && !StitchedBlocks(gk, out, in, nblocks, CB, T, decrypt))
+	{
+		if (decrypt)
+			GHASHBlocks(T, gk, in, nblocks);	// Hashed first, so out may be in
+		GCTR(out, CB, in, &gk->aes, nblocks);
+		if (!decrypt)
+			GHASHBlocks(T, gk, out, nblocks);
+	}
+
+	if (tail)
+		memcpy(mask + Block, CB, Block);
+	aes128e_encrypt_blocks(mask, mask, tail ? 2 : 1, &gk->aes);
+
+	if (tail)
+	{
+		in += nblocks * Block;
+		out += nblocks * Block;
+		for (i = 0; i < tail; i++)
 		{
-			tempX[j] = X[(i * Block) + j];				// Get the block from X and add it to tempX
+			last[i] = decrypt ? in[i] : in[i] ^ mask[Block + i];	// Ciphertext byte, read before out is written
+			out[i] = in[i] ^ mask[Block + i];
 		}
-		
-		xor_block(Y, tempX);							// XOR current block (tempX) with Y (initially is all zeroes)
-		/*printf("After XORing: \n");
-		PrintVector(Y, Block);*/
-		
-		GFMult128(Z, H, Y);								// Multiply H and Y in GF 2^128, Z is a zero array
-		/*printf("After Multiplicating GF 2^128: \n");
-		PrintVector(Z, Block);*/
+	}
+	LengthBlock(last + (tail ? Block : 0), (uint64_t)len_ad * 8, (uint64_t)len * 8);
+	GHASHBlocks(T, gk, last, tail ? 2 : 1);
+	xor_block(T, mask);							// T = E(K, J0) XOR S
+}
 
-		memcpy(Y, Z, Block);							// The result of the multiplication is copied to Y
+/* Expected tag compared with the received one; a forged message is zeroed */
+static inline int FixedVerify (unsigned char *out, unsigned long len, unsigned char *expected, const unsigned char *tag) {
+
+	int result = TagCompare(expected, tag);
+
+	if (result != 0)
+		memset(out, 0, len);
+	memset(expected, 0, Block);
+	return result;
+}
+
+/* One encryption and one decryption kernel per shape of AES128GCM_FIXED_SHAPES */
+#define FIXED_KERNELS(A, P) \
+static void FixedEncrypt##A##x##P (unsigned char *out, unsigned char *tag, const aes128gcm_key *gk, const unsigned char *IV, const unsigned char *in, const unsigned char *add_data) { \
+	FixedMessage(out, tag, gk, IV, in, add_data, A, P, 0); \
+} \
+static int FixedDecrypt##A##x##P (unsigned char *out, const unsigned char *tag, const aes128gcm_key *gk, const unsigned char *IV, const unsigned char *in, const unsigned char *add_data) { \
+	unsigned char expected[Block]; \
+	FixedMessage(out, expected, gk, IV, in, add_data, A, P, 1); \
+	return FixedVerify(out, P, expected, tag); \
+}
+AES128GCM_FIXED_SHAPES(FIXED_KERNELS)
+#undef FIXED_KERNELS
+
+/* Kernels of one shape of AES128GCM_FIXED_SHAPES */
+typedef struct {
+	unsigned long len_ad, len;
+	void (*encrypt)(unsigned char *out, unsigned char *tag, const aes128gcm_key *gk, const unsigned char *IV, const unsigned char *in, const unsigned char *add_data);
+	int (*decrypt)(unsigned char *out, const unsigned char *tag, const aes128gcm_key *gk, const unsigned char *IV, const unsigned char *in, const unsigned char *add_data);
+} FixedKernel;
+
+/* The shape list expanded once into a table, ended by an entry without kernels */
+#define FIXED_ENTRY(A, P) { A, P, FixedEncrypt##A##x##P, FixedDecrypt##A##x##P },
+static const FixedKernel FixedKernels[] = { AES128GCM_FIXED_SHAPES(FIXED_ENTRY) { 0, 0, NULL, NULL } };
+#undef FIXED_ENTRY
+
+/* Kernels for the shape of a message, NULL if it has none */
+static const FixedKernel *FixedLookup (unsigned long len_iv, unsigned long len, unsigned long len_ad) {
+
+	const FixedKernel *kernel;
+
+	if (len_iv != IVlen)
+		return NULL;
+	for (kernel = FixedKernels; kernel->encrypt != NULL; kernel++)
+	{
+		if (kernel->len_ad == len_ad && kernel->len == len)
+			return kernel;
 	}
-	memcpy(OUT, Y, Block);								// Finally the Y block is copied to OUT variable
+	return NULL;
 }
 
 /* Main GCM-AES 128 function */
 void aes128gcm(unsigned char *ciphertext, unsigned char *tag, const unsigned char *k, const unsigned char *IV, const unsigned char *plaintext, const unsigned long len_p, const unsigned char* add_data, const unsigned long len_ad) {
- 
- 	unsigned int len_total = (len_p * Block) + (len_ad * Block) + Block;	// Total lenght of the concatenation in bytes.
-	unsigned char concat[len_total];										// Char array that holds the concatenation to be passed to GHASH
-
-	/*
-	// Key
-	printf("%s\n", "Key:");
-	PrintVector(k, Block);
-
-	// IV
-	printf("%s\n", "IV:");
-	PrintVector(IV, 12);
-
-	// Plaintext
-	printf("%s\n", "Plaintext:");
-	PrintVector(plaintext, Block);
-
-	// ADD
-	printf("%s\n", "ADD:");
-	PrintVector(add_data, len_ad * Block);
-	*/
-
-	InitialHashSubkey(H, k);	// H is computed with zero array H and k H = E(K, 0^128)
-	J0Definition(J0, IV);		// J0 is defined. len(IV)=96, then let J0 = IV || 0^31 || 1
-	IncrementingFunction(J0);	// First we increase J0 before passing to GCTR
-	
-	GCTR(ciphertext, J0, plaintext, k, len_p);	// GCTR is called to compute all the ciphertext using the plaintext, k and J0
-	
-	ByteConcatenation(concat, add_data, ciphertext, len_ad, len_p, len_total);	// A, C, len(A) and len(C) are concatenated
 
-	GHASH(OUTPUT, H, concat, len_total);		// GHASH is called using the previous computed concat, H
+	aes128gcm_key gk;
 
-	J0Definition(J0, IV);			// J0 is redefined because the previous version had increments.
-	GCTR(tag, J0, OUTPUT, k, 1);	// GCTR is called to generate the TAG, we pass 1 as the length is always 16 bytes long 
-	
-	/*printf("TAG: \n");
-	PrintVector(tag, Block);*/
-}
\ No newline at end of file
+	aes128gcm_setkey(&gk, k);		// Key schedule and H are derived for this single call
+	aes128gcm_encrypt(ciphertext, tag, &gk, IV, IVlen, plaintext, len_p * Block, add_data, len_ad * Block);	// Block counts to bytes
+}
+
+/* Key schedule and hash subkey are derived once for a long-lived key */
+void aes128gcm_setkey(aes128gcm_key *gk, const unsigned char *k) {
+
+	aes128e_setkey(&gk->aes, k);			// Round keys are expanded once, AES instructions when available
+	InitialHashSubkey(gk->H, &gk->aes);	// H is computed with zero array H and k H = E(K, 0^128)
+
+	if (HashSubkeyTables(gk, AES128GCM_GHASH_VPCLMUL) != 0 &&	// VPCLMULQDQ when CPUID reports it
+		HashSubkeyTables(gk, AES128GCM_GHASH_CLMUL) != 0 &&		// Then PCLMULQDQ
+		HashSubkeyTables(gk, AES128GCM_GHASH_PMULL) != 0)		// Or PMULL
+	{
+		HashSubkeyTables(gk, AES128GCM_GHASH_TABLE);		// Otherwise the multiplication table
+	}
+}
+
+/* Same as aes128gcm_setkey with forced AES and GHASH implementations */
+int aes128gcm_setkey_backend(aes128gcm_key *gk, const unsigned char *k, int aes_backend, int ghash_backend) {
+
+	if (aes128e_setkey_backend(&gk->aes, k, aes_backend) != 0)
+		return -1;
+	InitialHashSubkey(gk->H, &gk->aes);
+	return HashSubkeyTables(gk, ghash_backend);
+}
+
+/* GCM-AES 128 under a key expanded by aes128gcm_setkey */
+void aes128gcm_encrypt(unsigned char *ciphertext, unsigned char *tag, const aes128gcm_key *gk, const unsigned char *IV, const unsigned long len_iv, const unsigned char *plaintext, const unsigned long len_p, const unsigned char* add_data, const unsigned long len_ad) {
+
+	aes128gcm_ctx ctx;
+	const FixedKernel *kernel = FixedLookup(len_iv, len_p, len_ad);
+
+	if (kernel != NULL)
+	{
+		kernel->encrypt(ciphertext, tag, gk, IV, plaintext, add_data);	// A shape with its own kernel
+		return;
+	}
+	if (!LengthsValid(len_p, len_ad))
+	{
+		memset(tag, 0, Block);								// The counter would wrap: nothing is encrypted
+		return;
+	}
+
+	aes128gcm_init(&ctx, gk, IV, len_iv);					// J0 is defined and the GHASH accumulator is cleared
+	aes128gcm_update_aad(&ctx, add_data, len_ad);			// A is hashed in place
+	aes128gcm_update(&ctx, ciphertext, plaintext, len_p);	// C is produced and hashed in one pass
+	aes128gcm_final(&ctx, tag);								// Length block and tag
+}
+
+/* Authenticated GCM-AES 128 decryption; the plaintext is only left in place if the tag verifies */
+int aes128gcm_decrypt(unsigned char *plaintext, const unsigned char *tag, const aes128gcm_key *gk, const unsigned char *IV, const unsigned long len_iv, const unsigned char *ciphertext, const unsigned long len_c, const unsigned char* add_data, const unsigned long len_ad) {
+
+	aes128gcm_ctx ctx;
+	const FixedKernel *kernel = FixedLookup(len_iv, len_c, len_ad);
+
+	if (kernel != NULL)
+		return kernel->decrypt(plaintext, tag, gk, IV, ciphertext, add_data);
+	if (!LengthsValid(len_c, len_ad))
+		return -1;											// No encryption produces such a message
+
+	aes128gcm_init(&ctx, gk, IV, len_iv);
+	aes128gcm_update_aad(&ctx, add_data, len_ad);
+	aes128gcm_decrypt_update(&ctx, plaintext, ciphertext, len_c);	// C is hashed and decrypted in one pass
+
+	if (aes128gcm_decrypt_final(&ctx, tag) != 0)
+	{
+		memset(plaintext, 0, len_c);						// Nothing of a forged message is released
+		return -1;
+	}
+	return 0;
+}
+
+/* A new message is started under gk with the IV of len_iv bytes */
+void aes128gcm_init(aes128gcm_ctx *ctx, const aes128gcm_key *gk, const unsigned char *IV, const unsigned long len_iv) {
+
+	ctx->gk = gk;
+	J0Definition(ctx->J0, gk, IV, len_iv);	// J0 = IV || 0^31 || 1 for a 96-bit IV, derived with GHASH otherwise
+	memcpy(ctx->CB, ctx->J0, Block);
+	IncrementingFunction(ctx->CB);		// The first counter block of the plaintext is inc32(J0)
+	memset(ctx->Y, 0, Block);			// GHASH accumulator
+	ctx->len_ad = 0;
+	ctx->len_c = 0;
+	ctx->buf_len = 0;
+	ctx->ks_len = 0;
+}
+
+/* Additional data is hashed, up to the GCM limit */
+int aes128gcm_update_aad(aes128gcm_ctx *ctx, const unsigned char *add_data, unsigned long len) {
+
+	if (len > AES128GCM_MAX_AAD - ctx->len_ad)
+		return -1;
+	ctx->len_ad += len;
+	HashStream(ctx, add_data, len);
+	return 0;
+}
+
+/* Plaintext is encrypted with the running counter and the ciphertext is hashed in the same pass */
+int aes128gcm_update(aes128gcm_ctx *ctx, unsigned char *ciphertext, const unsigned char *plaintext, unsigned long len) {
+
+	unsigned long n;
+
+	if (len > AES128GCM_MAX_PAYLOAD - ctx->len_c)
+		return -1;							// The 32-bit counter would wrap back to J0
+	if (ctx->len_c == 0)
+		HashFlush(ctx);						// First plaintext: the AAD is zero-padded to a whole block
+	ctx->len_c += len;
+
+	for (; len > 0; len -= n, ciphertext += n, plaintext += n)
+	{
+		n = StitchedStream(ctx, ciphertext, plaintext, len, 0);	// Hashed from registers as it is produced
+		if (n == 0)
+		{
+			n = ChunkLength(ctx, len);
+			CTRStream(ctx, ciphertext, plaintext, n);
+			HashStream(ctx, ciphertext, n);	// GHASH of the chunk just written, while it is still in L1
+		}
+	}
+	return 0;
+}
+
+/* Ciphertext is hashed and decrypted in the same pass, so each byte is read once */
+int aes128gcm_decrypt_update(aes128gcm_ctx *ctx, unsigned char *plaintext, const unsigned char *ciphertext, unsigned long len) {
+
+	unsigned long n;
+
+	if (len > AES128GCM_MAX_PAYLOAD - ctx->len_c)
+		return -1;
+	if (ctx->len_c == 0)
+		HashFlush(ctx);
+	ctx->len_c += len;
+
+	for (; len > 0; len -= n, ciphertext += n, plaintext += n)
+	{
+		n = StitchedStream(ctx, plaintext, ciphertext, len, 1);
+		if (n == 0)
+		{
+			n = ChunkLength(ctx, len);
+			HashStream(ctx, ciphertext, n);			// Hashed before decryption, so plaintext may overwrite ciphertext
+			CTRStream(ctx, plaintext, ciphertext, n);
+		}
+	}
+	return 0;
+}
+
+/* The tag is computed */
+void aes128gcm_final(aes128gcm_ctx *ctx, unsigned char *tag) {
+
+	ComputeTag(ctx, tag);
+}
+
+/* The expected tag is computed and compared in constant time with the received one */
+int aes128gcm_decrypt_final(aes128gcm_ctx *ctx, const unsigned char *tag) {
+
+	unsigned char expected[Block];
+	int result;
+
+	ComputeTag(ctx, expected);
+	result = TagCompare(expected, tag);
+	memset(expected, 0, Block);
+	return result;
+}
+
+/* GCM-AES 128 encryption of one large message on up to nthreads threads */
+int aes128gcm_encrypt_parallel(unsigned char *ciphertext, unsigned char *tag, const aes128gcm_key *gk, const unsigned char *IV, const unsigned long len_iv, const unsigned char *plaintext, const unsigned long len_p, const unsigned char* add_data, const unsigned long len_ad, int nthreads) {
+
+	aes128gcm_ctx ctx;
+
+	if (!LengthsValid(len_p, len_ad))
+		return -1;										// The counter would wrap: nothing is written
+	aes128gcm_init(&ctx, gk, IV, len_iv);
+	aes128gcm_update_aad(&ctx, add_data, len_ad);
+	ParallelStream(&ctx, ciphertext, plaintext, len_p, 0, nthreads);
+	aes128gcm_final(&ctx, tag);
+	return 0;
+}
+
+/* Authenticated GCM-AES 128 decryption of one large message on up to nthreads threads */
+int aes128gcm_decrypt_parallel(unsigned char *plaintext, const unsigned char *tag, const aes128gcm_key *gk, const unsigned char *IV, const unsigned long len_iv, const unsigned char *ciphertext, const unsigned long len_c, const unsigned char* add_data, const unsigned long len_ad, int nthreads) {
+
+	aes128gcm_ctx ctx;
+
+	if (!LengthsValid(len_c, len_ad))
+		return -1;
+	aes128gcm_init(&ctx, gk, IV, len_iv);
+	aes128gcm_update_aad(&ctx, add_data, len_ad);
+	ParallelStream(&ctx, plaintext, ciphertext, len_c, 1, nthreads);
+
+	if (aes128gcm_decrypt_final(&ctx, tag) != 0)
+	{
+		memset(plaintext, 0, len_c);
+		return -1;
+	}
+	return 0;
+}
+
+/* GCM-AES 128 encryption of a message given as segment lists, with no copy to a flat buffer */
+int aes128gcm_encrypt_iov(const aes128gcm_iovec *out, unsigned long out_count, unsigned char *tag, const aes128gcm_key *gk, const unsigned char *IV, const unsigned long len_iv, const aes128gcm_iovec *in, unsigned long in_count, const aes128gcm_iovec *aad, unsigned long aad_count) {
+
+	aes128gcm_ctx ctx;
+	unsigned long len = IovLength(in, in_count);
+
+	if (IovLength(out, out_count) < len || !LengthsValid(len, IovLength(aad, aad_count)))
+		return -1;
+
+	aes128gcm_init(&ctx, gk, IV, len_iv);
+	for (unsigned long i = 0; i < aad_count; i++)
+	{
+		aes128gcm_update_aad(&ctx, aad[i].base, aad[i].len);	// AAD blocks may straddle segments too
+	}
+	IovStream(&ctx, out, in, len, 0);
+	aes128gcm_final(&ctx, tag);
+	return 0;
+}
+
+/* Authenticated GCM-AES 128 decryption of a message given as segment lists */
+int aes128gcm_decrypt_iov(const aes128gcm_iovec *out, unsigned long out_count, const unsigned char *tag, const aes128gcm_key *gk, const unsigned char *IV, const unsigned long len_iv, const aes128gcm_iovec *in, unsigned long in_count, const aes128gcm_iovec *aad, unsigned long aad_count) {
+
+	aes128gcm_ctx ctx;
+	unsigned long len = IovLength(in, in_count);
+
+	if (IovLength(out, out_count) < len || !LengthsValid(len, IovLength(aad, aad_count)))
+		return -1;
+
+	aes128gcm_init(&ctx, gk, IV, len_iv);
+	for (unsigned long i = 0; i < aad_count; i++)
+	{
+		aes128gcm_update_aad(&ctx, aad[i].base, aad[i].len);
+	}
+	IovStream(&ctx, out, in, len, 1);
+
+	if (aes128gcm_decrypt_final(&ctx, tag) != 0)
+	{
+		IovZero(out, len);							// Nothing of a forged message is released
+		return -1;
+	}
+	return 0;
+}
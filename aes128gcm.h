@@ -1,3 +1,6 @@
+#ifndef AES128GCM_H
+#define AES128GCM_H
+
 /* Implement the following API.
  * You can add your own functions, but don't modify below this line.
  */
@@ -19,3 +22,176 @@ The number of blocks for this additional data is "len_ad" (e.g., len_ad = 1 for
 */
 
 void aes128gcm(unsigned char *ciphertext, unsigned char *tag, const unsigned char *k, const unsigned char *IV, const unsigned char *plaintext, const unsigned long len_p, const unsigned char* add_data, const unsigned long len_ad);
+
+/* Width of the software GHASH table, 4 or 8 bits (build with -DAES128GCM_TABLE_BITS=8,
+ * the library and its users must agree). Per key, the 4-bit table takes 16 entries of
+ * 16 bytes = 256 bytes and the 8-bit table 256 entries of 16 bytes = 4 KiB. */
+#ifndef AES128GCM_TABLE_BITS
+#define AES128GCM_TABLE_BITS 4
+#endif
+
+/* Length-specialised paths: message shapes X(additional data bytes, payload bytes) that
+ * aes128gcm_encrypt() and aes128gcm_decrypt() look up in a table built from this list,
+ * when the IV is 12 bytes, and hand to a path compiled for those lengths. Such a path
+ * builds J0 and the counter directly, keeps no streaming state, folds its length block
+ * and shares one AES call between E(K, J0) and a partial last block. It is not unrolled:
+ * its whole blocks go through the same CTR and GHASH kernels as any message, with a
+ * constant block count. The streaming, scatter/gather and parallel functions do not use
+ * it; the worker pool does, through aes128gcm_encrypt() and aes128gcm_decrypt(). Other
+ * shapes take the general path, with the same result. Each shape adds two functions to the
+ * library. Build with, e.g.,
+ * -D'AES128GCM_FIXED_SHAPES(X)=X(16, 64) X(0, 1400)', or an empty list for none. */
+#ifndef AES128GCM_FIXED_SHAPES
+#define AES128GCM_FIXED_SHAPES(X) X(16, 64) X(16, 128) X(16, 1024)
+#endif
+
+/* Expanded GCM key: the AES-128 key schedule and the hash subkey H = E(K, 0^128),
+both derived once from the 16-byte key and reused for every message under that key.
+No function keeps state outside the caller's buffers, so once set up a key can be
+shared read-only between any number of threads. */
+typedef struct {
+	aes128e_key aes;
+	unsigned char H[16];
+	union {
+		unsigned char Hpow[16][16];								/* Powers of H for the (V)PCLMULQDQ and PMULL GHASH */
+		uint64_t Htable[1 << AES128GCM_TABLE_BITS][2];		/* Multiples of H for the table GHASH */
+	} tables;
+	int ghash_backend;
+} aes128gcm_key;
+
+/* GHASH implementations. AES128GCM_GHASH_PORTABLE is the bit-serial C code,
+ * AES128GCM_GHASH_CLMUL uses the x86 carry-less multiply, AES128GCM_GHASH_TABLE
+ * the 4-bit or 8-bit multiplication table, AES128GCM_GHASH_VPCLMUL the
+ * carry-less multiply on 256-bit registers (VPCLMULQDQ, AVX2), and
+ * AES128GCM_GHASH_PMULL the ARMv8 64-bit polynomial multiply.
+ * AES128GCM_GHASH_BACKENDS is their count. */
+enum {
+	AES128GCM_GHASH_PORTABLE = 0,
+	AES128GCM_GHASH_CLMUL = 1,
+	AES128GCM_GHASH_TABLE = 2,
+	AES128GCM_GHASH_VPCLMUL = 3,
+	AES128GCM_GHASH_PMULL = 4,
+	AES128GCM_GHASH_BACKENDS
+};
+
+/* Expand the 16-byte key at k into gk.
+ * The fastest AES and GHASH implementations the CPU supports are picked at runtime. */
+void aes128gcm_setkey(aes128gcm_key *gk, const unsigned char *k);
+
+/* Same as aes128gcm_setkey(), but force the AES (AES128E_*) and GHASH (AES128GCM_GHASH_*)
+ * implementations. Returns 0, or -1 if this build or CPU does not support them. */
+int aes128gcm_setkey_backend(aes128gcm_key *gk, const unsigned char *k, int aes_backend, int ghash_backend);
+
+/* In-place operation: wherever a function takes an input and an output of the same length
+ * (plaintext and ciphertext, "in" and "out"), the output may be the same buffer as the input,
+ * so large payloads need no second buffer. Every byte is read before the byte at the same
+ * offset is written, in every backend. Buffers that overlap at different offsets are not
+ * supported. When a decryption fails, the output is zeroed, which in place also erases the
+ * ciphertext. */
+
+/* Length limits of NIST SP 800-38D, in bytes. The plaintext of one message is at most
+ * 2^39 - 256 bits, so that the 32-bit block counter never wraps back to J0 and reuses
+ * keystream, and the additional data at most 2^64 - 1 bits. */
+#define AES128GCM_MAX_PAYLOAD ((((uint64_t)1) << 36) - 32)
+#define AES128GCM_MAX_AAD ((((uint64_t)1) << 61) - 1)
+
+/* Under the key gk already expanded by aes128gcm_setkey() and the initial value "IV" of
+ * len_iv bytes, encrypt the plaintext "plaintext" of len_p bytes into "ciphertext" (also
+ * len_p bytes) and store the 16-byte authentication tag at "tag", authenticating also the
+ * additional data "add_data" of len_ad bytes. Unlike aes128gcm(), all lengths are in bytes
+ * and need not be multiples of 16. A 12-byte IV is used directly; any other non-zero
+ * length is hashed into the pre-counter block as specified by NIST SP 800-38D.
+ * len_p may be at most AES128GCM_MAX_PAYLOAD and len_ad at most AES128GCM_MAX_AAD; a
+ * longer message is not encrypted, and its tag is zeroed so that it never verifies.
+ * ciphertext may be equal to plaintext. */
+void aes128gcm_encrypt(unsigned char *ciphertext, unsigned char *tag, const aes128gcm_key *gk, const unsigned char *IV, const unsigned long len_iv, const unsigned char *plaintext, const unsigned long len_p, const unsigned char* add_data, const unsigned long len_ad);
+
+/* Under the key gk and the IV of len_iv bytes, verify the 16-byte tag and decrypt the
+ * ciphertext "ciphertext" of len_c bytes, with additional data "add_data" of len_ad bytes,
+ * into "plaintext". Returns 0 if the tag is authentic; otherwise returns -1 and the
+ * plaintext is zeroed. A message over the limits of aes128gcm_encrypt() cannot be
+ * authentic: -1 is returned without writing anything. plaintext may be equal to ciphertext. */
+int aes128gcm_decrypt(unsigned char *plaintext, const unsigned char *tag, const aes128gcm_key *gk, const unsigned char *IV, const unsigned long len_iv, const unsigned char *ciphertext, const unsigned long len_c, const unsigned char* add_data, const unsigned long len_ad);
+
+/* State of one message being encrypted or decrypted incrementally. The key gk passed to
+ * aes128gcm_init() must stay valid until aes128gcm_final(). */
+typedef struct {
+	const aes128gcm_key *gk;
+	unsigned char J0[16];			/* Pre-counter block, encrypted for the tag */
+	unsigned char CB[16];			/* Next counter block */
+	unsigned char Y[16];			/* GHASH accumulator */
+	unsigned char buf[16];			/* Partial AAD or ciphertext block not hashed yet */
+	unsigned char keystream[16];	/* Keystream block of the last partial plaintext block */
+	uint64_t len_ad, len_c;			/* Bytes of AAD and ciphertext so far, 64-bit on every platform */
+	unsigned int buf_len, ks_len;	/* Bytes held in buf, keystream bytes still unused */
+} aes128gcm_ctx;
+
+/* Start a message under the key gk with the initial value IV of len_iv bytes (12 is
+ * recommended, any non-zero length is accepted). The same init and update_aad calls
+ * start an encryption or a decryption. */
+void aes128gcm_init(aes128gcm_ctx *ctx, const aes128gcm_key *gk, const unsigned char *IV, const unsigned long len_iv);
+
+/* Add len bytes of additional data. Chunks can have any length, but all the
+ * additional data must be given before the first aes128gcm_update(). Returns 0, or -1
+ * if the total would exceed AES128GCM_MAX_AAD (nothing is added then). */
+int aes128gcm_update_aad(aes128gcm_ctx *ctx, const unsigned char *add_data, unsigned long len);
+
+/* Encrypt len bytes of plaintext into ciphertext. Chunks can have any length;
+ * the result only depends on the concatenation of all chunks. ciphertext may be
+ * equal to plaintext. Returns 0, or -1 if the total would exceed AES128GCM_MAX_PAYLOAD,
+ * past which the counter wraps and keystream repeats; nothing is written then and the
+ * message must be abandoned. */
+int aes128gcm_update(aes128gcm_ctx *ctx, unsigned char *ciphertext, const unsigned char *plaintext, unsigned long len);
+
+/* Finish the message and store the 16-byte authentication tag. The tag is the same
+ * as the one computed by aes128gcm_encrypt() on the whole message. */
+void aes128gcm_final(aes128gcm_ctx *ctx, unsigned char *tag);
+
+/* Decrypt len bytes of ciphertext into plaintext, hashing each chunk as it is decrypted.
+ * The plaintext is not authentic until aes128gcm_decrypt_final() returns 0: callers
+ * must not release it before then. plaintext may be equal to ciphertext. Returns 0, or
+ * -1 past AES128GCM_MAX_PAYLOAD like aes128gcm_update(). */
+int aes128gcm_decrypt_update(aes128gcm_ctx *ctx, unsigned char *plaintext, const unsigned char *ciphertext, unsigned long len);
+
+/* Finish a decryption and compare, in constant time, the expected tag with the 16-byte
+ * tag received. Returns 0 if they match, -1 otherwise. */
+int aes128gcm_decrypt_final(aes128gcm_ctx *ctx, const unsigned char *tag);
+
+/* Same as aes128gcm_encrypt(), with the message split into up to nthreads contiguous
+ * ranges of whole blocks that are encrypted and hashed by separate threads. The partial
+ * GHASH values are combined with powers of H, so the ciphertext and tag are exactly those
+ * of aes128gcm_encrypt(). Messages too short to be worth splitting use fewer threads.
+ * Each thread reads and writes its own range only, so ciphertext may be equal to
+ * plaintext. Ranges whose thread could not be started are run by the calling thread.
+ * Returns 0, or -1 if the message is over the limits of aes128gcm_encrypt() (nothing is
+ * written then). */
+int aes128gcm_encrypt_parallel(unsigned char *ciphertext, unsigned char *tag, const aes128gcm_key *gk, const unsigned char *IV, const unsigned long len_iv, const unsigned char *plaintext, const unsigned long len_p, const unsigned char* add_data, const unsigned long len_ad, int nthreads);
+
+/* Same as aes128gcm_decrypt() on up to nthreads threads, falling back to the calling
+ * thread like aes128gcm_encrypt_parallel(). Returns 0 if the tag is authentic; otherwise
+ * returns -1 and the plaintext is zeroed. Over the length limits, returns -1 without
+ * writing anything. plaintext may be equal to ciphertext. */
+int aes128gcm_decrypt_parallel(unsigned char *plaintext, const unsigned char *tag, const aes128gcm_key *gk, const unsigned char *IV, const unsigned long len_iv, const unsigned char *ciphertext, const unsigned long len_c, const unsigned char* add_data, const unsigned long len_ad, int nthreads);
+
+/* One segment of a scatter/gather list, laid out like the POSIX struct iovec. */
+typedef struct {
+	void *base;
+	unsigned long len;
+} aes128gcm_iovec;
+
+/* Same as aes128gcm_encrypt(), with the additional data, the plaintext and the ciphertext
+ * given as lists of in_count, aad_count and out_count segments. The segments are read and
+ * written in place, so blocks may straddle segment boundaries, and the output segments need
+ * not be split like the input ones. The output list may describe the same bytes as the input
+ * list, even with different segment boundaries. Returns 0, or -1 if the output segments
+ * hold fewer bytes than the input ones or the message is over the length limits (nothing
+ * is written then). */
+int aes128gcm_encrypt_iov(const aes128gcm_iovec *out, unsigned long out_count, unsigned char *tag, const aes128gcm_key *gk, const unsigned char *IV, const unsigned long len_iv, const aes128gcm_iovec *in, unsigned long in_count, const aes128gcm_iovec *aad, unsigned long aad_count);
+
+/* Same as aes128gcm_decrypt() on segment lists. Returns 0 if the tag is authentic;
+ * otherwise returns -1 and the plaintext written to the output segments is zeroed. Also
+ * returns -1, writing nothing, if the output segments hold fewer bytes than the input ones
+ * or the message is over the length limits. */
+int aes128gcm_decrypt_iov(const aes128gcm_iovec *out, unsigned long out_count, const unsigned char *tag, const aes128gcm_key *gk, const unsigned char *IV, const unsigned long len_iv, const aes128gcm_iovec *in, unsigned long in_count, const aes128gcm_iovec *aad, unsigned long aad_count);
+
+#endif
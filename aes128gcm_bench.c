@@ -0,0 +1,258 @@
+/* Benchmark suite of the GCM-AES 128 implementation.
+ *
+ * usage: aes128gcm_bench [-m max_bytes] [-s seconds] [-t threads]
+ *
+ * Every operation is timed for every AES and GHASH backend available on this host,
+ * for message sizes from 16 bytes up to max_bytes (64 MiB by default), on one thread
+ * and on all threads (every online core by default). Each point is repeated for about
+ * the given seconds (0.1 by default) and the best of three runs is kept. A size whose
+ * single call already takes longer is measured once, and larger sizes of that
+ * operation are skipped (the bit-serial GHASH is that slow). All-core runs stop at
+ * 4 MiB per thread to bound memory.
+ *
+ * Output is CSV on stdout, one line per point:
+ *
+ *   op,aes_backend,ghash_backend,threads,bytes,cycles_per_byte,gbps
+ *
+ * op is aes128e (one block per call), gctr (aes128e_ctr32), ghash (AAD-only message),
+ * encrypt, decrypt, encrypt_parallel (one message split with the parallel API, bytes is
+ * the message size), or encrypt_aad16, the one-shot call with 16 bytes of additional
+ * data per message (bytes counts the payload only). Cycles are time-stamp counter
+ * ticks, summed over the threads; they are left empty off x86.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "aes128e.h"
+#include "aes128gcm.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+/* Operations timed */
+enum { OP_AES128E, OP_GCTR, OP_GHASH, OP_ENCRYPT, OP_DECRYPT, OP_ENCRYPT_PARALLEL, OP_ENCRYPT_AAD16, OPS };
+
+static const char *op_name[OPS] = { "aes128e", "gctr", "ghash", "encrypt", "decrypt", "encrypt_parallel", "encrypt_aad16" };
+
+/* Size limit of all-core runs */
+#define ALL_CORE_MAX (4UL << 20)
+
+static const unsigned char IV[12]={0xca,0xfe,0xba,0xbe,0xfa,0xce,0xdb,0xad,0xde,0xca,0xf8,0x88};
+static const unsigned char AAD[16]={0xfe,0xed,0xfa,0xce,0xde,0xad,0xbe,0xef,0xfe,0xed,0xfa,0xce,0xde,0xad,0xbe,0xef};
+
+/* One thread's share of a point: reps runs of op over size bytes, in its own buffers */
+struct bench_job {
+  int op, threads, started;			/* started: runs on a thread of its own, to be joined */
+  const aes128gcm_key *gk;
+  unsigned long size, reps;
+  unsigned char *in, *out, tag[16];
+};
+
+/* Seconds on the monotonic clock */
+static double now(void) {
+
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Time-stamp counter, or 0 where there is none */
+static uint64_t ticks(void) {
+#ifdef HAVE_TSC
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+/* Thread body: the measured loop */
+static void *bench_run(void *p) {
+
+  struct bench_job *job = p;
+  unsigned char CB[16] = {0};
+  aes128gcm_ctx ctx;
+  unsigned long r, i;
+
+  for(r=0;r<job->reps;r++){
+    switch(job->op){
+    case OP_AES128E:
+      for(i=0;i<job->size;i+=16)
+        aes128e_encrypt(job->out + i, job->in + i, &job->gk->aes);
+      break;
+    case OP_GCTR:
+      aes128e_ctr32(job->out, job->in, job->size / 16, CB, &job->gk->aes);
+      break;
+    case OP_GHASH:
+      aes128gcm_init(&ctx, job->gk, IV, 12);
+      aes128gcm_update_aad(&ctx, job->in, job->size);
+      aes128gcm_final(&ctx, job->tag);
+      break;
+    case OP_ENCRYPT:
+      aes128gcm_encrypt(job->out, job->tag, job->gk, IV, 12, job->in, job->size, NULL, 0);
+      break;
+    case OP_DECRYPT:
+      if(aes128gcm_decrypt(job->out, job->tag, job->gk, IV, 12, job->in, job->size, NULL, 0) != 0)
+        fprintf(stderr, "aes128gcm_bench: tag mismatch\n");
+      break;
+    case OP_ENCRYPT_PARALLEL:
+      aes128gcm_encrypt_parallel(job->out, job->tag, job->gk, IV, 12, job->in, job->size, NULL, 0, job->threads);
+      break;
+    case OP_ENCRYPT_AAD16:
+      aes128gcm_encrypt(job->out, job->tag, job->gk, IV, 12, job->in, job->size, AAD, sizeof(AAD));
+      break;
+    }
+  }
+  return NULL;
+}
+
+/* All jobs run once; returns the wall time and the ticks elapsed. Jobs whose thread could not
+   be started are run by the calling thread after its own */
+static double bench_once(struct bench_job *job, pthread_t *thread, int jobs, uint64_t *tick) {
+
+  double start = now();
+  int j;
+
+  *tick = ticks();
+  for(j=1;j<jobs;j++)
+    job[j].started = pthread_create(&thread[j], NULL, bench_run, &job[j]) == 0;
+  bench_run(&job[0]);
+  for(j=1;j<jobs;j++){
+    if(job[j].started)
+      pthread_join(thread[j], NULL);
+    else
+      bench_run(&job[j]);
+  }
+  *tick = ticks() - *tick;
+  return now() - start;
+}
+
+/* One point on nthreads threads (the parallel API gets them inside a single job); prints its
+   CSV line and returns the time of a single call */
+static double bench_point(int op, const aes128gcm_key *gk, int aes_backend, int ghash_backend, unsigned long size, double seconds, int nthreads) {
+
+  int jobs = op == OP_ENCRYPT_PARALLEL ? 1 : nthreads;
+  unsigned long reps = 1;
+  struct bench_job *job = calloc(jobs, sizeof(struct bench_job));
+  pthread_t *thread = calloc(jobs, sizeof(pthread_t));
+  double best, once, elapsed;
+  uint64_t best_ticks, tick;
+  int j, run;
+
+  for(j=0;j<jobs;j++){
+    job[j].op = op;
+    job[j].threads = nthreads;
+    job[j].gk = gk;
+    job[j].size = size;
+    job[j].in = malloc(size);
+    job[j].out = malloc(size);
+    if(job[j].in == NULL || job[j].out == NULL){
+      fprintf(stderr, "aes128gcm_bench: cannot allocate %lu bytes\n", size);
+      exit(1);
+    }
+    memset(job[j].in, 0x5a, size);		// Pages are touched before the first timing
+    memset(job[j].out, 0, size);
+    if(op == OP_DECRYPT)
+      aes128gcm_encrypt(job[j].in, job[j].tag, gk, IV, 12, job[j].in, size, NULL, 0);
+  }
+
+  for(j=0;j<jobs;j++)
+    job[j].reps = 1;
+  once = best = bench_once(job, thread, jobs, &best_ticks);	// Warm-up and calibration
+
+  if(once < seconds){
+    reps = (unsigned long)(seconds / (once > 1e-7 ? once : 1e-7)) + 1;
+    for(j=0;j<jobs;j++)
+      job[j].reps = reps;
+    for(run=0,best=1e30;run<3;run++){
+      elapsed = bench_once(job, thread, jobs, &tick);
+      if(elapsed < best){
+        best = elapsed;
+        best_ticks = tick;
+      }
+    }
+  }
+
+  printf("%s,%d,%d,%d,%lu,", op_name[op], aes_backend, ghash_backend, nthreads, size);
+#ifdef HAVE_TSC
+  printf("%.3f", (double)best_ticks * (op == OP_ENCRYPT_PARALLEL ? nthreads : jobs) / ((double)size * reps * jobs));
+#endif
+  printf(",%.3f\n", (double)size * reps * jobs / best * 1e-9);
+  fflush(stdout);
+
+  for(j=0;j<jobs;j++){
+    free(job[j].in);
+    free(job[j].out);
+  }
+  free(job);
+  free(thread);
+  return once;
+}
+
+int main(int argc, char **argv) {
+
+  const unsigned char key[16]={0xfe,0xff,0xe9,0x92,0x86,0x65,0x73,0x1c,0x6d,0x6a,0x8f,0x94,0x67,0x30,0x83,0x08};
+  unsigned long max_size = 64UL << 20, size;
+  double seconds = 0.1;
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  int aes_backend, ghash_backend, opt, op, t, threads[2];
+  aes128gcm_key gk;
+
+  while((opt = getopt(argc, argv, "m:s:t:")) != -1){
+    switch(opt){
+    case 'm': max_size = strtoul(optarg, NULL, 0); break;
+    case 's': seconds = strtod(optarg, NULL); break;
+    case 't': cores = strtol(optarg, NULL, 0); break;
+    default:
+      fprintf(stderr, "usage: %s [-m max_bytes] [-s seconds] [-t threads]\n", argv[0]);
+      return 1;
+    }
+  }
+  if(cores < 1)
+    cores = 1;
+  threads[0] = 1;
+  threads[1] = (int)cores;
+
+  printf("op,aes_backend,ghash_backend,threads,bytes,cycles_per_byte,gbps\n");
+
+  for(aes_backend=AES128E_PORTABLE;aes_backend<AES128E_BACKENDS;aes_backend++){
+    for(ghash_backend=AES128GCM_GHASH_PORTABLE;ghash_backend<AES128GCM_GHASH_BACKENDS;ghash_backend++){
+      if(aes128gcm_setkey_backend(&gk, key, aes_backend, ghash_backend) != 0)
+        continue;					// Not built or not supported by this CPU
+
+      for(op=OP_AES128E;op<=OP_DECRYPT;op++){
+        if(op <= OP_GCTR && ghash_backend != AES128GCM_GHASH_PORTABLE)
+          continue;					// AES alone: once per AES backend
+        if(op == OP_GHASH && aes_backend != AES128E_PORTABLE)
+          continue;					// GHASH alone: once per GHASH backend
+        for(t=0;t<(cores > 1 ? 2 : 1);t++){
+          for(size=16;size<=max_size;size*=4){
+            if(threads[t] > 1 && size > ALL_CORE_MAX)
+              break;
+            if(bench_point(op, &gk, aes_backend, ghash_backend, size, seconds, threads[t]) > seconds)
+              break;				// Larger sizes would only take longer at the same rate
+          }
+        }
+      }
+    }
+  }
+
+  /* Default backends: one large message on 1..all threads, and small messages with the 16
+     bytes of additional data of typical record protocols */
+  aes128gcm_setkey(&gk, key);
+  for(t=1;t<=cores;t++)
+    bench_point(OP_ENCRYPT_PARALLEL, &gk, gk.aes.backend, gk.ghash_backend, max_size, seconds, t);
+  for(size=64;size<=1024;size*=2)
+    bench_point(OP_ENCRYPT_AAD16, &gk, gk.aes.backend, gk.ghash_backend, size, seconds, 1);
+
+  return 0;
+}
@@ -0,0 +1,277 @@
+/*****************************************************************************/
+/* Cache of expanded GCM-AES 128 keys
+
+	Entries live in one array allocated at init. Each entry is on exactly one
+	of two lists: the free list, or the LRU list (most recent first), where it
+	is also reachable from its hash bucket. Eviction walks the LRU list from
+	the tail and takes the first entry with no holders, so a key in use by
+	some thread is never overwritten.
+
+	Loading and expanding a key on a miss are done without the lock, so a
+	slow loader does not stall hits on other keys. If two threads miss on the
+	same key at once, the second to insert finds the first one's entry and
+	discards its own copy.
+
+																			 */
+/*****************************************************************************/
+
+  // ************************************************************************//
+ // Includes		                                                        //
+// ************************************************************************//
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "aes128gcm_cache.h"
+
+  // ************************************************************************//
+ // Definitions		                                                        //
+// ************************************************************************//
+
+/* End of a list or bucket chain */
+#define None (-1)
+
+  // ************************************************************************ //
+ // Private functions                                                        //
+// ************************************************************************ //
+
+/* Key material is cleared through a volatile pointer, so the stores are not optimized away */
+static void Zeroize (void *p, unsigned long len) {
+
+	volatile unsigned char *v = p;
+
+	while (len--)
+	{
+		*v++ = 0;
+	}
+}
+
+/* Bucket of key_id: Fibonacci hashing, nbuckets is a power of two */
+static unsigned long Bucket (const aes128gcm_cache *cache, uint64_t key_id) {
+
+	return (unsigned long)((key_id * UINT64_C(0x9e3779b97f4a7c15)) >> 32) & (cache->nbuckets - 1);
+}
+
+/* Entry holding key_id, or None */
+static long Find (const aes128gcm_cache *cache, uint64_t key_id) {
+
+	long e;
+
+	for (e = cache->buckets[Bucket(cache, key_id)]; e != None; e = cache->entries[e].chain)
+	{
+		if (cache->entries[e].key_id == key_id && !cache->entries[e].stale)
+			return e;
+	}
+	return None;
+}
+
+/* Entry e is taken off the LRU list */
+static void Unlink (aes128gcm_cache *cache, long e) {
+
+	aes128gcm_cache_entry *entry = &cache->entries[e];
+
+	if (entry->prev != None)
+		cache->entries[entry->prev].next = entry->next;
+	else
+		cache->head = entry->next;
+	if (entry->next != None)
+		cache->entries[entry->next].prev = entry->prev;
+	else
+		cache->tail = entry->prev;
+}
+
+/* Entry e is put at the front of the LRU list */
+static void PushFront (aes128gcm_cache *cache, long e) {
+
+	cache->entries[e].prev = None;
+	cache->entries[e].next = cache->head;
+	if (cache->head != None)
+		cache->entries[cache->head].prev = e;
+	else
+		cache->tail = e;
+	cache->head = e;
+}
+
+/* Entry e leaves its bucket and the LRU list, is zeroed and goes to the free list */
+static void Remove (aes128gcm_cache *cache, long e) {
+
+	long *link = &cache->buckets[Bucket(cache, cache->entries[e].key_id)];
+
+	while (*link != e)
+	{
+		link = &cache->entries[*link].chain;
+	}
+	*link = cache->entries[e].chain;
+	Unlink(cache, e);
+
+	Zeroize(&cache->entries[e], sizeof(aes128gcm_cache_entry));	// Round keys, H and the GHASH tables
+	cache->entries[e].next = cache->free_list;
+	cache->free_list = e;
+	cache->used--;
+}
+
+/* A free entry, evicting the least recently used unheld key if there is none; None if every key is held */
+static long Allocate (aes128gcm_cache *cache) {
+
+	long e = cache->free_list;
+
+	if (e != None)
+	{
+		cache->free_list = cache->entries[e].next;
+		return e;
+	}
+
+	for (e = cache->tail; e != None; e = cache->entries[e].prev)
+	{
+		if (cache->entries[e].refs == 0)
+		{
+			Remove(cache, e);
+			cache->evictions++;
+			cache->free_list = cache->entries[e].next;
+			return e;
+		}
+	}
+	return None;
+}
+
+  // ************************************************************************ //
+ // Public functions                                                         //
+// ************************************************************************ //
+
+/* Entries and buckets are allocated once; nothing is allocated afterwards */
+int aes128gcm_cache_init(aes128gcm_cache *cache, unsigned long capacity, aes128gcm_cache_loader loader, void *loader_arg) {
+
+	unsigned long i;
+
+	memset(cache, 0, sizeof(*cache));
+	for (cache->nbuckets = 1; cache->nbuckets < 2 * capacity; cache->nbuckets <<= 1);	// Load factor at most 1/2
+
+	cache->entries = calloc(capacity, sizeof(aes128gcm_cache_entry));
+	cache->buckets = malloc(cache->nbuckets * sizeof(long));
+	if (capacity == 0 || cache->entries == NULL || cache->buckets == NULL || pthread_mutex_init(&cache->lock, NULL) != 0)
+	{
+		free(cache->entries);
+		free(cache->buckets);
+		return -1;
+	}
+
+	for (i = 0; i < cache->nbuckets; i++)
+	{
+		cache->buckets[i] = None;
+	}
+	for (i = 0; i < capacity; i++)
+	{
+		cache->entries[i].next = i + 1 < capacity ? (long)i + 1 : None;
+	}
+	cache->capacity = capacity;
+	cache->head = cache->tail = None;
+	cache->free_list = 0;
+	cache->loader = loader;
+	cache->loader_arg = loader_arg;
+	return 0;
+}
+
+/* Every entry is zeroed, used or not */
+void aes128gcm_cache_destroy(aes128gcm_cache *cache) {
+
+	Zeroize(cache->entries, cache->capacity * sizeof(aes128gcm_cache_entry));
+	free(cache->entries);
+	free(cache->buckets);
+	pthread_mutex_destroy(&cache->lock);
+}
+
+/* Lookup under the lock; on a miss the key is loaded and expanded outside it, then inserted */
+const aes128gcm_key *aes128gcm_cache_acquire(aes128gcm_cache *cache, uint64_t key_id) {
+
+	unsigned char key[16];
+	aes128gcm_key gk;
+	long e;
+
+	pthread_mutex_lock(&cache->lock);
+	e = Find(cache, key_id);
+	if (e != None)
+	{
+		cache->hits++;
+		cache->entries[e].refs++;
+		Unlink(cache, e);
+		PushFront(cache, e);
+		pthread_mutex_unlock(&cache->lock);
+		return &cache->entries[e].gk;
+	}
+	cache->misses++;
+	pthread_mutex_unlock(&cache->lock);
+
+	if (cache->loader(cache->loader_arg, key_id, key) != 0)
+		return NULL;
+	aes128gcm_setkey(&gk, key);				// Key schedule, H and GHASH tables, once per load
+	Zeroize(key, sizeof(key));
+
+	pthread_mutex_lock(&cache->lock);
+	e = Find(cache, key_id);				// Another thread may have loaded it meanwhile
+	if (e == None)
+	{
+		e = Allocate(cache);
+		if (e != None)
+		{
+			memcpy(&cache->entries[e].gk, &gk, sizeof(gk));
+			cache->entries[e].key_id = key_id;
+			cache->entries[e].refs = 0;
+			cache->entries[e].stale = 0;
+			cache->entries[e].chain = cache->buckets[Bucket(cache, key_id)];
+			cache->buckets[Bucket(cache, key_id)] = e;
+			PushFront(cache, e);
+			cache->used++;
+		}
+	}
+	else
+	{
+		Unlink(cache, e);
+		PushFront(cache, e);
+	}
+	if (e != None)
+		cache->entries[e].refs++;
+	pthread_mutex_unlock(&cache->lock);
+
+	Zeroize(&gk, sizeof(gk));
+	return e != None ? &cache->entries[e].gk : NULL;
+}
+
+/* The entry is found from the key pointer, which is its first member */
+void aes128gcm_cache_release(aes128gcm_cache *cache, const aes128gcm_key *gk) {
+
+	long e = (long)((const aes128gcm_cache_entry *)gk - cache->entries);
+
+	pthread_mutex_lock(&cache->lock);
+	if (--cache->entries[e].refs == 0 && cache->entries[e].stale)
+		Remove(cache, e);					// Invalidated while it was held
+	pthread_mutex_unlock(&cache->lock);
+}
+
+/* A held key is only marked, so that its holders keep valid material until they release it */
+void aes128gcm_cache_invalidate(aes128gcm_cache *cache, uint64_t key_id) {
+
+	long e;
+
+	pthread_mutex_lock(&cache->lock);
+	e = Find(cache, key_id);
+	if (e != None)
+	{
+		if (cache->entries[e].refs == 0)
+			Remove(cache, e);
+		else
+			cache->entries[e].stale = 1;	// Find() no longer returns it, a new load takes a new entry
+	}
+	pthread_mutex_unlock(&cache->lock);
+}
+
+/* Counters are read under the lock, so the three values are consistent */
+void aes128gcm_cache_stats(aes128gcm_cache *cache, uint64_t *hits, uint64_t *misses, uint64_t *evictions) {
+
+	pthread_mutex_lock(&cache->lock);
+	if (hits)
+		*hits = cache->hits;
+	if (misses)
+		*misses = cache->misses;
+	if (evictions)
+		*evictions = cache->evictions;
+	pthread_mutex_unlock(&cache->lock);
+}
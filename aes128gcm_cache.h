@@ -0,0 +1,61 @@
+#ifndef AES128GCM_CACHE_H
+#define AES128GCM_CACHE_H
+
+/* Bounded, thread-safe cache of expanded GCM keys looked up by a 64-bit key ID.
+ * A miss asks the caller's loader for the 16-byte key and expands it once with
+ * aes128gcm_setkey(); when the cache is full the least recently used key that no
+ * thread holds is evicted, and its expanded material is zeroed.
+ */
+
+#include <stdint.h>
+#include <pthread.h>
+#include "aes128gcm.h"
+
+/* Called on a miss to fetch the raw key of key_id into key. Returns 0 on success, any
+ * other value if the key is unknown. It runs without the cache lock held. */
+typedef int (*aes128gcm_cache_loader)(void *arg, uint64_t key_id, unsigned char *key);
+
+/* One cached key; gk is first so that a pointer to it is a pointer to the entry. */
+typedef struct {
+	aes128gcm_key gk;
+	uint64_t key_id;
+	unsigned long refs;			/* Threads holding the key; pinned while non-zero */
+	int stale;					/* Invalidated while held: dropped on the last release */
+	long prev, next;			/* LRU list, most recent first (-1 ends it) */
+	long chain;					/* Next entry in the same hash bucket (-1 ends it) */
+} aes128gcm_cache_entry;
+
+typedef struct {
+	pthread_mutex_t lock;
+	aes128gcm_cache_entry *entries;
+	long *buckets;
+	unsigned long capacity, nbuckets, used;
+	long head, tail;			/* Most and least recently used entries */
+	long free_list;				/* Unused entries, linked through next */
+	aes128gcm_cache_loader loader;
+	void *loader_arg;
+	uint64_t hits, misses, evictions;
+} aes128gcm_cache;
+
+/* Set up cache for at most capacity keys. Returns 0, or -1 if memory is exhausted. */
+int aes128gcm_cache_init(aes128gcm_cache *cache, unsigned long capacity, aes128gcm_cache_loader loader, void *loader_arg);
+
+/* Zero every cached key and free the cache. No key may still be held. */
+void aes128gcm_cache_destroy(aes128gcm_cache *cache);
+
+/* Return the expanded key of key_id, loading it on a miss, and hold it until
+ * aes128gcm_cache_release(): a held key is never evicted or zeroed. Returns NULL if
+ * the loader fails or every entry is held by some thread. */
+const aes128gcm_key *aes128gcm_cache_acquire(aes128gcm_cache *cache, uint64_t key_id);
+
+/* Give back a key returned by aes128gcm_cache_acquire(). */
+void aes128gcm_cache_release(aes128gcm_cache *cache, const aes128gcm_key *gk);
+
+/* Drop key_id from the cache (e.g. after a rotation) and zero it, at once if no thread
+ * holds it, otherwise on its last release. */
+void aes128gcm_cache_invalidate(aes128gcm_cache *cache, uint64_t key_id);
+
+/* Read the hit, miss and eviction counters; any pointer may be NULL. */
+void aes128gcm_cache_stats(aes128gcm_cache *cache, uint64_t *hits, uint64_t *misses, uint64_t *evictions);
+
+#endif
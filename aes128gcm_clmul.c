@@ -0,0 +1,312 @@
+/*****************************************************************************/
+/* PCLMULQDQ backend of GHASH
+
+	Blocks are byte-reflected so that a 128-bit register holds the GCM block
+	as a polynomial with the first byte most significant. Every product is
+	computed with three carry-less multiplies (Karatsuba), and the 256-bit
+	products of up to 8 blocks against H^8..H^1 are summed before a single
+	shift and reduction modulo x^128 + x^7 + x^2 + x + 1:
+
+		Y' = (Y ^ X1) * H^8 ^ X2 * H^7 ^ ... ^ X8 * H
+
+	The stitched kernels run AES-CTR and GHASH over the same 8 blocks in one
+	pass: the multiplies of one group are issued between the AES rounds of
+	the next, so both units are busy and the ciphertext is hashed straight
+	from registers instead of being read back from memory.
+
+	This file is compiled with -mpclmul -mssse3 -maes, but nothing in it runs
+	unless CPUID reports them (see aes128gcm_setkey and aes128e_setkey).
+
+																			 */
+/*****************************************************************************/
+
+  // ************************************************************************//
+ // Includes		                                                        //
+// ************************************************************************//
+#include "aes128gcm_clmul.h"
+
+#ifdef AES128GCM_HAVE_CLMUL
+
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#include <wmmintrin.h>
+
+  // ************************************************************************//
+ // Definitions		                                                        //
+// ************************************************************************//
+
+/* Reverses the 16 bytes of a block (GCM byte order <-> polynomial order) */
+#define BSWAP_MASK _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15)
+
+/* Number of rounds of AES-128 */
+#define Nr 10
+
+  // ************************************************************************ //
+ // Private functions                                                        //
+// ************************************************************************ //
+
+/* Accumulate the unreduced product a * h into lo, hi and the Karatsuba middle term mid */
+static inline void MulAcc(__m128i a, __m128i h, __m128i *lo, __m128i *hi, __m128i *mid) {
+
+	__m128i as = _mm_xor_si128(a, _mm_shuffle_epi32(a, 0x4e));	// Low qword is a0 ^ a1
+	__m128i hs = _mm_xor_si128(h, _mm_shuffle_epi32(h, 0x4e));	// Low qword is h0 ^ h1
+
+	*lo  = _mm_xor_si128(*lo,  _mm_clmulepi64_si128(a, h, 0x00));	// a0 * h0
+	*hi  = _mm_xor_si128(*hi,  _mm_clmulepi64_si128(a, h, 0x11));	// a1 * h1
+	*mid = _mm_xor_si128(*mid, _mm_clmulepi64_si128(as, hs, 0x00));	// (a0 ^ a1) * (h0 ^ h1)
+}
+
+/* Reduce a sum of Karatsuba products to a 128-bit field element */
+static inline __m128i Reduce(__m128i lo, __m128i hi, __m128i mid) {
+
+	__m128i t1, t2, t3;
+
+	mid = _mm_xor_si128(mid, _mm_xor_si128(lo, hi));	// Middle 128 bits of the 256-bit product
+	lo = _mm_xor_si128(lo, _mm_slli_si128(mid, 8));
+	hi = _mm_xor_si128(hi, _mm_srli_si128(mid, 8));
+
+	// The operands were bit-reflected, so the 256-bit product [hi:lo] is shifted left by one bit
+	t1 = _mm_srli_epi32(lo, 31);
+	t2 = _mm_srli_epi32(hi, 31);
+	lo = _mm_slli_epi32(lo, 1);
+	hi = _mm_slli_epi32(hi, 1);
+	t3 = _mm_srli_si128(t1, 12);
+	t2 = _mm_slli_si128(t2, 4);
+	t1 = _mm_slli_si128(t1, 4);
+	lo = _mm_or_si128(lo, t1);
+	hi = _mm_or_si128(hi, t2);
+	hi = _mm_or_si128(hi, t3);
+
+	// First phase of the reduction: multiply the low half by x^63, x^62 and x^57
+	t1 = _mm_slli_epi32(lo, 31);
+	t2 = _mm_slli_epi32(lo, 30);
+	t3 = _mm_slli_epi32(lo, 25);
+	t1 = _mm_xor_si128(t1, t2);
+	t1 = _mm_xor_si128(t1, t3);
+	t2 = _mm_srli_si128(t1, 4);
+	t1 = _mm_slli_si128(t1, 12);
+	lo = _mm_xor_si128(lo, t1);
+
+	// Second phase: fold the low half into the high half with x^1, x^2 and x^7
+	t1 = _mm_srli_epi32(lo, 1);
+	t3 = _mm_srli_epi32(lo, 2);
+	t1 = _mm_xor_si128(t1, t3);
+	t3 = _mm_srli_epi32(lo, 7);
+	t1 = _mm_xor_si128(t1, t3);
+	t1 = _mm_xor_si128(t1, t2);
+	lo = _mm_xor_si128(lo, t1);
+
+	return _mm_xor_si128(hi, lo);
+}
+
+/* Multiplication in GF(2^128) of two byte-reflected elements */
+static inline __m128i GFMulCLMUL(__m128i a, __m128i b) {
+
+	__m128i lo = _mm_setzero_si128(), hi = _mm_setzero_si128(), mid = _mm_setzero_si128();
+
+	MulAcc(a, b, &lo, &hi, &mid);
+	return Reduce(lo, hi, mid);
+}
+
+/* Absorb n <= 8 byte-reflected blocks x[] into y with a single reduction */
+static inline __m128i GhashGroup(__m128i y, const __m128i *x, unsigned long n, const unsigned char Hpow[][16]) {
+
+	__m128i lo = _mm_setzero_si128(), hi = _mm_setzero_si128(), mid = _mm_setzero_si128();
+
+	for (unsigned long i = 0; i < n; i++)		// Block i is multiplied by H^(n - i)
+	{
+		MulAcc(i == 0 ? _mm_xor_si128(x[0], y) : x[i], _mm_loadu_si128((const __m128i *)Hpow[n - 1 - i]), &lo, &hi, &mid);
+	}
+	return Reduce(lo, hi, mid);
+}
+
+/* One counter block encrypted and XORed into the 16 bytes at in; the counter is advanced */
+static inline __m128i CTRBlock(const __m128i *rk, __m128i *counter, const unsigned char *in) {
+
+	const __m128i bswap = BSWAP_MASK;
+	__m128i b = _mm_xor_si128(_mm_shuffle_epi8(*counter, bswap), rk[0]);
+
+	*counter = _mm_add_epi32(*counter, _mm_set_epi32(0, 0, 0, 1));	// inc32
+	for (int r = 1; r < Nr; r++)
+	{
+		b = _mm_aesenc_si128(b, rk[r]);
+	}
+	b = _mm_aesenclast_si128(b, rk[Nr]);
+	return _mm_xor_si128(b, _mm_loadu_si128((const __m128i *)in));
+}
+
+/* Shared by both directions: 8 counter blocks go through the AES rounds while the
+   8 blocks of hash[] are multiplied by H^8..H^1 between them, then reduced into y */
+static inline void StitchedGroup(const __m128i *rk, __m128i *counter, __m128i *b, const __m128i *hash, int hashing, __m128i *y, const unsigned char Hpow[][16]) {
+
+	const __m128i bswap = BSWAP_MASK;
+	__m128i lo = _mm_setzero_si128(), hi = _mm_setzero_si128(), mid = _mm_setzero_si128();
+	int i, r;
+
+	for (i = 0; i < AES128GCM_CLMUL_POWERS; i++)
+	{
+		b[i] = _mm_xor_si128(_mm_shuffle_epi8(*counter, bswap), rk[0]);
+		*counter = _mm_add_epi32(*counter, _mm_set_epi32(0, 0, 0, 1));
+	}
+
+	for (r = 1; r < Nr; r++)
+	{
+		for (i = 0; i < AES128GCM_CLMUL_POWERS; i++)
+		{
+			b[i] = _mm_aesenc_si128(b[i], rk[r]);
+		}
+		if (hashing && r <= AES128GCM_CLMUL_POWERS)	// One multiply per round, hidden behind the AESENC latency
+		{
+			MulAcc(r == 1 ? _mm_xor_si128(hash[0], *y) : hash[r - 1], _mm_loadu_si128((const __m128i *)Hpow[AES128GCM_CLMUL_POWERS - r]), &lo, &hi, &mid);
+		}
+	}
+
+	for (i = 0; i < AES128GCM_CLMUL_POWERS; i++)
+	{
+		b[i] = _mm_aesenclast_si128(b[i], rk[Nr]);
+	}
+
+	if (hashing)
+		*y = Reduce(lo, hi, mid);
+}
+
+  // ************************************************************************ //
+ // Public functions                                                         //
+// ************************************************************************ //
+
+/* Fill Hpow[i] with H^(i+1) for i = 0..7 */
+void aes128gcm_clmul_init(unsigned char Hpow[][16], const unsigned char *H) {
+
+	__m128i h = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)H), BSWAP_MASK);
+	__m128i power = h;
+
+	_mm_storeu_si128((__m128i *)Hpow[0], h);		// Powers are stored byte-reflected, ready for MulAcc
+	for (int i = 1; i < AES128GCM_CLMUL_POWERS; i++)
+	{
+		power = GFMulCLMUL(power, h);
+		_mm_storeu_si128((__m128i *)Hpow[i], power);
+	}
+}
+
+/* Absorb nblocks blocks at X into Y, 8 blocks per reduction */
+void aes128gcm_clmul_ghash(unsigned char *Y, const unsigned char Hpow[][16], const unsigned char *X, unsigned long nblocks) {
+
+	const __m128i bswap = BSWAP_MASK;
+	__m128i y = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)Y), bswap);
+	__m128i lo, hi, mid, x;
+	unsigned long n;
+
+	while (nblocks > 0)
+	{
+		n = nblocks < AES128GCM_CLMUL_POWERS ? nblocks : AES128GCM_CLMUL_POWERS;	// Blocks absorbed by this reduction
+		lo = hi = mid = _mm_setzero_si128();
+
+		for (unsigned long i = 0; i < n; i++)		// Block i is multiplied by H^(n - i)
+		{
+			x = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(X + 16 * i)), bswap);
+			if (i == 0)
+				x = _mm_xor_si128(x, y);			// The running hash enters with the first block
+			MulAcc(x, _mm_loadu_si128((const __m128i *)Hpow[n - 1 - i]), &lo, &hi, &mid);
+		}
+
+		y = Reduce(lo, hi, mid);					// One reduction for the whole group
+		X += 16 * n;
+		nblocks -= n;
+	}
+
+	_mm_storeu_si128((__m128i *)Y, _mm_shuffle_epi8(y, bswap));
+}
+
+/* CTR encryption of nblocks blocks with the ciphertext hashed into Y in the same pass */
+void aes128gcm_clmul_encrypt(unsigned char *out, const unsigned char *in, unsigned long nblocks, unsigned char *CB, const unsigned char *roundKeys, unsigned char *Y, const unsigned char Hpow[][16]) {
+
+	const __m128i bswap = BSWAP_MASK;
+	__m128i rk[Nr + 1], b[AES128GCM_CLMUL_POWERS], c[AES128GCM_CLMUL_POWERS];
+	__m128i counter = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)CB), bswap);
+	__m128i y = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)Y), bswap);
+	int pending = 0;			// c[] holds a group of ciphertext that is not hashed yet
+	unsigned long i;
+
+	for (i = 0; i <= Nr; i++)
+	{
+		rk[i] = _mm_loadu_si128((const __m128i *)roundKeys + i);
+	}
+
+	for (; nblocks >= AES128GCM_CLMUL_POWERS; nblocks -= AES128GCM_CLMUL_POWERS, in += 16 * AES128GCM_CLMUL_POWERS, out += 16 * AES128GCM_CLMUL_POWERS)
+	{
+		StitchedGroup(rk, &counter, b, c, pending, &y, Hpow);	// Hashes the previous group while encrypting this one
+
+		for (i = 0; i < AES128GCM_CLMUL_POWERS; i++)
+		{
+			b[i] = _mm_xor_si128(b[i], _mm_loadu_si128((const __m128i *)in + i));
+			_mm_storeu_si128((__m128i *)out + i, b[i]);
+			c[i] = _mm_shuffle_epi8(b[i], bswap);			// Kept in registers for the next group
+		}
+		pending = 1;
+	}
+
+	if (pending)
+		y = GhashGroup(y, c, AES128GCM_CLMUL_POWERS, Hpow);	// Last whole group
+
+	for (i = 0; i < nblocks; i++)							// Fewer than 8 blocks left
+	{
+		b[i] = CTRBlock(rk, &counter, in + 16 * i);
+		_mm_storeu_si128((__m128i *)out + i, b[i]);
+		c[i] = _mm_shuffle_epi8(b[i], bswap);
+	}
+	if (nblocks > 0)
+		y = GhashGroup(y, c, nblocks, Hpow);
+
+	_mm_storeu_si128((__m128i *)CB, _mm_shuffle_epi8(counter, bswap));
+	_mm_storeu_si128((__m128i *)Y, _mm_shuffle_epi8(y, bswap));
+}
+
+/* CTR decryption of nblocks blocks with the ciphertext hashed into Y in the same pass */
+void aes128gcm_clmul_decrypt(unsigned char *out, const unsigned char *in, unsigned long nblocks, unsigned char *CB, const unsigned char *roundKeys, unsigned char *Y, const unsigned char Hpow[][16]) {
+
+	const __m128i bswap = BSWAP_MASK;
+	__m128i rk[Nr + 1], b[AES128GCM_CLMUL_POWERS], c[AES128GCM_CLMUL_POWERS], x[AES128GCM_CLMUL_POWERS];
+	__m128i counter = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)CB), bswap);
+	__m128i y = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)Y), bswap);
+	unsigned long i;
+
+	for (i = 0; i <= Nr; i++)
+	{
+		rk[i] = _mm_loadu_si128((const __m128i *)roundKeys + i);
+	}
+
+	for (; nblocks >= AES128GCM_CLMUL_POWERS; nblocks -= AES128GCM_CLMUL_POWERS, in += 16 * AES128GCM_CLMUL_POWERS, out += 16 * AES128GCM_CLMUL_POWERS)
+	{
+		for (i = 0; i < AES128GCM_CLMUL_POWERS; i++)
+		{
+			c[i] = _mm_loadu_si128((const __m128i *)in + i);	// Read once, before out may overwrite it
+		}
+		for (i = 0; i < AES128GCM_CLMUL_POWERS; i++)
+		{
+			x[i] = _mm_shuffle_epi8(c[i], bswap);
+		}
+
+		StitchedGroup(rk, &counter, b, x, 1, &y, Hpow);		// The ciphertext is already known, so it is hashed with its own group
+
+		for (i = 0; i < AES128GCM_CLMUL_POWERS; i++)
+		{
+			_mm_storeu_si128((__m128i *)out + i, _mm_xor_si128(b[i], c[i]));
+		}
+	}
+
+	for (i = 0; i < nblocks; i++)
+	{
+		x[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)in + i), bswap);
+	}
+	if (nblocks > 0)
+		y = GhashGroup(y, x, nblocks, Hpow);				// Hashed before the plaintext is written
+	for (i = 0; i < nblocks; i++)
+	{
+		_mm_storeu_si128((__m128i *)out + i, CTRBlock(rk, &counter, in + 16 * i));
+	}
+
+	_mm_storeu_si128((__m128i *)CB, _mm_shuffle_epi8(counter, bswap));
+	_mm_storeu_si128((__m128i *)Y, _mm_shuffle_epi8(y, bswap));
+}
+
+#endif
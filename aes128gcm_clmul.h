@@ -0,0 +1,31 @@
+#ifndef AES128GCM_CLMUL_H
+#define AES128GCM_CLMUL_H
+
+/* PCLMULQDQ backend of GHASH. It is compiled on x86 only, and aes128gcm_setkey()
+ * only selects it when CPUID reports PCLMULQDQ and SSSE3. The stitched kernels also
+ * use AES-NI and are only called for keys whose AES backend is AES128E_AESNI or
+ * AES128E_VAES (same key schedule).
+ */
+
+#if defined(__x86_64__) || defined(__i386__)
+#define AES128GCM_HAVE_CLMUL 1
+
+/* Number of H powers kept per key, which is also the number of blocks absorbed per reduction */
+#define AES128GCM_CLMUL_POWERS 8
+
+/* Fill Hpow[i] with H^(i+1) for i = 0..7, from the 16-byte hash subkey H. */
+void aes128gcm_clmul_init(unsigned char Hpow[][16], const unsigned char *H);
+
+/* Absorb the nblocks 16-byte blocks at X into the GHASH accumulator Y (16 bytes, GCM
+ * byte order): Y = (...((Y ^ X1) * H ^ X2) * H ...) * H. */
+void aes128gcm_clmul_ghash(unsigned char *Y, const unsigned char Hpow[][16], const unsigned char *X, unsigned long nblocks);
+
+/* AES-CTR over nblocks blocks from in to out with the 32-bit counter in CB (advanced
+ * past the last block), fused with GHASH of the ciphertext into Y. roundKeys is the
+ * 176-byte AES-128 key schedule. out may equal in. */
+void aes128gcm_clmul_encrypt(unsigned char *out, const unsigned char *in, unsigned long nblocks, unsigned char *CB, const unsigned char *roundKeys, unsigned char *Y, const unsigned char Hpow[][16]);
+void aes128gcm_clmul_decrypt(unsigned char *out, const unsigned char *in, unsigned long nblocks, unsigned char *CB, const unsigned char *roundKeys, unsigned char *Y, const unsigned char Hpow[][16]);
+
+#endif
+
+#endif
@@ -0,0 +1,543 @@
+/* Conformance runner of the GCM-AES 128 implementation.
+ *
+ * usage: aes128gcm_conformance [-r random_cases] file...
+ *
+ * Reads NIST CAVP GCM response files (.rsp, encrypt or decrypt) and Wycheproof AEAD
+ * JSON files, and runs every AES-128 vector through every AES and GHASH backend
+ * available on this host, with the one-shot, streaming (random chunking),
+ * parallel and scatter/gather (random segments) APIs, and in place for the one-shot and
+ * streaming ones. Tags shorter than 16 bytes are compared on their prefix. Then
+ * random_cases random messages (200 by default) are encrypted with the portable AES
+ * and bit-serial GHASH and checked the same way on every other backend; build with
+ * AES128E_IMPL=reference to make that path the byte-oriented reference cipher.
+ *
+ * Prints one line per failure and a summary per file; exits with 1 on any failure.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include "aes128e.h"
+#include "aes128gcm.h"
+
+/* One test: valid is 0 when decryption must reject it (its pt is then meaningless) */
+struct vector {
+  char name[96];
+  unsigned char key[16], tag[16];
+  unsigned char *iv, *aad, *pt, *ct;
+  unsigned long len_iv, len_ad, len_p, len_tag;
+  int valid, has_pt, has_ct;
+};
+
+static unsigned long checks, failures, skipped;
+static unsigned long seed = 1;
+
+/* Pseudo-random numbers for chunking and the random cases */
+static unsigned long lcg(void) {
+  seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+  return (seed >> 33) & 0x7fffffff;
+}
+
+static void fail(const struct vector *v, int aes_backend, int ghash_backend, const char *what) {
+  printf("FAIL %s backend %d/%d: %s\n", v->name, aes_backend, ghash_backend, what);
+  failures++;
+}
+
+/* Hex string of n characters to bytes; returns the byte count, or -1 on a bad digit */
+static long unhex(unsigned char *out, const char *hex, unsigned long n) {
+  unsigned long i;
+  unsigned int byte;
+
+  if(n % 2)
+    return -1;
+  for(i=0;i<n;i+=2){
+    if(!isxdigit((unsigned char)hex[i]) || !isxdigit((unsigned char)hex[i+1]) || sscanf(hex + i, "%2x", &byte) != 1)
+      return -1;
+    out[i/2] = (unsigned char)byte;
+  }
+  return (long)(n / 2);
+}
+
+/* Field of n hex characters into a new buffer (at least one byte, so it is never NULL) */
+static unsigned char *field(const char *hex, unsigned long n, unsigned long *len) {
+  unsigned char *p = malloc(n / 2 + 1);
+  long r = unhex(p, hex, n);
+
+  *len = r < 0 ? 0 : (unsigned long)r;
+  return p;
+}
+
+static void vector_free(struct vector *v) {
+  free(v->iv);
+  free(v->aad);
+  free(v->pt);
+  free(v->ct);
+  memset(v, 0, sizeof(*v));
+}
+
+/* Tag computed by the library against the expected one, over the expected length */
+static int tag_ok(const struct vector *v, const unsigned char *tag) {
+  return !memcmp(tag, v->tag, v->len_tag);
+}
+
+/* Streaming pass in random chunks, in place when in_place is set (the input is first copied
+   to out); the computed tag is left in tag. Decryption with a full tag also goes through
+   aes128gcm_decrypt_final(), whose result is returned */
+static int stream(const struct vector *v, const aes128gcm_key *gk, int decrypt, int in_place, unsigned char *out, unsigned char *tag) {
+  aes128gcm_ctx ctx;
+  unsigned long off, chunk;
+  const unsigned char *in = decrypt ? v->ct : v->pt;
+  int result = 0;
+
+  if(in_place){
+    memcpy(out, in, v->len_p);
+    in = out;
+  }
+
+  aes128gcm_init(&ctx, gk, v->iv, v->len_iv);
+  for(off=0;off<v->len_ad;off+=chunk){
+    chunk = lcg() % 20;
+    if(chunk > v->len_ad - off)
+      chunk = v->len_ad - off;
+    aes128gcm_update_aad(&ctx, v->aad + off, chunk);
+  }
+  for(off=0;off<v->len_p;off+=chunk){
+    chunk = lcg() % 4 == 0 ? lcg() % 300 : lcg() % 20;
+    if(chunk > v->len_p - off)
+      chunk = v->len_p - off;
+    if(decrypt)
+      aes128gcm_decrypt_update(&ctx, out + off, in + off, chunk);
+    else
+      aes128gcm_update(&ctx, out + off, in + off, chunk);
+  }
+  if(decrypt && v->len_tag == 16)
+    result = aes128gcm_decrypt_final(&ctx, v->tag);
+  else
+    aes128gcm_final(&ctx, tag);		// Truncated tags are compared by the caller
+  return result;
+}
+
+/* Cuts len bytes at base into segments of 0 to 19 bytes, the last one taking what is left
+   when max is reached; returns the number of segments */
+static unsigned long split(aes128gcm_iovec *iov, unsigned long max, unsigned char *base, unsigned long len) {
+  unsigned long count, off, chunk;
+
+  for(count=0,off=0;off<len || count==0;off+=chunk,count++){
+    chunk = count == max - 1 ? len - off : lcg() % 20;
+    if(chunk > len - off)
+      chunk = len - off;
+    iov[count] = (aes128gcm_iovec){ base + off, chunk };
+  }
+  return count;
+}
+
+/* Scatter/gather encryption or decryption, the input, output and AAD cut at different places */
+static int scatter(const struct vector *v, const aes128gcm_key *gk, int decrypt, unsigned char *out, unsigned char *tag) {
+  unsigned long max = (v->len_p > v->len_ad ? v->len_p : v->len_ad) + 1;
+  aes128gcm_iovec *in = malloc(3 * max * sizeof(*in)), *outv = in + max, *aad = outv + max;
+  unsigned long in_count = split(in, max, (unsigned char *)(decrypt ? v->ct : v->pt), v->len_p);
+  unsigned long out_count = split(outv, max, out, v->len_p);
+  unsigned long aad_count = split(aad, max, (unsigned char *)v->aad, v->len_ad);
+  int result;
+
+  if(decrypt)
+    result = aes128gcm_decrypt_iov(outv, out_count, v->tag, gk, v->iv, v->len_iv, in, in_count, aad, aad_count);
+  else
+    result = aes128gcm_encrypt_iov(outv, out_count, tag, gk, v->iv, v->len_iv, in, in_count, aad, aad_count);
+  free(in);
+  return result;
+}
+
+/* The vector through every API under one backend pair */
+static void run_backend(const struct vector *v, const aes128gcm_key *gk, int aes_backend, int ghash_backend) {
+  unsigned char *out = malloc(v->len_p + 1);
+  unsigned char tag[16];
+  int result;
+
+  /* Encryption, only for vectors that carry both the plaintext and the ciphertext */
+  if(v->valid && v->has_pt && v->has_ct){
+    aes128gcm_encrypt(out, tag, gk, v->iv, v->len_iv, v->pt, v->len_p, v->aad, v->len_ad);
+    checks++;
+    if(memcmp(out, v->ct, v->len_p) || !tag_ok(v, tag))
+      fail(v, aes_backend, ghash_backend, "one-shot encryption");
+
+    stream(v, gk, 0, 0, out, tag);
+    checks++;
+    if(memcmp(out, v->ct, v->len_p) || !tag_ok(v, tag))
+      fail(v, aes_backend, ghash_backend, "streaming encryption");
+
+    memcpy(out, v->pt, v->len_p);
+    aes128gcm_encrypt(out, tag, gk, v->iv, v->len_iv, out, v->len_p, v->aad, v->len_ad);
+    checks++;
+    if(memcmp(out, v->ct, v->len_p) || !tag_ok(v, tag))
+      fail(v, aes_backend, ghash_backend, "in-place encryption");
+
+    stream(v, gk, 0, 1, out, tag);
+    checks++;
+    if(memcmp(out, v->ct, v->len_p) || !tag_ok(v, tag))
+      fail(v, aes_backend, ghash_backend, "in-place streaming encryption");
+
+    result = aes128gcm_encrypt_parallel(out, tag, gk, v->iv, v->len_iv, v->pt, v->len_p, v->aad, v->len_ad, 3);
+    checks++;
+    if(result || memcmp(out, v->ct, v->len_p) || !tag_ok(v, tag))
+      fail(v, aes_backend, ghash_backend, "parallel encryption");
+
+    result = scatter(v, gk, 0, out, tag);
+    checks++;
+    if(result || memcmp(out, v->ct, v->len_p) || !tag_ok(v, tag))
+      fail(v, aes_backend, ghash_backend, "scatter/gather encryption");
+  }
+
+  /* Decryption: valid vectors give the plaintext back, invalid ones are rejected */
+  if(v->has_ct && v->len_tag == 16){
+    result = aes128gcm_decrypt(out, v->tag, gk, v->iv, v->len_iv, v->ct, v->len_p, v->aad, v->len_ad);
+    checks++;
+    if(v->valid ? result != 0 || (v->has_pt && memcmp(out, v->pt, v->len_p)) : result != -1)
+      fail(v, aes_backend, ghash_backend, "one-shot decryption");
+
+    result = stream(v, gk, 1, 0, out, tag);
+    checks++;
+    if(v->valid ? result != 0 || (v->has_pt && memcmp(out, v->pt, v->len_p)) : result != -1)
+      fail(v, aes_backend, ghash_backend, "streaming decryption");
+
+    memcpy(out, v->ct, v->len_p);
+    result = aes128gcm_decrypt(out, v->tag, gk, v->iv, v->len_iv, out, v->len_p, v->aad, v->len_ad);
+    checks++;
+    if(v->valid ? result != 0 || (v->has_pt && memcmp(out, v->pt, v->len_p)) : result != -1)
+      fail(v, aes_backend, ghash_backend, "in-place decryption");
+
+    result = stream(v, gk, 1, 1, out, tag);
+    checks++;
+    if(v->valid ? result != 0 || (v->has_pt && memcmp(out, v->pt, v->len_p)) : result != -1)
+      fail(v, aes_backend, ghash_backend, "in-place streaming decryption");
+
+    result = aes128gcm_decrypt_parallel(out, v->tag, gk, v->iv, v->len_iv, v->ct, v->len_p, v->aad, v->len_ad, 3);
+    checks++;
+    if(v->valid ? result != 0 || (v->has_pt && memcmp(out, v->pt, v->len_p)) : result != -1)
+      fail(v, aes_backend, ghash_backend, "parallel decryption");
+
+    result = scatter(v, gk, 1, out, tag);
+    checks++;
+    if(v->valid ? result != 0 || (v->has_pt && memcmp(out, v->pt, v->len_p)) : result != -1)
+      fail(v, aes_backend, ghash_backend, "scatter/gather decryption");
+  }
+  else if(v->has_ct){
+    stream(v, gk, 1, 0, out, tag);		// Truncated tag: the recomputed tag is compared on its prefix
+    checks++;
+    if(v->valid ? !tag_ok(v, tag) || (v->has_pt && memcmp(out, v->pt, v->len_p)) : tag_ok(v, tag) && !memcmp(out, v->pt, v->len_p))
+      fail(v, aes_backend, ghash_backend, "streaming decryption, truncated tag");
+  }
+
+  free(out);
+}
+
+/* The vector under every backend pair this build and CPU support */
+static void run_vector(const struct vector *v) {
+  aes128gcm_key gk;
+  int aes_backend, ghash_backend;
+
+  if(v->len_iv == 0 || v->len_tag == 0 || v->len_tag > 16){
+    skipped++;						// Outside what SP 800-38D allows, and what the API takes
+    return;
+  }
+  for(aes_backend=AES128E_PORTABLE;aes_backend<AES128E_BACKENDS;aes_backend++)
+    for(ghash_backend=AES128GCM_GHASH_PORTABLE;ghash_backend<AES128GCM_GHASH_BACKENDS;ghash_backend++)
+      if(aes128gcm_setkey_backend(&gk, v->key, aes_backend, ghash_backend) == 0)
+        run_backend(v, &gk, aes_backend, ghash_backend);
+}
+
+/* Whole file into a NUL-terminated buffer */
+static char *slurp(const char *path) {
+  FILE *f = fopen(path, "rb");
+  char *text = NULL;
+  long n;
+
+  if(f == NULL)
+    return NULL;
+  if(fseek(f, 0, SEEK_END) == 0 && (n = ftell(f)) >= 0 && fseek(f, 0, SEEK_SET) == 0 && (text = malloc(n + 1)) != NULL){
+    if(fread(text, 1, n, f) != (size_t)n){
+      free(text);
+      text = NULL;
+    }
+    else
+      text[n] = 0;
+  }
+  fclose(f);
+  return text;
+}
+
+/* CAVP response file: "name = hex" lines grouped by "Count", "FAIL" marks a forgery */
+static void parse_rsp(const char *path, char *text) {
+  struct vector v;
+  char section[64] = "", *line, *eq, *value, *end;
+  unsigned long len;
+  int keylen = 128, open = 0;
+
+  memset(&v, 0, sizeof(v));
+  for(line=strtok(text, "\n");;line=strtok(NULL, "\n")){
+    if(line == NULL || !strncmp(line, "Count", 5)){
+      if(open){
+        if(keylen == 128)
+          run_vector(&v);
+        else
+          skipped++;
+        vector_free(&v);
+        open = 0;
+      }
+      if(line == NULL)
+        break;
+    }
+    end = line + strlen(line);
+    while(end > line && isspace((unsigned char)end[-1]))
+      *--end = 0;
+    if(line[0] == '[' && sscanf(line, "[Keylen = %d]", &keylen) != 1 && !strncmp(line, "[IVlen", 6))
+      snprintf(section, sizeof(section), "%s", line);
+    if(line[0] == '#' || line[0] == '[')
+      continue;
+    if(!strcmp(line, "FAIL")){
+      v.valid = 0;
+      continue;
+    }
+    if((eq = strchr(line, '=')) == NULL)
+      continue;
+    for(value=eq+1;*value==' ';value++);
+    while(eq > line && eq[-1] == ' ')
+      eq--;
+    *eq = 0;
+
+    if(!strcmp(line, "Count")){
+      open = 1;
+      v.valid = 1;
+      snprintf(v.name, sizeof(v.name), "%s %s Count %s", path, section, value);
+    }
+    else if(!strcmp(line, "Key")){
+      if(unhex(v.key, value, strlen(value)) != 16)
+        keylen = 0;
+    }
+    else if(!strcmp(line, "IV"))
+      v.iv = field(value, strlen(value), &v.len_iv);
+    else if(!strcmp(line, "AAD"))
+      v.aad = field(value, strlen(value), &v.len_ad);
+    else if(!strcmp(line, "PT")){
+      v.pt = field(value, strlen(value), &v.len_p);
+      v.has_pt = 1;
+    }
+    else if(!strcmp(line, "CT")){
+      v.ct = field(value, strlen(value), &len);
+      v.len_p = len;
+      v.has_ct = 1;
+    }
+    else if(!strcmp(line, "Tag")){
+      if(strlen(value) > 32 || (v.len_tag = unhex(v.tag, value, strlen(value))) == (unsigned long)-1)
+        v.len_tag = 0;
+    }
+  }
+}
+
+/* Minimal JSON reader: enough for Wycheproof files. Objects are walked recursively; the
+   string and number members of each one are collected, and an object with a "tcId" is a test */
+struct json_member { const char *name, *value; unsigned long name_len, value_len; };
+
+static const char *json_skip(const char *p) {
+  while(*p && isspace((unsigned char)*p))
+    p++;
+  return p;
+}
+
+/* String at p (after the quote); returns the closing quote, or NULL */
+static const char *json_string(const char *p) {
+  while(*p && *p != '"'){
+    if(*p == '\\' && p[1])
+      p++;
+    p++;
+  }
+  return *p ? p : NULL;
+}
+
+static const char *json_value(const char *path, const char *p, struct json_member *out);
+
+/* A test object is turned into a vector and run */
+static void json_test(const char *path, struct json_member *m, int n) {
+  struct vector v;
+  const char *tcid = "?";
+  int i, key_ok = 0;
+
+  memset(&v, 0, sizeof(v));
+  v.valid = 1;
+  v.has_pt = v.has_ct = 1;
+  for(i=0;i<n;i++){
+    if(m[i].name_len == 4 && !strncmp(m[i].name, "tcId", 4))
+      tcid = m[i].value;
+    else if(m[i].name_len == 3 && !strncmp(m[i].name, "key", 3))
+      key_ok = m[i].value_len == 32 && unhex(v.key, m[i].value, 32) == 16;
+    else if(m[i].name_len == 2 && !strncmp(m[i].name, "iv", 2))
+      v.iv = field(m[i].value, m[i].value_len, &v.len_iv);
+    else if(m[i].name_len == 3 && !strncmp(m[i].name, "aad", 3))
+      v.aad = field(m[i].value, m[i].value_len, &v.len_ad);
+    else if(m[i].name_len == 3 && !strncmp(m[i].name, "msg", 3))
+      v.pt = field(m[i].value, m[i].value_len, &v.len_p);
+    else if(m[i].name_len == 2 && !strncmp(m[i].name, "ct", 2))
+      v.ct = field(m[i].value, m[i].value_len, &v.len_p);
+    else if(m[i].name_len == 3 && !strncmp(m[i].name, "tag", 3))
+      v.len_tag = m[i].value_len <= 32 && unhex(v.tag, m[i].value, m[i].value_len) >= 0 ? m[i].value_len / 2 : 0;
+    else if(m[i].name_len == 6 && !strncmp(m[i].name, "result", 6))
+      v.valid = strncmp(m[i].value, "invalid", 7) != 0;	// "acceptable" must also decrypt
+  }
+  snprintf(v.name, sizeof(v.name), "%s tcId %.*s", path, (int)strcspn(tcid, ",\n }"), tcid);
+
+  if(key_ok && v.iv && v.aad && v.pt && v.ct)
+    run_vector(&v);
+  else
+    skipped++;						// Other key sizes, or not an AEAD test
+  vector_free(&v);
+}
+
+/* Object at p (after the brace); returns the character after the closing brace */
+static const char *json_object(const char *path, const char *p) {
+  struct json_member m[32];
+  const char *name, *end;
+  int n = 0, is_test = 0;
+
+  for(p=json_skip(p);*p && *p!='}';p=json_skip(p)){
+    if(*p == ',' ){
+      p++;
+      continue;
+    }
+    if(*p != '"' || (end = json_string(p + 1)) == NULL)
+      return NULL;
+    name = p + 1;
+    p = json_skip(end + 1);
+    if(*p++ != ':')
+      return NULL;
+    if(n < 32){
+      m[n].name = name;
+      m[n].name_len = (unsigned long)(end - name);
+      if(m[n].name_len == 4 && !strncmp(name, "tcId", 4))
+        is_test = 1;
+    }
+    if((p = json_value(path, p, n < 32 ? &m[n] : NULL)) == NULL)
+      return NULL;
+    if(n < 32)
+      n++;
+  }
+  if(*p != '}')
+    return NULL;
+  if(is_test)
+    json_test(path, m, n);
+  return p + 1;
+}
+
+/* Any value at p; string and number values are recorded in out */
+static const char *json_value(const char *path, const char *p, struct json_member *out) {
+  const char *end;
+
+  p = json_skip(p);
+  if(out)
+    out->value = "", out->value_len = 0;
+  if(*p == '{')
+    return json_object(path, p + 1);
+  if(*p == '['){
+    for(p=json_skip(p+1);*p && *p!=']';p=json_skip(p)){
+      if(*p == ','){
+        p++;
+        continue;
+      }
+      if((p = json_value(path, p, NULL)) == NULL)
+        return NULL;
+    }
+    return *p ? p + 1 : NULL;
+  }
+  if(*p == '"'){
+    if((end = json_string(p + 1)) == NULL)
+      return NULL;
+    if(out)
+      out->value = p + 1, out->value_len = (unsigned long)(end - p - 1);
+    return end + 1;
+  }
+  for(end=p;*end && !strchr(",}] \t\r\n", *end);end++);	// Number, true, false or null
+  if(end == p)
+    return NULL;
+  if(out)
+    out->value = p, out->value_len = (unsigned long)(end - p);
+  return end;
+}
+
+/* Random messages encrypted with the portable backends, then checked everywhere like a vector */
+static void random_cases(unsigned long n) {
+  struct vector v;
+  aes128gcm_key gk;
+  unsigned long i, j;
+
+  for(i=0;i<n;i++){
+    memset(&v, 0, sizeof(v));
+    snprintf(v.name, sizeof(v.name), "random case %lu", i);
+    v.len_iv = lcg() % 4 ? 12 : 1 + lcg() % 70;
+    v.len_ad = lcg() % 3 ? lcg() % 40 : lcg() % 300;
+    v.len_p = lcg() % 3 ? lcg() % 200 : lcg() % 2100;
+    v.len_tag = 16;
+    v.iv = malloc(v.len_iv);
+    v.aad = malloc(v.len_ad + 1);
+    v.pt = malloc(v.len_p + 1);
+    v.ct = malloc(v.len_p + 1);
+    for(j=0;j<16;j++)
+      v.key[j] = (unsigned char)lcg();
+    for(j=0;j<v.len_iv;j++)
+      v.iv[j] = (unsigned char)lcg();
+    for(j=0;j<v.len_ad;j++)
+      v.aad[j] = (unsigned char)lcg();
+    for(j=0;j<v.len_p;j++)
+      v.pt[j] = (unsigned char)lcg();
+    v.valid = v.has_pt = v.has_ct = 1;
+
+    aes128gcm_setkey_backend(&gk, v.key, AES128E_PORTABLE, AES128GCM_GHASH_PORTABLE);	// The reference
+    aes128gcm_encrypt(v.ct, v.tag, &gk, v.iv, v.len_iv, v.pt, v.len_p, v.aad, v.len_ad);
+    run_vector(&v);
+
+    v.tag[lcg() % 16] ^= (unsigned char)(1 << lcg() % 8);	// Every backend must reject the forgery
+    v.valid = 0;
+    run_vector(&v);
+    vector_free(&v);
+  }
+}
+
+int main(int argc, char **argv) {
+  unsigned long random = 200, before, skipped_before;
+  char *text, *dot;
+  int i = 1;
+
+  if(argc > 2 && !strcmp(argv[1], "-r")){
+    random = strtoul(argv[2], NULL, 10);
+    i = 3;
+  }
+
+  for(;i<argc;i++){
+    if((text = slurp(argv[i])) == NULL){
+      printf("FAIL %s: cannot read\n", argv[i]);
+      failures++;
+      continue;
+    }
+    before = failures;
+    skipped_before = skipped;
+    checks = 0;
+    dot = strrchr(argv[i], '.');
+    if(dot && !strcmp(dot, ".json")){
+      if(json_value(argv[i], text, NULL) == NULL){
+        printf("FAIL %s: malformed JSON\n", argv[i]);
+        failures++;
+      }
+    }
+    else
+      parse_rsp(argv[i], text);
+    printf("%s: %lu checks, %lu skipped, %s\n", argv[i], checks, skipped - skipped_before, failures == before ? "PASS" : "FAIL");
+    free(text);
+  }
+
+  checks = 0;
+  before = failures;
+  random_cases(random);
+  printf("%lu random cases against the portable backends: %lu checks, %s\n", random, checks, failures == before ? "PASS" : "FAIL");
+
+  return failures ? 1 : 0;
+}
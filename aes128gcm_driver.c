@@ -5,10 +5,143 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdint.h>
-#include <string.h>
+#include <pthread.h>
 #include "aes128e.h"
 #include "aes128gcm.h"
+#include "aes128gcm_cache.h"
+#include "aes128gcm_pool.h"
+
+
+/* Parameters of the multi-threaded stress test */
+#define STRESS_THREADS 8
+#define STRESS_ROUNDS 200
+
+/* Checks that failed so far; the exit status is non-zero if any did */
+static unsigned long failed_checks;
+
+/* "PASS" or "FAIL" for the outcome of a check, counting the failures */
+static const char *verdict(int ok) {
+  if(!ok)
+    failed_checks++;
+  return ok ? "PASS" : "FAIL";
+}
+
+/* Shared read-only inputs of the stress test; every thread owns its outputs */
+struct stress_arg {
+  const aes128gcm_key *gk;
+  const unsigned char *key, *IV, *plaintext, *add_data, *ciphertext_ref;
+  const unsigned char (*tag_ref)[16];
+  unsigned long failures;
+};
 
+/* Worker: re-runs all 16 reference vectors, alternating the one-shot and expanded key entry points */
+static void *stress_worker(void *p) {
+  struct stress_arg *arg = p;
+  unsigned char ciphertext[3*16], tag[16];
+  unsigned int round, len_p, len_ad;
+
+  for(round=0;round<STRESS_ROUNDS;round++){
+    for(len_p=0;len_p<=3;len_p++){
+      for(len_ad=0;len_ad<=3;len_ad++){
+        if(round & 1)
+          aes128gcm_encrypt(ciphertext, tag, arg->gk, arg->IV, 12, arg->plaintext, len_p*16, arg->add_data, len_ad*16);
+        else
+          aes128gcm(ciphertext, tag, arg->key, arg->IV, arg->plaintext, len_p, arg->add_data, len_ad);
+        if(memcmp(ciphertext, arg->ciphertext_ref, len_p*16) || memcmp(tag, arg->tag_ref[len_p*4+len_ad], 16))
+          arg->failures++;
+      }
+    }
+  }
+  return NULL;
+}
+
+/* Key cache tests: 16 key IDs through a cache of 4, the raw key of an ID is its low byte repeated */
+#define CACHE_KEYS 16
+#define CACHE_CAPACITY 4
+#define CACHE_ROUNDS 2000
+
+static int cache_loader(void *arg, uint64_t key_id, unsigned char *key) {
+  (void)arg;
+  if(key_id >= CACHE_KEYS)
+    return -1;							// Unknown key
+  memset(key, (int)key_id + 1, 16);
+  return 0;
+}
+
+/* Tags of an empty message under each key and a zero IV, computed without the cache */
+static const unsigned char cache_IV[12];
+static unsigned char cache_tag_ref[CACHE_KEYS][16];
+
+struct cache_arg {
+  aes128gcm_cache *cache;
+  unsigned long seed, failures;
+};
+
+/* Worker: acquires keys in a pseudo-random order and checks that each is the right one */
+static void *cache_worker(void *p) {
+  struct cache_arg *arg = p;
+  const aes128gcm_key *gk;
+  unsigned char tag[16];
+  uint64_t id;
+  int round;
+
+  for(round=0;round<CACHE_ROUNDS;round++){
+    arg->seed = arg->seed * 1103515245 + 12345;
+    id = (arg->seed >> 16) % CACHE_KEYS;
+    gk = aes128gcm_cache_acquire(arg->cache, id);
+    if(gk == NULL)
+      continue;							// Every entry held by the other threads
+    aes128gcm_encrypt(NULL, tag, gk, cache_IV, 12, NULL, 0, NULL, 0);
+    if(memcmp(tag, cache_tag_ref[id], 16))
+      arg->failures++;
+    aes128gcm_cache_release(arg->cache, gk);
+  }
+  return NULL;
+}
+
+/* Worker pool tests: producers submit records of varied lengths, every third one to decrypt
+   (every thirtieth with a forged tag), and the collector checks order and contents */
+#define POOL_PRODUCERS 3
+#define POOL_RECORDS 500
+#define POOL_MAX_LEN 600
+
+/* One producer's records and the buffers they point to */
+struct pool_arg {
+  aes128gcm_pool *pool;
+  const aes128gcm_key *gk;
+  const unsigned char *plaintext;				// POOL_MAX_LEN bytes, also the additional data
+  int id;
+  aes128gcm_pool_record record[POOL_RECORDS];
+  unsigned char IV[POOL_RECORDS][12], tag[POOL_RECORDS][16];
+  unsigned char in[POOL_RECORDS][POOL_MAX_LEN], out[POOL_RECORDS][POOL_MAX_LEN];
+};
+
+/* Producer: fills and submits its records in index order */
+static void *pool_producer(void *p) {
+  struct pool_arg *arg = p;
+  aes128gcm_pool_record *r;
+  unsigned long i, len, len_ad;
+
+  for(i=0;i<POOL_RECORDS;i++){
+    r = &arg->record[i];
+    len = (arg->id * 131 + i * 37) % POOL_MAX_LEN;
+    len_ad = i % 17;
+    memset(arg->IV[i], 0, 12);
+    arg->IV[i][0] = (unsigned char)arg->id;
+    arg->IV[i][1] = (unsigned char)i;
+    arg->IV[i][2] = (unsigned char)(i >> 8);
+    *r = (aes128gcm_pool_record){ arg->IV[i], 12, arg->plaintext, len_ad, arg->in[i], len, arg->out[i], arg->tag[i], i % 3 == 0, 1, arg };
+    if(r->decrypt){
+      aes128gcm_encrypt(arg->in[i], arg->tag[i], arg->gk, arg->IV[i], 12, arg->plaintext, len, arg->plaintext, len_ad);
+      if(i % 10 == 0)
+        arg->tag[i][15] ^= 0x80;
+    }
+    else
+      memcpy(arg->in[i], arg->plaintext, len);
+    aes128gcm_pool_submit(arg->pool, r);
+  }
+  return NULL;
+}
 
 int main() {
   const unsigned char key[16]={0x98,0xff,0xf6,0x7e,0x64,0xe4,0x6b,0xe5,0xee,0x2e,0x05,0xcc,0x9a,0xf6,0xd0,0x12};
@@ -69,6 +202,73 @@ const unsigned char plaintext3[4*16] = {0xd9,0x31,0x32,0x25,0xf8,0x84,0x06,0xe5,
 const unsigned char add_data3[16]={0};
 */
 
+  /* FIPS-197 Appendix B and Appendix C.1 vectors for the block cipher alone */
+  const unsigned char fips_key[2][16]={{0x2b,0x7e,0x15,0x16,0x28,0xae,0xd2,0xa6,0xab,0xf7,0x15,0x88,0x09,0xcf,0x4f,0x3c},
+				     {0x00,0x01,0x02,0x03,0x04,0x05,0x06,0x07,0x08,0x09,0x0a,0x0b,0x0c,0x0d,0x0e,0x0f}};
+  const unsigned char fips_plaintext[2][16]={{0x32,0x43,0xf6,0xa8,0x88,0x5a,0x30,0x8d,0x31,0x31,0x98,0xa2,0xe0,0x37,0x07,0x34},
+					   {0x00,0x11,0x22,0x33,0x44,0x55,0x66,0x77,0x88,0x99,0xaa,0xbb,0xcc,0xdd,0xee,0xff}};
+  const unsigned char fips_ciphertext[2][16]={{0x39,0x25,0x84,0x1d,0x02,0xdc,0x09,0xfb,0xdc,0x11,0x85,0x97,0x19,0x6a,0x0b,0x32},
+					    {0x69,0xc4,0xe0,0xd8,0x6a,0x7b,0x04,0x30,0xd8,0xcd,0xb7,0x80,0x70,0xb4,0xc5,0x5a}};
+  unsigned char block[16];
+  int v;
+
+  aes128e_key ks;
+  int backend;
+
+  for(v=0;v<2;v++){
+    aes128e(block, fips_plaintext[v], fips_key[v]);
+    printf("FIPS-197 vector %d: %s\n\n", v, verdict(!memcmp(block, fips_ciphertext[v], 16)));
+
+    /* Every implementation available on this host must agree */
+    for(backend=AES128E_PORTABLE;backend<AES128E_BACKENDS;backend++){
+      if(aes128e_setkey_backend(&ks, fips_key[v], backend))
+        continue;
+      aes128e_encrypt(block, fips_plaintext[v], &ks);
+      printf("FIPS-197 vector %d backend %d: %s\n\n", v, backend, verdict(!memcmp(block, fips_ciphertext[v], 16)));
+    }
+  }
+
+  /* Interleaved CTR against one block at a time, 37 blocks so every lane count leaves a tail,
+     starting 3 below the 32-bit counter wrap which must not carry into the IV bytes */
+  unsigned char ctr_in[37*16], ctr_out[37*16], ctr_ref[37*16], ctr_cb[16], ctr_ref_cb[16];
+  int i;
+
+  for(v=0;v<37*16;v++)
+    ctr_in[v] = (unsigned char)(v * 29 + 3);
+  for(backend=AES128E_PORTABLE;backend<AES128E_BACKENDS;backend++){
+    if(aes128e_setkey_backend(&ks, fips_key[0], backend))
+      continue;
+    memcpy(ctr_ref_cb, fips_plaintext[0], 12);
+    memset(ctr_ref_cb + 12, 0xff, 4);
+    ctr_ref_cb[15] = 0xfd;
+    memcpy(ctr_cb, ctr_ref_cb, 16);
+    for(v=0;v<37;v++){
+      aes128e_encrypt(block, ctr_ref_cb, &ks);
+      for(i=0;i<16;i++)
+        ctr_ref[v*16+i] = ctr_in[v*16+i] ^ block[i];
+      for(i=15;i>=12 && ++ctr_ref_cb[i]==0;i--);	// inc32
+    }
+    aes128e_ctr32(ctr_out, ctr_in, 37, ctr_cb, &ks);
+    printf("CTR backend %d: %s\n\n", backend, verdict(!memcmp(ctr_out, ctr_ref, sizeof(ctr_ref)) && !memcmp(ctr_cb, ctr_ref_cb, 16)));
+  }
+
+  /* Independent blocks against one block at a time, in place, for every tail length of the
+     8-lane backends; 64 distinct blocks reach every S-box input */
+  for(backend=AES128E_PORTABLE;backend<AES128E_BACKENDS;backend++){
+    if(aes128e_setkey_backend(&ks, fips_key[1], backend))
+      continue;
+    int blocks_ok = 1;
+    for(v=1;v<=37;v++){
+      memcpy(ctr_out, ctr_in, v*16);
+      aes128e_encrypt_blocks(ctr_out, ctr_out, v, &ks);
+      for(i=0;i<v;i++){
+        aes128e_encrypt(block, ctr_in + 16*i, &ks);
+        blocks_ok &= !memcmp(block, ctr_out + 16*i, 16);
+      }
+    }
+    printf("blocks backend %d: %s\n\n", backend, verdict(blocks_ok));
+  }
+
   unsigned int len_p; // = 4;
   unsigned int len_ad; // = 0;
 
@@ -81,15 +281,525 @@ const unsigned char add_data3[16]={0};
       aes128gcm(ciphertext,tag, key, IV, plaintext, len_p, add_data, len_ad);
       printf("lenghts %d %d: ", len_p, len_ad);
 
-      printf("ciphertext %s ", !memcmp(ciphertext, ciphertext_ref, (len_p)*16 ) ? "PASS" : "FAIL");
-      printf("tag %s\n\n", !memcmp(tag, tag_ref[len_p*4+len_ad], 16) ? "PASS" : "FAIL");
+      printf("ciphertext %s ", verdict(!memcmp(ciphertext, ciphertext_ref, (len_p)*16 )));
+      printf("tag %s\n\n", verdict(!memcmp(tag, tag_ref[len_p*4+len_ad], 16)));
     }
   }/**/
+
+  /* Same vectors under a key expanded once and reused for every message */
+  aes128gcm_key gk;
+  aes128gcm_setkey(&gk, key);
+
+  for(len_p=0;len_p<=3;len_p++){
+    for(len_ad=0;len_ad<=3;len_ad++){
+      aes128gcm_encrypt(ciphertext,tag, &gk, IV, 12, plaintext, len_p*16, add_data, len_ad*16);
+      printf("expanded key lenghts %d %d: ", len_p, len_ad);
+
+      printf("ciphertext %s ", verdict(!memcmp(ciphertext, ciphertext_ref, (len_p)*16 )));
+      printf("tag %s\n\n", verdict(!memcmp(tag, tag_ref[len_p*4+len_ad], 16)));
+    }
+  }
+
+  /* Same vectors, and a message longer than one aggregated GHASH reduction,
+     through every AES and GHASH implementation available on this host */
+  unsigned char long_plaintext[37*16], long_ciphertext[37*16], long_ciphertext_ref[37*16], long_tag_ref[16];
+  int ghash_backend;
+
+  for(v=0;v<(int)sizeof(long_plaintext);v++)
+    long_plaintext[v] = (unsigned char)(v * 151 + 7);
+  aes128gcm_setkey_backend(&gk, key, AES128E_PORTABLE, AES128GCM_GHASH_PORTABLE);
+  aes128gcm_encrypt(long_ciphertext_ref, long_tag_ref, &gk, IV, 12, long_plaintext, 37*16, long_plaintext, 11*16);
+
+  for(backend=AES128E_PORTABLE;backend<AES128E_BACKENDS;backend++){
+    for(ghash_backend=AES128GCM_GHASH_PORTABLE;ghash_backend<AES128GCM_GHASH_BACKENDS;ghash_backend++){
+      if(aes128gcm_setkey_backend(&gk, key, backend, ghash_backend))
+        continue;
+      unsigned long failures = 0;
+      for(len_p=0;len_p<=3;len_p++){
+        for(len_ad=0;len_ad<=3;len_ad++){
+          aes128gcm_encrypt(ciphertext,tag, &gk, IV, 12, plaintext, len_p*16, add_data, len_ad*16);
+          failures += memcmp(ciphertext, ciphertext_ref, (len_p)*16) || memcmp(tag, tag_ref[len_p*4+len_ad], 16);
+        }
+      }
+      aes128gcm_encrypt(long_ciphertext, tag, &gk, IV, 12, long_plaintext, 37*16, long_plaintext, 11*16);
+      failures += memcmp(long_ciphertext, long_ciphertext_ref, sizeof(long_ciphertext)) || memcmp(tag, long_tag_ref, 16);
+      printf("aes backend %d ghash backend %d: %s\n\n", backend, ghash_backend, verdict(!failures));
+    }
+  }
+  aes128gcm_setkey(&gk, key);
+
+  /* Same vectors and long message through the incremental API, in chunks of 0 to 40 bytes */
+  aes128gcm_ctx ctx;
+  unsigned long off, chunk, seed = 1, failures = 0;
+
+  for(len_p=0;len_p<=3;len_p++){
+    for(len_ad=0;len_ad<=3;len_ad++){
+      aes128gcm_init(&ctx, &gk, IV, 12);
+      for(off=0;off<len_ad*16;off+=chunk){
+        seed = seed * 1103515245 + 12345;
+        chunk = (seed >> 16) % 41;
+        if(chunk > len_ad*16 - off) chunk = len_ad*16 - off;
+        aes128gcm_update_aad(&ctx, add_data + off, chunk);
+      }
+      for(off=0;off<len_p*16;off+=chunk){
+        seed = seed * 1103515245 + 12345;
+        chunk = (seed >> 16) % 41;
+        if(chunk > len_p*16 - off) chunk = len_p*16 - off;
+        aes128gcm_update(&ctx, ciphertext + off, plaintext + off, chunk);
+      }
+      aes128gcm_final(&ctx, tag);
+      failures += memcmp(ciphertext, ciphertext_ref, (len_p)*16) || memcmp(tag, tag_ref[len_p*4+len_ad], 16);
+    }
+  }
+  aes128gcm_init(&ctx, &gk, IV, 12);
+  for(off=0;off<11*16;off+=chunk){
+    seed = seed * 1103515245 + 12345;
+    chunk = (seed >> 16) % 41;
+    if(chunk > 11*16 - off) chunk = 11*16 - off;
+    aes128gcm_update_aad(&ctx, long_plaintext + off, chunk);
+  }
+  for(off=0;off<sizeof(long_plaintext);off+=chunk){
+    seed = seed * 1103515245 + 12345;
+    chunk = (seed >> 16) % 41;
+    if(chunk > sizeof(long_plaintext) - off) chunk = sizeof(long_plaintext) - off;
+    aes128gcm_update(&ctx, long_ciphertext + off, long_plaintext + off, chunk);
+  }
+  aes128gcm_final(&ctx, tag);
+  failures += memcmp(long_ciphertext, long_ciphertext_ref, sizeof(long_ciphertext)) || memcmp(tag, long_tag_ref, 16);
+  printf("streaming: %s\n\n", verdict(!failures));
+
+  /* Decryption of the same vectors, one-shot and in chunks, and rejection of a forged tag */
+  unsigned char decrypted[3*16], forged[16];
+  int result;
+
+  failures = 0;
+  for(len_p=0;len_p<=3;len_p++){
+    for(len_ad=0;len_ad<=3;len_ad++){
+      result = aes128gcm_decrypt(decrypted, tag_ref[len_p*4+len_ad], &gk, IV, 12, ciphertext_ref, len_p*16, add_data, len_ad*16);
+      failures += result != 0 || memcmp(decrypted, plaintext, len_p*16);
+
+      aes128gcm_init(&ctx, &gk, IV, 12);
+      aes128gcm_update_aad(&ctx, add_data, len_ad*16);
+      for(off=0;off<len_p*16;off+=chunk){
+        seed = seed * 1103515245 + 12345;
+        chunk = (seed >> 16) % 41;
+        if(chunk > len_p*16 - off) chunk = len_p*16 - off;
+        aes128gcm_decrypt_update(&ctx, decrypted + off, ciphertext_ref + off, chunk);
+      }
+      result = aes128gcm_decrypt_final(&ctx, tag_ref[len_p*4+len_ad]);
+      failures += result != 0 || memcmp(decrypted, plaintext, len_p*16);
+
+      memcpy(forged, tag_ref[len_p*4+len_ad], 16);
+      forged[(len_p*4+len_ad) % 16] ^= 0x01;
+      memset(decrypted, 0xaa, sizeof(decrypted));
+      result = aes128gcm_decrypt(decrypted, forged, &gk, IV, 12, ciphertext_ref, len_p*16, add_data, len_ad*16);
+      failures += result != -1;
+      for(v=0;v<(int)len_p*16;v++)
+        failures += decrypted[v] != 0;
+    }
+  }
+  result = aes128gcm_decrypt(long_ciphertext, long_tag_ref, &gk, IV, 12, long_ciphertext_ref, 37*16, long_plaintext, 11*16);
+  failures += result != 0 || memcmp(long_ciphertext, long_plaintext, sizeof(long_plaintext));
+  printf("decryption: %s\n\n", verdict(!failures));
+
+  /* Length limits: a payload one byte over the SP 800-38D limit, in one call or across
+     streaming calls, is refused before any buffer is touched (only reachable where unsigned
+     long has 64 bits) */
+  if(sizeof(unsigned long) > 4){
+    unsigned long over = (unsigned long)(AES128GCM_MAX_PAYLOAD + 1);
+    memset(decrypted, 0xaa, sizeof(decrypted));
+    memset(forged, 0xaa, sizeof(forged));
+    aes128gcm_encrypt(decrypted, forged, &gk, IV, 12, decrypted, over, NULL, 0);
+    failures = decrypted[0] != 0xaa;
+    for(v=0;v<16;v++)
+      failures += forged[v] != 0;
+    failures += aes128gcm_decrypt(decrypted, tag_ref[0], &gk, IV, 12, decrypted, over, NULL, 0) != -1 || decrypted[0] != 0xaa;
+    failures += aes128gcm_encrypt_parallel(decrypted, forged, &gk, IV, 12, decrypted, over, NULL, 0, 4) != -1;
+    failures += aes128gcm_decrypt_parallel(decrypted, tag_ref[0], &gk, IV, 12, decrypted, over, NULL, 0, 4) != -1;
+    aes128gcm_init(&ctx, &gk, IV, 12);
+    failures += aes128gcm_update(&ctx, decrypted, decrypted, 16) != 0;
+    failures += aes128gcm_update(&ctx, decrypted, decrypted, over - 16) != -1;	// One byte over, counting the first 16
+    failures += aes128gcm_decrypt_update(&ctx, decrypted, decrypted, over - 16) != -1;
+    failures += decrypted[0] == 0xaa || decrypted[16] != 0xaa;	// Only the first call wrote
+    printf("length limits: %s\n\n", verdict(!failures));
+  }
+
+  /* GCM specification test cases 4, 5 and 6: 60-byte plaintext, 20-byte additional data,
+     and IVs of 12, 8 and 60 bytes (the last two derive J0 with GHASH) */
+  const unsigned char spec_key[16]={0xfe,0xff,0xe9,0x92,0x86,0x65,0x73,0x1c,0x6d,0x6a,0x8f,0x94,0x67,0x30,0x83,0x08};
+  const unsigned char spec_plaintext[60]={0xd9,0x31,0x32,0x25,0xf8,0x84,0x06,0xe5,0xa5,0x59,0x09,0xc5,0xaf,0xf5,0x26,0x9a,
+				0x86,0xa7,0xa9,0x53,0x15,0x34,0xf7,0xda,0x2e,0x4c,0x30,0x3d,0x8a,0x31,0x8a,0x72,
+				0x1c,0x3c,0x0c,0x95,0x95,0x68,0x09,0x53,0x2f,0xcf,0x0e,0x24,0x49,0xa6,0xb5,0x25,
+				0xb1,0x6a,0xed,0xf5,0xaa,0x0d,0xe6,0x57,0xba,0x63,0x7b,0x39};
+  const unsigned char spec_add_data[20]={0xfe,0xed,0xfa,0xce,0xde,0xad,0xbe,0xef,0xfe,0xed,0xfa,0xce,0xde,0xad,0xbe,0xef,
+				0xab,0xad,0xda,0xd2};
+  const unsigned char spec_IV[3][60]={{0xca,0xfe,0xba,0xbe,0xfa,0xce,0xdb,0xad,0xde,0xca,0xf8,0x88},
+				{0xca,0xfe,0xba,0xbe,0xfa,0xce,0xdb,0xad},
+				{0x93,0x13,0x22,0x5d,0xf8,0x84,0x06,0xe5,0x55,0x90,0x9c,0x5a,0xff,0x52,0x69,0xaa,
+				0x6a,0x7a,0x95,0x38,0x53,0x4f,0x7d,0xa1,0xe4,0xc3,0x03,0xd2,0xa3,0x18,0xa7,0x28,
+				0xc3,0xc0,0xc9,0x51,0x56,0x80,0x95,0x39,0xfc,0xf0,0xe2,0x42,0x9a,0x6b,0x52,0x54,
+				0x16,0xae,0xdb,0xf5,0xa0,0xde,0x6a,0x57,0xa6,0x37,0xb3,0x9b}};
+  const unsigned long spec_len_iv[3]={12,8,60};
+  const unsigned char spec_ciphertext[3][60]={{0x42,0x83,0x1e,0xc2,0x21,0x77,0x74,0x24,0x4b,0x72,0x21,0xb7,0x84,0xd0,0xd4,0x9c,
+				0xe3,0xaa,0x21,0x2f,0x2c,0x02,0xa4,0xe0,0x35,0xc1,0x7e,0x23,0x29,0xac,0xa1,0x2e,
+				0x21,0xd5,0x14,0xb2,0x54,0x66,0x93,0x1c,0x7d,0x8f,0x6a,0x5a,0xac,0x84,0xaa,0x05,
+				0x1b,0xa3,0x0b,0x39,0x6a,0x0a,0xac,0x97,0x3d,0x58,0xe0,0x91},
+				{0x61,0x35,0x3b,0x4c,0x28,0x06,0x93,0x4a,0x77,0x7f,0xf5,0x1f,0xa2,0x2a,0x47,0x55,
+				0x69,0x9b,0x2a,0x71,0x4f,0xcd,0xc6,0xf8,0x37,0x66,0xe5,0xf9,0x7b,0x6c,0x74,0x23,
+				0x73,0x80,0x69,0x00,0xe4,0x9f,0x24,0xb2,0x2b,0x09,0x75,0x44,0xd4,0x89,0x6b,0x42,
+				0x49,0x89,0xb5,0xe1,0xeb,0xac,0x0f,0x07,0xc2,0x3f,0x45,0x98},
+				{0x8c,0xe2,0x49,0x98,0x62,0x56,0x15,0xb6,0x03,0xa0,0x33,0xac,0xa1,0x3f,0xb8,0x94,
+				0xbe,0x91,0x12,0xa5,0xc3,0xa2,0x11,0xa8,0xba,0x26,0x2a,0x3c,0xca,0x7e,0x2c,0xa7,
+				0x01,0xe4,0xa9,0xa4,0xfb,0xa4,0x3c,0x90,0xcc,0xdc,0xb2,0x81,0xd4,0x8c,0x7c,0x6f,
+				0xd6,0x28,0x75,0xd2,0xac,0xa4,0x17,0x03,0x4c,0x34,0xae,0xe5}};
+  const unsigned char spec_tag[3][16]={{0x5b,0xc9,0x4f,0xbc,0x32,0x21,0xa5,0xdb,0x94,0xfa,0xe9,0x5a,0xe7,0x12,0x1a,0x47},
+				{0x36,0x12,0xd2,0xe7,0x9e,0x3b,0x07,0x85,0x56,0x1b,0xe1,0x4a,0xac,0xa2,0xfc,0xcb},
+				{0x61,0x9c,0xc5,0xae,0xff,0xfe,0x0b,0xfa,0x46,0x2a,0xf4,0x3c,0x16,0x99,0xd0,0x50}};
+  unsigned char spec_out[60];
+
+  aes128gcm_setkey(&gk, spec_key);
+  for(v=0;v<3;v++){
+    aes128gcm_encrypt(spec_out, tag, &gk, spec_IV[v], spec_len_iv[v], spec_plaintext, 60, spec_add_data, 20);
+    printf("spec test case %d: ciphertext %s ", v+4, verdict(!memcmp(spec_out, spec_ciphertext[v], 60)));
+    printf("tag %s ", verdict(!memcmp(tag, spec_tag[v], 16)));
+    result = aes128gcm_decrypt(spec_out, spec_tag[v], &gk, spec_IV[v], spec_len_iv[v], spec_ciphertext[v], 60, spec_add_data, 20);
+    printf("decryption %s\n\n", verdict(!result && !memcmp(spec_out, spec_plaintext, 60)));
+  }
+  aes128gcm_setkey(&gk, key);
+  int t;
+
+  /* Parallel API against the sequential one, over ranges ending mid-block; the 8-byte IV
+     gives a J0 derived with GHASH, so the split counter ranges start anywhere */
+  const unsigned long par_len = 10 * 65536 + 5;
+  unsigned char *par_plaintext = malloc(par_len), *par_ref = malloc(par_len), *par_out = malloc(par_len);
+  unsigned char par_tag_ref[16];
+
+  for(off=0;off<par_len;off++)
+    par_plaintext[off] = (unsigned char)(off * 13 + 1);
+  aes128gcm_encrypt(par_ref, par_tag_ref, &gk, spec_IV[1], 8, par_plaintext, par_len, long_plaintext, 11*16+3);
+  for(t=1;t<=12;t+=t<4?1:4){
+    result = aes128gcm_encrypt_parallel(par_out, tag, &gk, spec_IV[1], 8, par_plaintext, par_len, long_plaintext, 11*16+3, t);
+    printf("parallel %d threads: encryption %s ", t, verdict(!result && !memcmp(par_out, par_ref, par_len) && !memcmp(tag, par_tag_ref, 16)));
+    result = aes128gcm_decrypt_parallel(par_out, par_tag_ref, &gk, spec_IV[1], 8, par_out, par_len, long_plaintext, 11*16+3, t);
+    printf("decryption %s ", verdict(!result && !memcmp(par_out, par_plaintext, par_len)));
+    memcpy(par_out, par_ref, par_len);
+    par_out[par_len - 1] ^= 1;
+    result = aes128gcm_decrypt_parallel(par_out, par_tag_ref, &gk, spec_IV[1], 8, par_out, par_len, long_plaintext, 11*16+3, t);
+    printf("forged %s\n\n", verdict(result == -1));
+  }
+  free(par_plaintext);
+  free(par_ref);
+  free(par_out);
+
+  /* Scatter/gather API: the long message and its AAD cut into segments of 0 to 40 bytes,
+     the output cut differently from the input, then decrypted in place and forged */
+  #define IOV_MAX_SEGMENTS 128
+  aes128gcm_iovec iov_in[IOV_MAX_SEGMENTS], iov_out[IOV_MAX_SEGMENTS], iov_aad[IOV_MAX_SEGMENTS];
+  unsigned long iov_in_count, iov_out_count, iov_aad_count;
+  int iov_ok = 1;
+
+  for(t=0;t<20;t++){
+    memset(long_ciphertext, 0, sizeof(long_ciphertext));
+    for(off=0,iov_in_count=0;off<sizeof(long_plaintext);off+=chunk,iov_in_count++){
+      seed = seed * 1103515245 + 12345;
+      chunk = (seed >> 16) % 41;
+      if(chunk > sizeof(long_plaintext) - off) chunk = sizeof(long_plaintext) - off;
+      iov_in[iov_in_count] = (aes128gcm_iovec){ long_plaintext + off, chunk };
+    }
+    for(off=0,iov_out_count=0;off<sizeof(long_ciphertext);off+=chunk,iov_out_count++){
+      seed = seed * 1103515245 + 12345;
+      chunk = (seed >> 16) % 41;
+      if(chunk > sizeof(long_ciphertext) - off) chunk = sizeof(long_ciphertext) - off;
+      iov_out[iov_out_count] = (aes128gcm_iovec){ long_ciphertext + off, chunk };
+    }
+    for(off=0,iov_aad_count=0;off<11*16;off+=chunk,iov_aad_count++){
+      seed = seed * 1103515245 + 12345;
+      chunk = (seed >> 16) % 41;
+      if(chunk > 11*16 - off) chunk = 11*16 - off;
+      iov_aad[iov_aad_count] = (aes128gcm_iovec){ long_plaintext + off, chunk };
+    }
+    result = aes128gcm_encrypt_iov(iov_out, iov_out_count, tag, &gk, IV, 12, iov_in, iov_in_count, iov_aad, iov_aad_count);
+    iov_ok &= !result && !memcmp(long_ciphertext, long_ciphertext_ref, sizeof(long_ciphertext)) && !memcmp(tag, long_tag_ref, 16);
+
+    result = aes128gcm_decrypt_iov(iov_out, iov_out_count, long_tag_ref, &gk, IV, 12, iov_out, iov_out_count, iov_aad, iov_aad_count);
+    iov_ok &= !result && !memcmp(long_ciphertext, long_plaintext, sizeof(long_plaintext));
+  }
+  printf("scatter/gather encryption and decryption: %s ", verdict(iov_ok));
+
+  memcpy(long_ciphertext, long_ciphertext_ref, sizeof(long_ciphertext));
+  memcpy(forged, long_tag_ref, 16);
+  forged[3] ^= 0x40;
+  result = aes128gcm_decrypt_iov(iov_out, iov_out_count, forged, &gk, IV, 12, iov_out, iov_out_count, iov_aad, iov_aad_count);
+  iov_ok = result == -1;
+  for(off=0;off<sizeof(long_ciphertext);off++)
+    iov_ok &= long_ciphertext[off] == 0;
+  result = aes128gcm_encrypt_iov(iov_out, iov_out_count - 1, tag, &gk, IV, 12, iov_in, iov_in_count, iov_aad, iov_aad_count);
+  iov_ok &= result == -1 || iov_out[iov_out_count - 1].len == 0;	// Output one segment short
+  printf("forged %s\n\n", verdict(iov_ok));
+
+  /* In place (output equal to input) through every entry point and backend pair, on a
+     length that ends mid-block; a forged tag wipes the buffer, ciphertext included */
+  const unsigned long inp_len = 4096 + 7;
+  unsigned char *inp_plaintext = malloc(inp_len), *inp_ref = malloc(inp_len), *inp_buf = malloc(inp_len);
+  unsigned char inp_tag_ref[16];
+  aes128gcm_iovec inp_iov[3];
+
+  for(off=0;off<inp_len;off++)
+    inp_plaintext[off] = (unsigned char)(off * 7 + 3);
+  aes128gcm_setkey_backend(&gk, key, AES128E_PORTABLE, AES128GCM_GHASH_PORTABLE);
+  aes128gcm_encrypt(inp_ref, inp_tag_ref, &gk, IV, 12, inp_plaintext, inp_len, add_data, 20);
+  inp_iov[0] = (aes128gcm_iovec){ inp_buf, 100 };
+  inp_iov[1] = (aes128gcm_iovec){ inp_buf + 100, 2000 };
+  inp_iov[2] = (aes128gcm_iovec){ inp_buf + 2100, inp_len - 2100 };
+  aes128gcm_iovec inp_aad = { (void *)add_data, 20 };
+
+  for(backend=AES128E_PORTABLE;backend<AES128E_BACKENDS;backend++){
+    for(ghash_backend=AES128GCM_GHASH_PORTABLE;ghash_backend<AES128GCM_GHASH_BACKENDS;ghash_backend++){
+      if(aes128gcm_setkey_backend(&gk, key, backend, ghash_backend))
+        continue;
+      unsigned long failures = 0;
+
+      memcpy(inp_buf, inp_plaintext, inp_len);
+      aes128gcm_encrypt(inp_buf, tag, &gk, IV, 12, inp_buf, inp_len, add_data, 20);
+      failures += memcmp(inp_buf, inp_ref, inp_len) || memcmp(tag, inp_tag_ref, 16);
+      result = aes128gcm_decrypt(inp_buf, inp_tag_ref, &gk, IV, 12, inp_buf, inp_len, add_data, 20);
+      failures += result != 0 || memcmp(inp_buf, inp_plaintext, inp_len);
+
+      aes128gcm_init(&ctx, &gk, IV, 12);
+      aes128gcm_update_aad(&ctx, add_data, 20);
+      for(off=0;off<inp_len;off+=chunk){
+        seed = seed * 1103515245 + 12345;
+        chunk = (seed >> 16) % 600;
+        if(chunk > inp_len - off) chunk = inp_len - off;
+        aes128gcm_update(&ctx, inp_buf + off, inp_buf + off, chunk);
+      }
+      aes128gcm_final(&ctx, tag);
+      failures += memcmp(inp_buf, inp_ref, inp_len) || memcmp(tag, inp_tag_ref, 16);
+      aes128gcm_init(&ctx, &gk, IV, 12);
+      aes128gcm_update_aad(&ctx, add_data, 20);
+      for(off=0;off<inp_len;off+=chunk){
+        seed = seed * 1103515245 + 12345;
+        chunk = (seed >> 16) % 600;
+        if(chunk > inp_len - off) chunk = inp_len - off;
+        aes128gcm_decrypt_update(&ctx, inp_buf + off, inp_buf + off, chunk);
+      }
+      result = aes128gcm_decrypt_final(&ctx, inp_tag_ref);
+      failures += result != 0 || memcmp(inp_buf, inp_plaintext, inp_len);
+
+      result = aes128gcm_encrypt_parallel(inp_buf, tag, &gk, IV, 12, inp_buf, inp_len, add_data, 20, 3);
+      failures += result != 0 || memcmp(inp_buf, inp_ref, inp_len) || memcmp(tag, inp_tag_ref, 16);
+      result = aes128gcm_decrypt_parallel(inp_buf, inp_tag_ref, &gk, IV, 12, inp_buf, inp_len, add_data, 20, 3);
+      failures += result != 0 || memcmp(inp_buf, inp_plaintext, inp_len);
+
+      result = aes128gcm_encrypt_iov(inp_iov, 3, tag, &gk, IV, 12, inp_iov, 3, &inp_aad, 1);
+      failures += result != 0 || memcmp(inp_buf, inp_ref, inp_len) || memcmp(tag, inp_tag_ref, 16);
+      result = aes128gcm_decrypt_iov(inp_iov, 3, inp_tag_ref, &gk, IV, 12, inp_iov, 3, &inp_aad, 1);
+      failures += result != 0 || memcmp(inp_buf, inp_plaintext, inp_len);
+
+      memcpy(inp_buf, inp_ref, inp_len);
+      memcpy(forged, inp_tag_ref, 16);
+      forged[15] ^= 0x80;
+      result = aes128gcm_decrypt(inp_buf, forged, &gk, IV, 12, inp_buf, inp_len, add_data, 20);
+      failures += result != -1;
+      for(off=0;off<inp_len;off++)
+        failures += inp_buf[off] != 0;
+      printf("in place aes backend %d ghash backend %d: %s\n\n", backend, ghash_backend, verdict(!failures));
+    }
+  }
+  aes128gcm_setkey(&gk, key);
+  free(inp_plaintext);
+  free(inp_ref);
+  free(inp_buf);
+
+  /* Fixed-shape kernels (AES128GCM_FIXED_SHAPES) against the incremental API, which never
+     takes them, on every backend pair: encryption, decryption, both in place, a forged tag */
+#define FIXED_SHAPE(A, P) { A, P },
+  const unsigned long fixed_shapes[][2] = { AES128GCM_FIXED_SHAPES(FIXED_SHAPE) { 0, 0 } };
+#undef FIXED_SHAPE
+  const unsigned long fixed_count = sizeof(fixed_shapes) / sizeof(fixed_shapes[0]) - 1;
+  unsigned char fixed_tag_ref[16];
+
+  for(backend=AES128E_PORTABLE;backend<AES128E_BACKENDS;backend++){
+    for(ghash_backend=AES128GCM_GHASH_PORTABLE;ghash_backend<AES128GCM_GHASH_BACKENDS;ghash_backend++){
+      if(aes128gcm_setkey_backend(&gk, key, backend, ghash_backend))
+        continue;
+      unsigned long failures = 0, fixed;
+
+      for(fixed=0;fixed<fixed_count;fixed++){
+        unsigned long fa = fixed_shapes[fixed][0], fp = fixed_shapes[fixed][1];
+        unsigned char *fin = malloc(3*fp + fa + 1), *fref = fin + fp, *fout = fref + fp, *fad = fout + fp;
+
+        for(off=0;off<fp;off++)
+          fin[off] = (unsigned char)(off * 13 + fixed);
+        for(off=0;off<fa;off++)
+          fad[off] = (unsigned char)(off * 5 + 1);
+        aes128gcm_init(&ctx, &gk, IV, 12);
+        aes128gcm_update_aad(&ctx, fad, fa);
+        aes128gcm_update(&ctx, fref, fin, fp);
+        aes128gcm_final(&ctx, fixed_tag_ref);
+
+        aes128gcm_encrypt(fout, tag, &gk, IV, 12, fin, fp, fad, fa);
+        failures += memcmp(fout, fref, fp) || memcmp(tag, fixed_tag_ref, 16);
+        result = aes128gcm_decrypt(fout, fixed_tag_ref, &gk, IV, 12, fref, fp, fad, fa);
+        failures += result != 0 || memcmp(fout, fin, fp);
+
+        aes128gcm_encrypt(fout, tag, &gk, IV, 12, fout, fp, fad, fa);
+        failures += memcmp(fout, fref, fp) || memcmp(tag, fixed_tag_ref, 16);
+        result = aes128gcm_decrypt(fout, fixed_tag_ref, &gk, IV, 12, fout, fp, fad, fa);
+        failures += result != 0 || memcmp(fout, fin, fp);
+
+        memcpy(forged, fixed_tag_ref, 16);
+        forged[fixed % 16] ^= 0x04;
+        result = aes128gcm_decrypt(fout, forged, &gk, IV, 12, fref, fp, fad, fa);
+        failures += result != -1;
+        for(off=0;off<fp;off++)
+          failures += fout[off] != 0;
+        free(fin);
+      }
+      printf("fixed shapes (%lu) aes backend %d ghash backend %d: %s\n\n", fixed_count, backend, ghash_backend, verdict(!failures));
+    }
+  }
+  aes128gcm_setkey(&gk, key);
+
+  /* Key cache: hits, misses and LRU eviction order, held keys never evicted, invalidation,
+     then the same cache shared by several threads */
+  aes128gcm_cache cache;
+  const aes128gcm_key *held[CACHE_CAPACITY + 1];
+  uint64_t hits, misses, evictions;
+  struct cache_arg cache_args[STRESS_THREADS];
+  pthread_t cache_threads[STRESS_THREADS];
+  int cache_ok = 1;
+  unsigned char cache_key[16];
+
+  for(v=0;v<CACHE_KEYS;v++){
+    cache_loader(NULL, v, cache_key);
+    aes128gcm_setkey(&gk, cache_key);
+    aes128gcm_encrypt(NULL, cache_tag_ref[v], &gk, cache_IV, 12, NULL, 0, NULL, 0);
+  }
+  aes128gcm_setkey(&gk, key);
+
+  aes128gcm_cache_init(&cache, CACHE_CAPACITY, cache_loader, NULL);
+  for(v=0;v<6;v++){						// 0 1 2 3 miss, 0 hit, 4 miss evicts 1 (least recent)
+    held[0] = aes128gcm_cache_acquire(&cache, v < 4 ? v : v == 4 ? 0 : 4);
+    aes128gcm_encrypt(NULL, tag, held[0], cache_IV, 12, NULL, 0, NULL, 0);
+    cache_ok &= !memcmp(tag, cache_tag_ref[v < 4 ? v : v == 4 ? 0 : 4], 16);
+    aes128gcm_cache_release(&cache, held[0]);
+  }
+  held[0] = aes128gcm_cache_acquire(&cache, 0);	// Still cached: hit
+  aes128gcm_cache_release(&cache, held[0]);
+  held[0] = aes128gcm_cache_acquire(&cache, 1);	// Evicted: miss
+  aes128gcm_cache_release(&cache, held[0]);
+  aes128gcm_cache_stats(&cache, &hits, &misses, &evictions);
+  cache_ok &= hits == 2 && misses == 6 && evictions == 2;
+
+  for(v=0;v<CACHE_CAPACITY;v++)			// Every entry held: no room for a fifth key
+    held[v] = aes128gcm_cache_acquire(&cache, 8 + v);
+  cache_ok &= aes128gcm_cache_acquire(&cache, 12) == NULL && aes128gcm_cache_acquire(&cache, 99) == NULL;
+  aes128gcm_cache_invalidate(&cache, 8);			// Held: still usable until released
+  aes128gcm_encrypt(NULL, tag, held[0], cache_IV, 12, NULL, 0, NULL, 0);
+  cache_ok &= !memcmp(tag, cache_tag_ref[8], 16);
+  for(v=0;v<CACHE_CAPACITY;v++)
+    aes128gcm_cache_release(&cache, held[v]);
+  aes128gcm_cache_stats(&cache, &hits, NULL, NULL);
+  held[0] = aes128gcm_cache_acquire(&cache, 8);	// Dropped on release: loaded again
+  aes128gcm_cache_release(&cache, held[0]);
+  aes128gcm_cache_stats(&cache, NULL, &misses, NULL);
+  cache_ok &= hits == 2 && misses == 13;
+  printf("key cache: %s ", verdict(cache_ok));
+
+  for(t=0;t<STRESS_THREADS;t++){
+    cache_args[t] = (struct cache_arg){ &cache, (unsigned long)t + 1, 0 };
+    pthread_create(&cache_threads[t], NULL, cache_worker, &cache_args[t]);
+  }
+  failures = 0;
+  for(t=0;t<STRESS_THREADS;t++){
+    pthread_join(cache_threads[t], NULL);
+    failures += cache_args[t].failures;
+  }
+  aes128gcm_cache_stats(&cache, &hits, &misses, NULL);
+  printf("threads %s (%llu hits, %llu misses)\n\n", verdict(!failures), (unsigned long long)hits, (unsigned long long)misses);
+  aes128gcm_cache_destroy(&cache);
+
+  /* Worker pool: a full ring refuses records, completions come back in submission order
+     (each producer's own order with several producers), every record as aes128gcm_encrypt()
+     or aes128gcm_decrypt() would have left it */
+  aes128gcm_pool pool;
+  aes128gcm_pool_record pool_single[5], *pool_done;
+  struct pool_arg *pool_args[POOL_PRODUCERS];
+  pthread_t pool_threads[POOL_PRODUCERS];
+  unsigned long pool_next[POOL_PRODUCERS], pool_index;
+  unsigned char pool_single_tag[5][16], pool_plaintext[POOL_MAX_LEN], pool_ref[POOL_MAX_LEN], pool_tag[16], pool_zero[POOL_MAX_LEN];
+  int pool_order = 1, pool_records = 1, pool_full = 1;
+
+  for(v=0;v<POOL_MAX_LEN;v++)
+    pool_plaintext[v] = (unsigned char)(v * 7 + 3);
+  memset(pool_zero, 0, sizeof(pool_zero));
+
+  pool_full &= aes128gcm_pool_init(&pool, key, 2, 3) == 0;	// Rounded up to 4 records in flight
+  for(v=0;v<5;v++)
+    pool_single[v] = (aes128gcm_pool_record){ IV, 12, NULL, 0, NULL, 0, NULL, pool_single_tag[v], 0, 1, NULL };
+  for(v=0;v<4;v++)
+    pool_full &= aes128gcm_pool_try_submit(&pool, &pool_single[v]) == 0;
+  pool_full &= aes128gcm_pool_try_submit(&pool, &pool_single[4]) == -1;
+  for(v=0;v<4;v++){
+    pool_done = aes128gcm_pool_complete(&pool, 1);
+    pool_full &= pool_done == &pool_single[v] && pool_done->result == 0 && !memcmp(pool_single_tag[v], tag_ref[0], 16);
+  }
+  pool_full &= aes128gcm_pool_complete(&pool, 0) == NULL;
+  pool_full &= aes128gcm_pool_try_submit(&pool, &pool_single[4]) == 0 && aes128gcm_pool_complete(&pool, 1) == &pool_single[4];
+  aes128gcm_pool_destroy(&pool);
+
+  aes128gcm_pool_init(&pool, key, 4, 16);
+  for(t=0;t<POOL_PRODUCERS;t++){
+    pool_args[t] = calloc(1, sizeof(struct pool_arg));
+    pool_args[t]->pool = &pool;
+    pool_args[t]->gk = &gk;
+    pool_args[t]->plaintext = pool_plaintext;
+    pool_args[t]->id = t;
+    pool_next[t] = 0;
+    pthread_create(&pool_threads[t], NULL, pool_producer, pool_args[t]);
+  }
+  for(v=0;v<POOL_PRODUCERS*POOL_RECORDS;v++){
+    pool_done = aes128gcm_pool_complete(&pool, 1);
+    struct pool_arg *a = pool_done->user;
+    pool_index = (unsigned long)(pool_done - a->record);
+    pool_order &= pool_index == pool_next[a->id]++;
+    aes128gcm_encrypt(pool_ref, pool_tag, &gk, pool_done->IV, 12, pool_plaintext, pool_done->len, pool_plaintext, pool_done->len_ad);
+    if(pool_done->decrypt && pool_index % 10 == 0)
+      pool_records &= pool_done->result == -1 && !memcmp(pool_done->out, pool_zero, pool_done->len);
+    else if(pool_done->decrypt)
+      pool_records &= pool_done->result == 0 && !memcmp(pool_done->out, pool_plaintext, pool_done->len);
+    else
+      pool_records &= pool_done->result == 0 && !memcmp(pool_done->out, pool_ref, pool_done->len) && !memcmp(pool_done->tag, pool_tag, 16);
+  }
+  for(t=0;t<POOL_PRODUCERS;t++){
+    pthread_join(pool_threads[t], NULL);
+    pool_order &= pool_next[t] == POOL_RECORDS;
+    free(pool_args[t]);
+  }
+  aes128gcm_pool_destroy(&pool);
+  printf("worker pool: full ring %s order %s records %s\n\n", verdict(pool_full), verdict(pool_order), verdict(pool_records));
+
+  /* Same vectors from several threads at once, sharing only the read-only expanded key */
+  pthread_t threads[STRESS_THREADS];
+  struct stress_arg args[STRESS_THREADS];
+
+  failures = 0;
+  for(t=0;t<STRESS_THREADS;t++){
+    args[t] = (struct stress_arg){ &gk, key, IV, plaintext, add_data, ciphertext_ref, tag_ref, 0 };
+    pthread_create(&threads[t], NULL, stress_worker, &args[t]);
+  }
+  for(t=0;t<STRESS_THREADS;t++){
+    pthread_join(threads[t], NULL);
+    failures += args[t].failures;
+  }
+  printf("stress %d threads x %d rounds: %s\n\n", STRESS_THREADS, STRESS_ROUNDS, verdict(!failures));
+
   free(ciphertext);
   free(tag);
-  
-
 
-	return 0;
+  if(failed_checks)
+    printf("%lu checks failed\n", failed_checks);
+  return failed_checks ? 1 : 0;
 }
 
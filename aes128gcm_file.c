@@ -0,0 +1,570 @@
+/* File encryption tool built on the GCM-AES 128 library.
+ *
+ * usage: aes128gcm_file -e|-d [-m] [-v] [-c chunk_size] -k keyfile|-K hexkey input output
+ *        aes128gcm_file -x chunk -k keyfile|-K hexkey input output
+ *
+ * -e encrypts input into a chunked container and -d decrypts a whole container. -x decrypts
+ * only chunk number "chunk" (from 0), and reads only the header and that chunk. The key is
+ * 16 raw bytes in keyfile, or 32 hex digits. With -e and -d (without -m) the input may be
+ * "-" for stdin. The output may always be "-" for stdout. -v prints the throughput to stderr.
+ *
+ * Container: a 24-byte header, then the chunks. Each chunk is chunk_size bytes of
+ * ciphertext followed by its 16-byte tag (65536 bytes by default, set with -c). The last
+ * chunk is shorter, and empty when the file length is a multiple of chunk_size:
+ *
+ *   0   "AGCM", version 1, 3 zero bytes
+ *   8   chunk_size, 32-bit big-endian
+ *   12  8-byte random nonce prefix
+ *   20  4 zero bytes
+ *
+ * Chunk i is encrypted with IV = nonce prefix || i (32-bit big-endian) and the header as
+ * additional data. So chunks cannot be reordered, moved to another container, or keep
+ * their tags under a modified header. Only the last chunk is shorter than chunk_size, so a
+ * container cut at a chunk boundary is detected, and even an empty file has a tag. A
+ * chunk is at offset 24 + i * (chunk_size + 16) and can be verified on its own.
+ *
+ * Input is read in buffers of whole chunks (about 4 MiB, page-aligned). A second thread
+ * fills one buffer with large read() calls while the other is processed, so I/O overlaps
+ * with the crypto. With -m the input is mapped instead, and the buffers are slices of the
+ * mapping. Each chunk of a buffer goes through aes128gcm_encrypt() or aes128gcm_decrypt()
+ * in place in that buffer. When a chunk fails to verify, the tool stops with
+ * an error. The output file is then removed, although the chunks before it were authentic.
+ */
+
+#define _XOPEN_SOURCE 600
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "aes128gcm.h"
+
+#define HEADER 24
+#define TAG 16
+#define DEFAULT_CHUNK 65536UL
+#define MAX_CHUNK (1UL << 30)
+#define BUFFER_BYTES (4UL << 20)
+#define PAGE 4096
+
+
+/* Input in buffer-sized slices: from the reader thread, or from the mapping with -m.
+   Every slice but the last one is exactly size bytes */
+struct source {
+  int fd, started, stop;
+  unsigned long size;
+  const unsigned char *map;		/* Whole input with -m, NULL otherwise */
+  unsigned long map_len, map_off;
+  unsigned char *buf[2];
+  unsigned long len[2];
+  int full[2], failed[2], next;	/* failed[i]: the read into buf[i] hit an error */
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  pthread_t thread;
+};
+
+/* Reads up to len bytes, fewer only at end of file; returns the count or -1 */
+static long read_full(int fd, unsigned char *p, unsigned long len) {
+  unsigned long done = 0;
+  ssize_t n;
+
+  while(done < len){
+    n = read(fd, p + done, len - done);
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n < 0)
+      return -1;
+    if(n == 0)
+      break;
+    done += (unsigned long)n;
+  }
+  return (long)done;
+}
+
+/* Writes len bytes; returns 0 or -1 */
+static int write_full(int fd, const unsigned char *p, unsigned long len) {
+  ssize_t n;
+
+  while(len > 0){
+    n = write(fd, p, len);
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n < 0)
+      return -1;
+    p += n;
+    len -= (unsigned long)n;
+  }
+  return 0;
+}
+
+/* Reads exactly len bytes at offset off; returns 0 or -1 */
+static int pread_full(int fd, unsigned char *p, unsigned long len, off_t off) {
+  ssize_t n;
+
+  while(len > 0){
+    n = pread(fd, p, len, off);
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n <= 0)
+      return -1;
+    p += n;
+    off += n;
+    len -= (unsigned long)n;
+  }
+  return 0;
+}
+
+/* Reader thread: fills the two buffers in turn until a short read, or until stopped */
+static void *reader(void *p) {
+  struct source *s = p;
+  long n;
+  int i, stop;
+
+  for(i=0;;i^=1){
+    pthread_mutex_lock(&s->lock);
+    while(s->full[i] && !s->stop)
+      pthread_cond_wait(&s->cond, &s->lock);
+    stop = s->stop;					// Read under the lock that source_close() sets it under
+    pthread_mutex_unlock(&s->lock);
+    if(stop)
+      return NULL;
+
+    n = read_full(s->fd, s->buf[i], s->size);	// The other buffer is being processed meanwhile
+
+    pthread_mutex_lock(&s->lock);
+    s->len[i] = n < 0 ? 0 : (unsigned long)n;
+    s->failed[i] = n < 0;
+    s->full[i] = 1;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+    if(n < 0 || (unsigned long)n < s->size)
+      return NULL;					// End of input: the consumer sees the short slice
+  }
+}
+
+/* Starts reading fd in slices of size bytes; returns 0 or -1 */
+static int source_open(struct source *s, int fd, unsigned long size, int use_map) {
+  struct stat st;
+
+  memset(s, 0, sizeof(*s));
+  s->fd = fd;
+  s->size = size;
+
+  if(use_map){
+    if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+      return -1;
+    s->map_len = (unsigned long)st.st_size;
+    if(s->map_len == 0){
+      s->map = (const unsigned char *)"";	// An empty file is one empty slice
+      return 0;
+    }
+    s->map = mmap(NULL, s->map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(s->map == MAP_FAILED){
+      s->map = NULL;
+      return -1;
+    }
+    posix_madvise((void *)s->map, s->map_len, POSIX_MADV_SEQUENTIAL);	// Aggressive read-ahead
+    return 0;
+  }
+
+  if(posix_memalign((void **)&s->buf[0], PAGE, size) != 0 || posix_memalign((void **)&s->buf[1], PAGE, size) != 0){
+    free(s->buf[0]);
+    return -1;
+  }
+  pthread_mutex_init(&s->lock, NULL);
+  pthread_cond_init(&s->cond, NULL);
+  if(pthread_create(&s->thread, NULL, reader, s) != 0){
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->cond);
+    free(s->buf[0]);
+    free(s->buf[1]);
+    return -1;
+  }
+  s->started = 1;
+  return 0;
+}
+
+/* Next slice of the input into *p; returns its length, or -1 on a read error */
+static long source_next(struct source *s, const unsigned char **p) {
+  unsigned long n;
+  int failed;
+
+  if(s->map != NULL){
+    n = s->map_len - s->map_off < s->size ? s->map_len - s->map_off : s->size;
+    *p = s->map + s->map_off;
+    s->map_off += n;
+    return (long)n;
+  }
+
+  pthread_mutex_lock(&s->lock);
+  while(!s->full[s->next])
+    pthread_cond_wait(&s->cond, &s->lock);
+  n = s->len[s->next];
+  failed = s->failed[s->next];			// Copied under the lock, which the reader writes it under
+  pthread_mutex_unlock(&s->lock);
+  *p = s->buf[s->next];
+  return failed ? -1 : (long)n;
+}
+
+/* The slice returned by source_next() is no longer used, so its buffer can be refilled */
+static void source_release(struct source *s) {
+  if(s->map != NULL)
+    return;
+  pthread_mutex_lock(&s->lock);
+  s->full[s->next] = 0;
+  pthread_cond_broadcast(&s->cond);
+  pthread_mutex_unlock(&s->lock);
+  s->next ^= 1;
+}
+
+/* Stops the reader thread, which may be waiting for a buffer after an error, and frees the buffers */
+static void source_close(struct source *s) {
+  if(s->map != NULL){
+    if(s->map_len > 0)
+      munmap((void *)s->map, s->map_len);
+    return;
+  }
+  if(!s->started)
+    return;
+  pthread_mutex_lock(&s->lock);
+  s->stop = 1;
+  pthread_cond_broadcast(&s->cond);
+  pthread_mutex_unlock(&s->lock);
+  pthread_join(s->thread, NULL);
+  pthread_mutex_destroy(&s->lock);
+  pthread_cond_destroy(&s->cond);
+  free(s->buf[0]);
+  free(s->buf[1]);
+}
+
+static void put32(unsigned char *p, uint32_t x) {
+  p[0] = (unsigned char)(x >> 24);
+  p[1] = (unsigned char)(x >> 16);
+  p[2] = (unsigned char)(x >> 8);
+  p[3] = (unsigned char)x;
+}
+
+static uint32_t get32(const unsigned char *p) {
+  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+/* Checks a container header; returns its chunk size, or 0 if it is not one */
+static unsigned long parse_header(const unsigned char *header) {
+  unsigned long chunk = get32(header + 8);
+
+  if(memcmp(header, "AGCM\1\0\0\0", 8) || get32(header + 20) != 0 || chunk == 0 || chunk > MAX_CHUNK)
+    return 0;
+  return chunk;
+}
+
+/* IVs of chunks first to first + n - 1: the nonce prefix of the header and the chunk index */
+static void chunk_ivs(unsigned char (*iv)[12], const unsigned char *header, uint64_t first, unsigned long n) {
+  unsigned long i;
+
+  for(i=0;i<n;i++){
+    memcpy(iv[i], header + 12, 8);
+    put32(iv[i] + 8, (uint32_t)(first + i));
+  }
+}
+
+/* Error message of the last failure */
+static char message[128];
+
+/* Encrypts the input into a container; returns 0, or -1 with the reason in message */
+static int encrypt_file(int in_fd, int out_fd, const aes128gcm_key *gk, unsigned long chunk, int use_map, uint64_t *bytes) {
+  unsigned long per = BUFFER_BYTES / chunk > 0 ? BUFFER_BYTES / chunk : 1;	// Chunks per buffer
+  unsigned char header[HEADER] = "AGCM\1", *out = NULL;
+  unsigned char (*iv)[12] = malloc((per + 1) * sizeof(*iv));
+  const unsigned char *in;
+  struct source src;
+  uint64_t index = 0;
+  unsigned long n, i, clen;
+  long len;
+  int fd, last = 0;
+
+  src.started = 0;
+  src.map = NULL;
+  put32(header + 8, (uint32_t)chunk);
+  fd = open("/dev/urandom", O_RDONLY);
+  if(fd < 0 || read_full(fd, header + 12, 8) != 8)
+    snprintf(message, sizeof(message), "cannot read /dev/urandom");
+  else if(iv == NULL || posix_memalign((void **)&out, PAGE, (per + 1) * (chunk + TAG)) != 0)
+    snprintf(message, sizeof(message), "out of memory");
+  else if(write_full(out_fd, header, HEADER) != 0)
+    snprintf(message, sizeof(message), "write error");
+  else if(source_open(&src, in_fd, per * chunk, use_map) != 0)
+    snprintf(message, sizeof(message), use_map ? "cannot map the input" : "out of memory");
+  else
+    message[0] = '\0';
+  if(fd >= 0)
+    close(fd);
+
+  while(message[0] == '\0' && !last){
+    len = source_next(&src, &in);
+    if(len < 0){
+      snprintf(message, sizeof(message), "read error");
+      break;
+    }
+    last = (unsigned long)len < per * chunk;		// Short slice: it holds the final chunk, maybe empty
+    n = (unsigned long)len / chunk + last;
+    if(index + n > (uint64_t)UINT32_MAX + 1){
+      snprintf(message, sizeof(message), "input too long for a chunk size of %lu", chunk);
+      break;
+    }
+
+    chunk_ivs(iv, header, index, n);
+    for(i=0;i<n;i++){
+      clen = i < (unsigned long)len / chunk ? chunk : (unsigned long)len % chunk;
+      aes128gcm_encrypt(out + i * (chunk + TAG), out + i * (chunk + TAG) + clen, gk, iv[i], 12, in + i * chunk, clen, header, HEADER);
+    }
+    source_release(&src);				// Refilled by the reader while the output is written
+
+    if(write_full(out_fd, out, (unsigned long)len + n * TAG) != 0)
+      snprintf(message, sizeof(message), "write error");
+    index += n;
+    *bytes += (unsigned long)len;
+  }
+
+  source_close(&src);
+  free(out);
+  free(iv);
+  return message[0] ? -1 : 0;
+}
+
+/* Decrypts and verifies a whole container; returns 0, or -1 with the reason in message */
+static int decrypt_file(int in_fd, int out_fd, const aes128gcm_key *gk, int use_map, uint64_t *bytes) {
+  unsigned char header[HEADER], *out = NULL;
+  unsigned char (*iv)[12] = NULL;
+  const unsigned char *in;
+  struct source src;
+  uint64_t index = 0;
+  unsigned long chunk, rec, per = 0, n, i, tail, plain;
+  long len;
+  int last = 0;
+
+  src.started = 0;
+  src.map = NULL;
+  message[0] = '\0';
+  if(read_full(in_fd, header, HEADER) != HEADER || (chunk = parse_header(header)) == 0){
+    snprintf(message, sizeof(message), "not a container");
+    return -1;
+  }
+  rec = chunk + TAG;
+  per = BUFFER_BYTES / rec > 0 ? BUFFER_BYTES / rec : 1;
+
+  iv = malloc(per * sizeof(*iv));
+  if(iv == NULL || posix_memalign((void **)&out, PAGE, per * chunk) != 0)
+    snprintf(message, sizeof(message), "out of memory");
+  else if(source_open(&src, in_fd, per * rec, use_map) != 0)
+    snprintf(message, sizeof(message), use_map ? "cannot map the input" : "out of memory");
+  else if(use_map)
+    src.map_off = HEADER;					// The mapping starts with the header, already read
+
+  while(message[0] == '\0' && !last){
+    len = source_next(&src, &in);
+    if(len < 0){
+      snprintf(message, sizeof(message), "read error");
+      break;
+    }
+    last = (unsigned long)len < per * rec;
+    n = (unsigned long)len / rec;
+    tail = (unsigned long)len % rec;
+    if(last && tail < TAG){					// The last chunk must be shorter than the others
+      snprintf(message, sizeof(message), "truncated container after chunk %llu", (unsigned long long)(index + n));
+      break;
+    }
+    n += last;
+    if(index + n > (uint64_t)UINT32_MAX + 1){
+      snprintf(message, sizeof(message), "too many chunks");
+      break;
+    }
+
+    chunk_ivs(iv, header, index, n);
+    for(i=0,plain=0;i<n;i++){
+      unsigned long clen = i < (unsigned long)len / rec ? chunk : tail - TAG;
+      if(aes128gcm_decrypt(out + i * chunk, in + i * rec + clen, gk, iv[i], 12, in + i * rec, clen, header, HEADER) != 0)
+        break;
+      plain += clen;
+    }
+    if(i < n){
+      snprintf(message, sizeof(message), "chunk %llu is not authentic", (unsigned long long)(index + i));
+      break;
+    }
+    source_release(&src);
+
+    if(write_full(out_fd, out, plain) != 0)
+      snprintf(message, sizeof(message), "write error");
+    index += n;
+    *bytes += plain;
+  }
+
+  source_close(&src);
+  free(out);
+  free(iv);
+  return message[0] ? -1 : 0;
+}
+
+/* Decrypts chunk number index alone, with two positioned reads; returns 0, or -1 with the reason in message */
+static int extract_chunk(int in_fd, int out_fd, const aes128gcm_key *gk, uint64_t index, uint64_t *bytes) {
+  unsigned char header[HEADER], iv[12], *buf;
+  unsigned long chunk, rec, clen;
+  uint64_t body, nchunks;
+  struct stat st;
+
+  if(fstat(in_fd, &st) != 0 || !S_ISREG(st.st_mode) || (uint64_t)st.st_size < HEADER + TAG
+     || pread_full(in_fd, header, HEADER, 0) != 0 || (chunk = parse_header(header)) == 0){
+    snprintf(message, sizeof(message), "not a container");
+    return -1;
+  }
+  rec = chunk + TAG;
+  body = (uint64_t)st.st_size - HEADER;
+  nchunks = body / rec + 1;
+  if(body % rec < TAG){
+    snprintf(message, sizeof(message), "truncated container");
+    return -1;
+  }
+  if(index >= nchunks){
+    snprintf(message, sizeof(message), "no chunk %llu, the container has %llu", (unsigned long long)index, (unsigned long long)nchunks);
+    return -1;
+  }
+  clen = index < nchunks - 1 ? chunk : (unsigned long)(body % rec) - TAG;
+
+  if((buf = malloc(clen + TAG)) == NULL){
+    snprintf(message, sizeof(message), "out of memory");
+    return -1;
+  }
+  chunk_ivs(&iv, header, index, 1);
+  if(pread_full(in_fd, buf, clen + TAG, (off_t)(HEADER + index * rec)) != 0)
+    snprintf(message, sizeof(message), "read error");
+  else if(aes128gcm_decrypt(buf, buf + clen, gk, iv, 12, buf, clen, header, HEADER) != 0)
+    snprintf(message, sizeof(message), "chunk %llu is not authentic", (unsigned long long)index);
+  else if(write_full(out_fd, buf, clen) != 0)
+    snprintf(message, sizeof(message), "write error");
+  else
+    message[0] = '\0';
+  *bytes += clen;
+  free(buf);
+  return message[0] ? -1 : 0;
+}
+
+/* The 16-byte key from 32 hex digits; returns 0 or -1 */
+static int parse_hex_key(unsigned char *key, const char *hex) {
+  unsigned int byte;
+  int i;
+
+  if(strlen(hex) != 32 || strspn(hex, "0123456789abcdefABCDEF") != 32)
+    return -1;
+  for(i=0;i<16;i++){
+    if(sscanf(hex + 2 * i, "%2x", &byte) != 1)
+      return -1;
+    key[i] = (unsigned char)byte;
+  }
+  return 0;
+}
+
+/* The 16-byte key from a file of exactly 16 bytes; returns 0 or -1 */
+static int read_key_file(unsigned char *key, const char *path) {
+  unsigned char extra;
+  int fd = open(path, O_RDONLY), ok;
+
+  if(fd < 0)
+    return -1;
+  ok = read_full(fd, key, 16) == 16 && read_full(fd, &extra, 1) == 0;
+  close(fd);
+  return ok ? 0 : -1;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr, "usage: %s -e|-d [-m] [-v] [-c chunk_size] -k keyfile|-K hexkey input output\n"
+                  "       %s -x chunk -k keyfile|-K hexkey input output\n", name, name);
+}
+
+int main(int argc, char **argv) {
+
+  unsigned char key[16];
+  unsigned long chunk = DEFAULT_CHUNK;
+  uint64_t index = 0, bytes = 0;
+  int opt, mode = 0, use_map = 0, verbose = 0, have_key = 0, in_fd, out_fd, result;
+  struct timespec t0, t1;
+  aes128gcm_key gk;
+  double seconds;
+
+  while((opt = getopt(argc, argv, "edx:mvc:k:K:")) != -1){
+    switch(opt){
+    case 'e': case 'd': mode = opt; break;
+    case 'x': mode = opt; index = strtoull(optarg, NULL, 0); break;
+    case 'm': use_map = 1; break;
+    case 'v': verbose = 1; break;
+    case 'c': chunk = strtoul(optarg, NULL, 0); break;
+    case 'k':
+      if(read_key_file(key, optarg) != 0){
+        fprintf(stderr, "%s: %s: not a 16-byte key file\n", argv[0], optarg);
+        return 1;
+      }
+      have_key = 1;
+      break;
+    case 'K':
+      if(parse_hex_key(key, optarg) != 0){
+        fprintf(stderr, "%s: the key must be 32 hex digits\n", argv[0]);
+        return 1;
+      }
+      have_key = 1;
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if(mode == 0 || !have_key || argc - optind != 2 || chunk == 0 || chunk > MAX_CHUNK){
+    usage(argv[0]);
+    return 1;
+  }
+
+  if(!strcmp(argv[optind], "-") && mode != 'x' && !use_map)
+    in_fd = STDIN_FILENO;
+  else if((in_fd = open(argv[optind], O_RDONLY)) < 0){
+    fprintf(stderr, "%s: %s: %s\n", argv[0], argv[optind], strerror(errno));
+    return 1;
+  }
+  if(!strcmp(argv[optind + 1], "-"))
+    out_fd = STDOUT_FILENO;
+  else if((out_fd = open(argv[optind + 1], O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0){
+    fprintf(stderr, "%s: %s: %s\n", argv[0], argv[optind + 1], strerror(errno));
+    return 1;
+  }
+
+  aes128gcm_setkey(&gk, key);
+  memset(key, 0, sizeof(key));
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+
+  if(mode == 'e')
+    result = encrypt_file(in_fd, out_fd, &gk, chunk, use_map, &bytes);
+  else if(mode == 'd')
+    result = decrypt_file(in_fd, out_fd, &gk, use_map, &bytes);
+  else
+    result = extract_chunk(in_fd, out_fd, &gk, index, &bytes);
+
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  memset(&gk, 0, sizeof(gk));
+  if(out_fd != STDOUT_FILENO && close(out_fd) != 0 && result == 0){
+    snprintf(message, sizeof(message), "write error");
+    result = -1;
+  }
+  if(result != 0){
+    fprintf(stderr, "%s: %s\n", argv[0], message);
+    if(out_fd != STDOUT_FILENO)
+      unlink(argv[optind + 1]);				// Nothing partial or unauthenticated is left behind
+    return 1;
+  }
+  if(verbose){
+    seconds = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+    fprintf(stderr, "%llu bytes in %.3f s, %.1f MB/s\n", (unsigned long long)bytes, seconds, seconds > 0 ? bytes / seconds / 1e6 : 0.0);
+  }
+  return 0;
+}
@@ -0,0 +1,236 @@
+/* Load generator for the GCM-AES 128 worker pool.
+ *
+ * usage: aes128gcm_loadgen [-t max_threads] [-p producers] [-n records] [-s size] [-a aad_size] [-q depth] [-r rate]
+ *
+ * For 1, 2, 4, ... up to max_threads workers (every online core by default), producer
+ * threads (1 by default) submit records of size bytes (1024) with aad_size bytes of
+ * additional data (16) to an aes128gcm_pool of depth records in flight (256), and the
+ * main thread collects them in order. Each run has records records in total (100000).
+ *
+ * Without -r every producer submits as fast as the pool takes records, so latency is
+ * mostly time spent queued behind depth records. With -r, the producers together aim
+ * at rate records per second, and each latency is measured from the time its record
+ * was scheduled, so a pool that falls behind shows it even while producers wait.
+ *
+ * Output is CSV on stdout, one line per worker count:
+ *
+ *   threads,producers,size,records,seconds,records_per_s,gbps,p50_us,p99_us,p999_us
+ *
+ * gbps counts payload bytes; latency runs from submission to collection.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "aes128gcm.h"
+#include "aes128gcm_pool.h"
+
+/* One producer's records; record i lives in slot i % (capacity + 2), and that slot's previous
+   record has been collected, and finished with, by the time the producer reuses it */
+struct producer {
+  aes128gcm_pool *pool;
+  const unsigned char *payload, *aad;
+  unsigned long size, aad_size, records, slots;
+  double interval;					// Seconds between records, 0 to submit at once
+  uint64_t start;
+  int id;
+  aes128gcm_pool_record *record;
+  uint64_t *submitted;				// Nanoseconds at which each slot's record was due
+  unsigned char *out, (*IV)[12], (*tag)[16];
+};
+
+/* Nanoseconds on the monotonic clock */
+static uint64_t now_ns(void) {
+
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/* Sleep until the monotonic clock reads t */
+static void sleep_until(uint64_t t) {
+
+  struct timespec ts;
+
+  ts.tv_sec = (time_t)(t / 1000000000u);
+  ts.tv_nsec = (long)(t % 1000000000u);
+  while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0);
+}
+
+/* Thread body: submits records in order, paced if an interval is set */
+static void *produce(void *p) {
+
+  struct producer *pr = p;
+  aes128gcm_pool_record *r;
+  unsigned long i, s;
+  uint64_t due;
+
+  for(i=0;i<pr->records;i++){
+    s = i % pr->slots;
+    r = &pr->record[s];
+    due = pr->start + (uint64_t)(i * pr->interval * 1e9);
+    if(pr->interval > 0)
+      sleep_until(due);
+    else
+      due = now_ns();
+    memcpy(pr->IV[s], &i, sizeof(i) < 8 ? sizeof(i) : 8);
+    pr->IV[s][11] = (unsigned char)pr->id;		// Unique per producer and record (up to 256 producers)
+    *r = (aes128gcm_pool_record){ pr->IV[s], 12, pr->aad, pr->aad_size, pr->payload, pr->size, pr->out + s * pr->size, pr->tag[s], 0, 0, pr };
+    pr->submitted[s] = due;
+    aes128gcm_pool_submit(pr->pool, r);
+  }
+  return NULL;
+}
+
+static int compare_u64(const void *a, const void *b) {
+
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+/* Latency at quantile q of the n sorted values, in microseconds */
+static double percentile(const uint64_t *sorted, unsigned long n, double q) {
+
+  unsigned long i = (unsigned long)(q * (n - 1) + 0.5);
+
+  return sorted[i] * 1e-3;
+}
+
+/* One run on nthreads workers; prints its CSV line. Returns -1 if it could not be set up */
+static int run(const unsigned char *key, int nthreads, int producers, unsigned long records, unsigned long size, unsigned long aad_size, unsigned long depth, double rate) {
+
+  aes128gcm_pool pool;
+  aes128gcm_pool_record *done;
+  struct producer *pr = calloc((size_t)producers, sizeof(struct producer));
+  pthread_t *thread = calloc((size_t)producers, sizeof(pthread_t));
+  unsigned char *payload = malloc(size + 1), *aad = malloc(aad_size + 1);
+  uint64_t *latency = malloc(records * sizeof(uint64_t)), start, elapsed, t;
+  unsigned long i, n = 0, failures = 0;
+  int p, result = -1;
+
+  if(pr == NULL || thread == NULL || payload == NULL || aad == NULL || latency == NULL)
+    goto out;
+  for(i=0;i<size;i++)
+    payload[i] = (unsigned char)i;
+  memset(aad, 0xa5, aad_size);
+  if(aes128gcm_pool_init(&pool, key, nthreads, depth) != 0)
+    goto out;
+
+  start = now_ns() + 1000000;				// Producers start together, 1 ms from now
+  for(p=0;p<producers;p++){
+    pr[p].pool = &pool;
+    pr[p].payload = payload;
+    pr[p].aad = aad;
+    pr[p].size = size;
+    pr[p].aad_size = aad_size;
+    pr[p].records = records / producers + ((unsigned long)p < records % producers);
+    pr[p].slots = pool.mask + 3;
+    pr[p].interval = rate > 0 ? producers / rate : 0;
+    pr[p].start = start;
+    pr[p].id = p;
+    pr[p].record = calloc(pr[p].slots, sizeof(aes128gcm_pool_record));
+    pr[p].submitted = calloc(pr[p].slots, sizeof(uint64_t));
+    pr[p].out = malloc(pr[p].slots * size + 1);
+    pr[p].IV = calloc(pr[p].slots, 12);
+    pr[p].tag = calloc(pr[p].slots, 16);
+    if(pr[p].record == NULL || pr[p].submitted == NULL || pr[p].out == NULL || pr[p].IV == NULL || pr[p].tag == NULL)
+      goto stop;
+  }
+  for(p=0;p<producers;p++){
+    if(pthread_create(&thread[p], NULL, produce, &pr[p]) != 0)
+      break;
+  }
+  if(p < producers){
+    records = 0;
+    for(i=0;i<(unsigned long)p;i++)
+      records += pr[i].records;
+  }
+
+  for(n=0;n<records;n++){
+    done = aes128gcm_pool_complete(&pool, 1);
+    t = now_ns();
+    latency[n] = t - ((struct producer *)done->user)->submitted[done - ((struct producer *)done->user)->record];
+    failures += done->result != 0;
+  }
+  elapsed = now_ns() - start;
+  while(p--)
+    pthread_join(thread[p], NULL);
+
+  if(n > 0 && failures == 0){
+    qsort(latency, n, sizeof(uint64_t), compare_u64);
+    printf("%d,%d,%lu,%lu,%.3f,%.0f,%.3f,%.1f,%.1f,%.1f\n", nthreads, producers, size, n, elapsed * 1e-9,
+      n / (elapsed * 1e-9), (double)n * size * 8 / elapsed, percentile(latency, n, 0.5), percentile(latency, n, 0.99), percentile(latency, n, 0.999));
+    fflush(stdout);
+    result = 0;
+  }
+  else if(failures)
+    fprintf(stderr, "aes128gcm_loadgen: %lu records failed\n", failures);
+
+stop:
+  aes128gcm_pool_destroy(&pool);
+  for(p=0;p<producers;p++){
+    free(pr[p].record);
+    free(pr[p].submitted);
+    free(pr[p].out);
+    free(pr[p].IV);
+    free(pr[p].tag);
+  }
+out:
+  free(pr);
+  free(thread);
+  free(payload);
+  free(aad);
+  free(latency);
+  return result;
+}
+
+int main(int argc, char **argv) {
+
+  const unsigned char key[16]={0xfe,0xff,0xe9,0x92,0x86,0x65,0x73,0x1c,0x6d,0x6a,0x8f,0x94,0x67,0x30,0x83,0x08};
+  unsigned long records = 100000, size = 1024, aad_size = 16, depth = 256;
+  double rate = 0;
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  int producers = 1, opt, t;
+
+  while((opt = getopt(argc, argv, "t:p:n:s:a:q:r:")) != -1){
+    switch(opt){
+    case 't': cores = strtol(optarg, NULL, 0); break;
+    case 'p': producers = (int)strtol(optarg, NULL, 0); break;
+    case 'n': records = strtoul(optarg, NULL, 0); break;
+    case 's': size = strtoul(optarg, NULL, 0); break;
+    case 'a': aad_size = strtoul(optarg, NULL, 0); break;
+    case 'q': depth = strtoul(optarg, NULL, 0); break;
+    case 'r': rate = strtod(optarg, NULL); break;
+    default:
+      fprintf(stderr, "usage: %s [-t max_threads] [-p producers] [-n records] [-s size] [-a aad_size] [-q depth] [-r rate]\n", argv[0]);
+      return 1;
+    }
+  }
+  if(cores < 1)
+    cores = 1;
+  if(producers < 1 || producers > 256)
+    producers = producers < 1 ? 1 : 256;
+  if(records < (unsigned long)producers)
+    records = (unsigned long)producers;
+
+  printf("threads,producers,size,records,seconds,records_per_s,gbps,p50_us,p99_us,p999_us\n");
+  for(t=1;;t*=2){
+    if(t > cores)
+      t = (int)cores;				// The last run uses every core
+    if(run(key, t, producers, records, size, aad_size, depth, rate) != 0){
+      fprintf(stderr, "aes128gcm_loadgen: run on %d threads failed\n", t);
+      return 1;
+    }
+    if(t == cores)
+      break;
+  }
+  return 0;
+}
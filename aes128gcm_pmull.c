@@ -0,0 +1,311 @@
+/*****************************************************************************/
+/* PMULL backend of GHASH
+
+	Blocks are bit-reversed within each byte (RBIT), so that a 128-bit
+	register read little-endian holds the GCM block as a polynomial with
+	coefficient i in bit i, and no shift is needed after the multiply.
+	Every product is computed with three 64-bit polynomial multiplies
+	(Karatsuba), and the 256-bit products of up to 8 blocks against
+	H^8..H^1 are summed before a single reduction modulo
+	x^128 + x^7 + x^2 + x + 1, which folds the upper half twice with
+	x^128 = x^7 + x^2 + x + 1 (0x87):
+
+		Y' = (Y ^ X1) * H^8 ^ X2 * H^7 ^ ... ^ X8 * H
+
+	The stitched kernels run AES-CTR and GHASH over the same 8 blocks in one
+	pass, with the multiplies issued between the AESE/AESMC rounds, as in
+	the PCLMULQDQ backend.
+
+	This file is compiled with -march=armv8-a+crypto, but nothing in it runs
+	unless the hwcaps report PMULL (see aes128gcm_setkey and aes128e_setkey).
+
+																			 */
+/*****************************************************************************/
+
+  // ************************************************************************//
+ // Includes		                                                        //
+// ************************************************************************//
+#include "aes128gcm_pmull.h"
+
+#ifdef AES128GCM_HAVE_PMULL
+
+#include <stdint.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#include <arm_neon.h>
+
+  // ************************************************************************//
+ // Definitions		                                                        //
+// ************************************************************************//
+
+/* Number of rounds of AES-128 */
+#define Nr 10
+
+  // ************************************************************************ //
+ // Private functions                                                        //
+// ************************************************************************ //
+
+/* Low 64-bit halves of a and b multiplied into 128 bits */
+static inline uint8x16_t MulLow(uint8x16_t a, uint8x16_t b) {
+
+	return vreinterpretq_u8_p128(vmull_p64(vgetq_lane_p64(vreinterpretq_p64_u8(a), 0), vgetq_lane_p64(vreinterpretq_p64_u8(b), 0)));
+}
+
+/* High 64-bit halves of a and b multiplied into 128 bits */
+static inline uint8x16_t MulHigh(uint8x16_t a, uint8x16_t b) {
+
+	return vreinterpretq_u8_p128(vmull_high_p64(vreinterpretq_p64_u8(a), vreinterpretq_p64_u8(b)));
+}
+
+/* Accumulate the unreduced product a * h into lo, hi and the Karatsuba middle term mid */
+static inline void MulAcc(uint8x16_t a, uint8x16_t h, uint8x16_t *lo, uint8x16_t *hi, uint8x16_t *mid) {
+
+	uint8x16_t as = veorq_u8(a, vextq_u8(a, a, 8));		// Both halves are a0 ^ a1
+	uint8x16_t hs = veorq_u8(h, vextq_u8(h, h, 8));		// Both halves are h0 ^ h1
+
+	*lo  = veorq_u8(*lo,  MulLow(a, h));		// a0 * h0
+	*hi  = veorq_u8(*hi,  MulHigh(a, h));		// a1 * h1
+	*mid = veorq_u8(*mid, MulLow(as, hs));		// (a0 ^ a1) * (h0 ^ h1)
+}
+
+/* Reduce a sum of Karatsuba products to a 128-bit field element */
+static inline uint8x16_t Reduce(uint8x16_t lo, uint8x16_t hi, uint8x16_t mid) {
+
+	const uint8x16_t zero = vdupq_n_u8(0);
+	const uint8x16_t poly = vreinterpretq_u8_u64(vdupq_n_u64(0x87));	// x^7 + x^2 + x + 1
+	uint8x16_t t;
+
+	mid = veorq_u8(mid, veorq_u8(lo, hi));		// Middle 128 bits of the 256-bit product
+	lo = veorq_u8(lo, vextq_u8(zero, mid, 8));
+	hi = veorq_u8(hi, vextq_u8(mid, zero, 8));
+
+	// The product is [hi:lo] = x^192 p3 + x^128 p2 + x^64 p1 + p0; fold p3 into p2:p1 first
+	t = MulHigh(hi, poly);
+	hi = veorq_u8(hi, vextq_u8(t, zero, 8));
+	lo = veorq_u8(lo, vextq_u8(zero, t, 8));
+
+	// Then p2 into p1:p0
+	return veorq_u8(lo, MulLow(hi, poly));
+}
+
+/* Multiplication in GF(2^128) of two bit-reversed elements */
+static inline uint8x16_t GFMulPMULL(uint8x16_t a, uint8x16_t b) {
+
+	uint8x16_t lo = vdupq_n_u8(0), hi = vdupq_n_u8(0), mid = vdupq_n_u8(0);
+
+	MulAcc(a, b, &lo, &hi, &mid);
+	return Reduce(lo, hi, mid);
+}
+
+/* Absorb n <= 8 bit-reversed blocks x[] into y with a single reduction */
+static inline uint8x16_t GhashGroup(uint8x16_t y, const uint8x16_t *x, unsigned long n, const unsigned char Hpow[][16]) {
+
+	uint8x16_t lo = vdupq_n_u8(0), hi = vdupq_n_u8(0), mid = vdupq_n_u8(0);
+
+	for (unsigned long i = 0; i < n; i++)		// Block i is multiplied by H^(n - i)
+	{
+		MulAcc(i == 0 ? veorq_u8(x[0], y) : x[i], vld1q_u8(Hpow[n - 1 - i]), &lo, &hi, &mid);
+	}
+	return Reduce(lo, hi, mid);
+}
+
+/* Counter block with the 32-bit big-endian counter in the last 4 bytes */
+static inline uint8x16_t CounterBlock(uint8x16_t iv, uint32_t counter) {
+
+	return vreinterpretq_u8_u32(vsetq_lane_u32(__builtin_bswap32(counter), vreinterpretq_u32_u8(iv), 3));
+}
+
+/* One counter block encrypted and XORed into the 16 bytes at in; the counter is advanced */
+static inline uint8x16_t CTRBlock(const uint8x16_t *rk, uint8x16_t iv, uint32_t *counter, const unsigned char *in) {
+
+	uint8x16_t b = CounterBlock(iv, (*counter)++);		// inc32
+
+	for (int r = 0; r < Nr - 1; r++)
+	{
+		b = vaesmcq_u8(vaeseq_u8(b, rk[r]));
+	}
+	b = veorq_u8(vaeseq_u8(b, rk[Nr - 1]), rk[Nr]);
+	return veorq_u8(b, vld1q_u8(in));
+}
+
+/* Shared by both directions: 8 counter blocks go through the AES rounds while the
+   8 blocks of hash[] are multiplied by H^8..H^1 between them, then reduced into y */
+static inline void StitchedGroup(const uint8x16_t *rk, uint8x16_t iv, uint32_t *counter, uint8x16_t *b, const uint8x16_t *hash, int hashing, uint8x16_t *y, const unsigned char Hpow[][16]) {
+
+	uint8x16_t lo = vdupq_n_u8(0), hi = vdupq_n_u8(0), mid = vdupq_n_u8(0);
+	int i, r;
+
+	for (i = 0; i < AES128GCM_PMULL_POWERS; i++)
+	{
+		b[i] = CounterBlock(iv, (*counter)++);
+	}
+
+	for (r = 0; r < Nr - 1; r++)
+	{
+		for (i = 0; i < AES128GCM_PMULL_POWERS; i++)
+		{
+			b[i] = vaesmcq_u8(vaeseq_u8(b[i], rk[r]));
+		}
+		if (hashing && r < AES128GCM_PMULL_POWERS)	// One multiply per round, hidden behind the AESE latency
+		{
+			MulAcc(r == 0 ? veorq_u8(hash[0], *y) : hash[r], vld1q_u8(Hpow[AES128GCM_PMULL_POWERS - 1 - r]), &lo, &hi, &mid);
+		}
+	}
+
+	for (i = 0; i < AES128GCM_PMULL_POWERS; i++)
+	{
+		b[i] = veorq_u8(vaeseq_u8(b[i], rk[Nr - 1]), rk[Nr]);
+	}
+
+	if (hashing)
+		*y = Reduce(lo, hi, mid);
+}
+
+  // ************************************************************************ //
+ // Public functions                                                         //
+// ************************************************************************ //
+
+/* The kernel reports the 64-bit polynomial multiply in AT_HWCAP */
+int aes128gcm_pmull_available(void) {
+
+	return (getauxval(AT_HWCAP) & HWCAP_PMULL) != 0;
+}
+
+/* Fill Hpow[i] with H^(i+1) for i = 0..7 */
+void aes128gcm_pmull_init(unsigned char Hpow[][16], const unsigned char *H) {
+
+	uint8x16_t h = vrbitq_u8(vld1q_u8(H));
+	uint8x16_t power = h;
+
+	vst1q_u8(Hpow[0], h);		// Powers are stored bit-reversed, ready for MulAcc
+	for (int i = 1; i < AES128GCM_PMULL_POWERS; i++)
+	{
+		power = GFMulPMULL(power, h);
+		vst1q_u8(Hpow[i], power);
+	}
+}
+
+/* Absorb nblocks blocks at X into Y, 8 blocks per reduction */
+void aes128gcm_pmull_ghash(unsigned char *Y, const unsigned char Hpow[][16], const unsigned char *X, unsigned long nblocks) {
+
+	uint8x16_t y = vrbitq_u8(vld1q_u8(Y));
+	uint8x16_t lo, hi, mid, x;
+	unsigned long n;
+
+	while (nblocks > 0)
+	{
+		n = nblocks < AES128GCM_PMULL_POWERS ? nblocks : AES128GCM_PMULL_POWERS;	// Blocks absorbed by this reduction
+		lo = hi = mid = vdupq_n_u8(0);
+
+		for (unsigned long i = 0; i < n; i++)		// Block i is multiplied by H^(n - i)
+		{
+			x = vrbitq_u8(vld1q_u8(X + 16 * i));
+			if (i == 0)
+				x = veorq_u8(x, y);				// The running hash enters with the first block
+			MulAcc(x, vld1q_u8(Hpow[n - 1 - i]), &lo, &hi, &mid);
+		}
+
+		y = Reduce(lo, hi, mid);					// One reduction for the whole group
+		X += 16 * n;
+		nblocks -= n;
+	}
+
+	vst1q_u8(Y, vrbitq_u8(y));
+}
+
+/* CTR encryption of nblocks blocks with the ciphertext hashed into Y in the same pass */
+void aes128gcm_pmull_encrypt(unsigned char *out, const unsigned char *in, unsigned long nblocks, unsigned char *CB, const unsigned char *roundKeys, unsigned char *Y, const unsigned char Hpow[][16]) {
+
+	uint8x16_t rk[Nr + 1], b[AES128GCM_PMULL_POWERS], c[AES128GCM_PMULL_POWERS];
+	uint8x16_t iv = vld1q_u8(CB);
+	uint8x16_t y = vrbitq_u8(vld1q_u8(Y));
+	uint32_t counter = (uint32_t)CB[12] << 24 | (uint32_t)CB[13] << 16 | (uint32_t)CB[14] << 8 | CB[15];
+	int pending = 0;			// c[] holds a group of ciphertext that is not hashed yet
+	unsigned long i;
+
+	for (i = 0; i <= Nr; i++)
+	{
+		rk[i] = vld1q_u8(roundKeys + 16 * i);
+	}
+
+	for (; nblocks >= AES128GCM_PMULL_POWERS; nblocks -= AES128GCM_PMULL_POWERS, in += 16 * AES128GCM_PMULL_POWERS, out += 16 * AES128GCM_PMULL_POWERS)
+	{
+		StitchedGroup(rk, iv, &counter, b, c, pending, &y, Hpow);	// Hashes the previous group while encrypting this one
+
+		for (i = 0; i < AES128GCM_PMULL_POWERS; i++)
+		{
+			b[i] = veorq_u8(b[i], vld1q_u8(in + 16 * i));
+			vst1q_u8(out + 16 * i, b[i]);
+			c[i] = vrbitq_u8(b[i]);						// Kept in registers for the next group
+		}
+		pending = 1;
+	}
+
+	if (pending)
+		y = GhashGroup(y, c, AES128GCM_PMULL_POWERS, Hpow);	// Last whole group
+
+	for (i = 0; i < nblocks; i++)							// Fewer than 8 blocks left
+	{
+		b[i] = CTRBlock(rk, iv, &counter, in + 16 * i);
+		vst1q_u8(out + 16 * i, b[i]);
+		c[i] = vrbitq_u8(b[i]);
+	}
+	if (nblocks > 0)
+		y = GhashGroup(y, c, nblocks, Hpow);
+
+	CB[12] = (unsigned char)(counter >> 24);
+	CB[13] = (unsigned char)(counter >> 16);
+	CB[14] = (unsigned char)(counter >> 8);
+	CB[15] = (unsigned char)counter;
+	vst1q_u8(Y, vrbitq_u8(y));
+}
+
+/* CTR decryption of nblocks blocks with the ciphertext hashed into Y in the same pass */
+void aes128gcm_pmull_decrypt(unsigned char *out, const unsigned char *in, unsigned long nblocks, unsigned char *CB, const unsigned char *roundKeys, unsigned char *Y, const unsigned char Hpow[][16]) {
+
+	uint8x16_t rk[Nr + 1], b[AES128GCM_PMULL_POWERS], c[AES128GCM_PMULL_POWERS], x[AES128GCM_PMULL_POWERS];
+	uint8x16_t iv = vld1q_u8(CB);
+	uint8x16_t y = vrbitq_u8(vld1q_u8(Y));
+	uint32_t counter = (uint32_t)CB[12] << 24 | (uint32_t)CB[13] << 16 | (uint32_t)CB[14] << 8 | CB[15];
+	unsigned long i;
+
+	for (i = 0; i <= Nr; i++)
+	{
+		rk[i] = vld1q_u8(roundKeys + 16 * i);
+	}
+
+	for (; nblocks >= AES128GCM_PMULL_POWERS; nblocks -= AES128GCM_PMULL_POWERS, in += 16 * AES128GCM_PMULL_POWERS, out += 16 * AES128GCM_PMULL_POWERS)
+	{
+		for (i = 0; i < AES128GCM_PMULL_POWERS; i++)
+		{
+			c[i] = vld1q_u8(in + 16 * i);					// Read once, before out may overwrite it
+			x[i] = vrbitq_u8(c[i]);
+		}
+
+		StitchedGroup(rk, iv, &counter, b, x, 1, &y, Hpow);	// The ciphertext is already known, so it is hashed with its own group
+
+		for (i = 0; i < AES128GCM_PMULL_POWERS; i++)
+		{
+			vst1q_u8(out + 16 * i, veorq_u8(b[i], c[i]));
+		}
+	}
+
+	for (i = 0; i < nblocks; i++)
+	{
+		x[i] = vrbitq_u8(vld1q_u8(in + 16 * i));
+	}
+	if (nblocks > 0)
+		y = GhashGroup(y, x, nblocks, Hpow);				// Hashed before the plaintext is written
+	for (i = 0; i < nblocks; i++)
+	{
+		vst1q_u8(out + 16 * i, CTRBlock(rk, iv, &counter, in + 16 * i));
+	}
+
+	CB[12] = (unsigned char)(counter >> 24);
+	CB[13] = (unsigned char)(counter >> 16);
+	CB[14] = (unsigned char)(counter >> 8);
+	CB[15] = (unsigned char)counter;
+	vst1q_u8(Y, vrbitq_u8(y));
+}
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef AES128GCM_PMULL_H
+#define AES128GCM_PMULL_H
+
+/* PMULL backend of GHASH (ARMv8 Crypto Extensions). It is compiled on little-endian
+ * aarch64 Linux only, and aes128gcm_setkey() only selects it when the kernel reports
+ * PMULL in the hwcaps. The stitched kernels also use AESE/AESMC and are only called
+ * for keys whose AES backend is AES128E_ARMCE.
+ */
+
+#if defined(__aarch64__) && defined(__linux__) && !defined(__ARM_BIG_ENDIAN)
+#define AES128GCM_HAVE_PMULL 1
+
+/* Number of H powers kept per key, which is also the number of blocks absorbed per reduction */
+#define AES128GCM_PMULL_POWERS 8
+
+/* Returns 1 if the CPU has the 64-bit polynomial multiply (HWCAP_PMULL), 0 otherwise. */
+int aes128gcm_pmull_available(void);
+
+/* Fill Hpow[i] with H^(i+1) for i = 0..7, from the 16-byte hash subkey H. */
+void aes128gcm_pmull_init(unsigned char Hpow[][16], const unsigned char *H);
+
+/* Absorb the nblocks 16-byte blocks at X into the GHASH accumulator Y (16 bytes, GCM
+ * byte order): Y = (...((Y ^ X1) * H ^ X2) * H ...) * H. */
+void aes128gcm_pmull_ghash(unsigned char *Y, const unsigned char Hpow[][16], const unsigned char *X, unsigned long nblocks);
+
+/* AES-CTR over nblocks blocks from in to out with the 32-bit counter in CB (advanced
+ * past the last block), fused with GHASH of the ciphertext into Y. roundKeys is the
+ * 176-byte AES-128 key schedule. out may equal in. */
+void aes128gcm_pmull_encrypt(unsigned char *out, const unsigned char *in, unsigned long nblocks, unsigned char *CB, const unsigned char *roundKeys, unsigned char *Y, const unsigned char Hpow[][16]);
+void aes128gcm_pmull_decrypt(unsigned char *out, const unsigned char *in, unsigned long nblocks, unsigned char *CB, const unsigned char *roundKeys, unsigned char *Y, const unsigned char Hpow[][16]);
+
+#endif
+
+#endif
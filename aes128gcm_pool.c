@@ -0,0 +1,360 @@
+/*****************************************************************************/
+/* Worker pool for GCM-AES 128 records
+
+	Records travel through one bounded ring of cells (Vyukov's MPMC queue),
+	extended with a third turn so that a cell is only reused once the
+	collector has taken its record back. For the lap where a cell serves
+	position pos, its seq is
+
+		pos			free, the producer owning pos may fill it
+		pos + 1		submitted, a worker may claim it
+		pos + 2		done, the collector may take it
+		pos + cap	free again, for position pos + cap
+
+	Producers and workers claim positions with a compare-and-swap on their
+	own counter; the collector is alone on its counter, so completions come
+	back in the order the positions were claimed, whatever order the workers
+	finish in. The ring holds at most cap records in flight, which bounds the
+	memory and gives producers backpressure.
+
+	Threads only sleep after a short spin finds nothing to do. A sleeper
+	announces itself in its doorbell before checking again under the lock,
+	and wakers check the doorbell after publishing their change, both behind
+	a full fence, so a wakeup cannot be lost and the hot path takes no lock.
+
+																			 */
+/*****************************************************************************/
+
+  // ************************************************************************//
+ // Includes		                                                        //
+// ************************************************************************//
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "aes128gcm_pool.h"
+
+  // ************************************************************************//
+ // Definitions		                                                        //
+// ************************************************************************//
+
+/* Checks of the ring before a thread goes to sleep */
+#define SpinTries 256
+
+/* Smallest ring: the three turns of a lap must stay distinct from the next lap's */
+#define MinimumCapacity 4
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CpuRelax() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define CpuRelax() __asm__ __volatile__("yield")
+#else
+#define CpuRelax() ((void)0)
+#endif
+
+  // ************************************************************************ //
+ // Private functions                                                        //
+// ************************************************************************ //
+
+/* Key material is cleared through a volatile pointer, so the stores are not optimized away */
+static void Zeroize (void *p, unsigned long len) {
+
+	volatile unsigned char *v = p;
+
+	while (len--)
+	{
+		*v++ = 0;
+	}
+}
+
+/* Turn of the cell at position pos compared with the expected one: 0 if it is that turn */
+static int64_t Turn (const aes128gcm_pool *pool, uint64_t pos, uint64_t expected) {
+
+	return (int64_t)(__atomic_load_n(&pool->cells[pos & pool->mask].seq, __ATOMIC_ACQUIRE) - expected);
+}
+
+/* A free cell is waiting for the next producer */
+static int Writable (aes128gcm_pool *pool) {
+
+	uint64_t pos = __atomic_load_n(&pool->enqueue_pos, __ATOMIC_RELAXED);
+
+	return Turn(pool, pos, pos) == 0;
+}
+
+/* A submitted cell is waiting for a worker, or the pool is stopping */
+static int Claimable (aes128gcm_pool *pool) {
+
+	uint64_t pos = __atomic_load_n(&pool->dequeue_pos, __ATOMIC_RELAXED);
+
+	return Turn(pool, pos, pos + 1) == 0 || __atomic_load_n(&pool->stop, __ATOMIC_ACQUIRE);
+}
+
+/* The oldest record is done */
+static int Collectable (aes128gcm_pool *pool) {
+
+	uint64_t pos = pool->complete_pos;
+
+	return Turn(pool, pos, pos + 2) == 0;
+}
+
+/* Spin for a while, then sleep on d until ready(pool) holds */
+static void Await (aes128gcm_pool *pool, aes128gcm_pool_doorbell *d, int (*ready)(aes128gcm_pool *)) {
+
+	int spin;
+
+	for (spin = 0; spin < SpinTries; spin++)
+	{
+		if (ready(pool))
+			return;
+		CpuRelax();
+	}
+
+	pthread_mutex_lock(&d->lock);
+	__atomic_add_fetch(&d->sleepers, 1, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);		// Pairs with the fence in Wake()
+	while (!ready(pool))
+	{
+		pthread_cond_wait(&d->cond, &d->lock);
+	}
+	__atomic_sub_fetch(&d->sleepers, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&d->lock);
+}
+
+/* Wake one (or all) of the threads sleeping on d, after a change they may be waiting for */
+static void Wake (aes128gcm_pool_doorbell *d, int all) {
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&d->sleepers, __ATOMIC_RELAXED) == 0)
+		return;
+
+	pthread_mutex_lock(&d->lock);
+	if (all)
+		pthread_cond_broadcast(&d->cond);
+	else
+		pthread_cond_signal(&d->cond);
+	pthread_mutex_unlock(&d->lock);
+}
+
+/* Claim the oldest submitted cell for a worker; returns its position, or -1 if none is submitted */
+static int Claim (aes128gcm_pool *pool, uint64_t *claimed) {
+
+	uint64_t pos = __atomic_load_n(&pool->dequeue_pos, __ATOMIC_RELAXED);
+	int64_t turn;
+
+	for (;;)
+	{
+		turn = Turn(pool, pos, pos + 1);
+		if (turn == 0)
+		{
+			if (__atomic_compare_exchange_n(&pool->dequeue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			{
+				*claimed = pos;
+				return 0;
+			}
+		}
+		else if (turn < 0)
+			return -1;									// Not submitted yet: empty
+		else
+			pos = __atomic_load_n(&pool->dequeue_pos, __ATOMIC_RELAXED);	// Another worker took it
+	}
+}
+
+static int DoorbellInit (aes128gcm_pool_doorbell *d) {
+
+	d->sleepers = 0;
+	if (pthread_mutex_init(&d->lock, NULL) != 0)
+		return -1;
+	if (pthread_cond_init(&d->cond, NULL) != 0)
+	{
+		pthread_mutex_destroy(&d->lock);
+		return -1;
+	}
+	return 0;
+}
+
+static void DoorbellDestroy (aes128gcm_pool_doorbell *d) {
+
+	pthread_cond_destroy(&d->cond);
+	pthread_mutex_destroy(&d->lock);
+}
+
+/* Claim records with this worker's key until the pool stops and the ring is drained */
+static void *Worker (void *arg) {
+
+	aes128gcm_pool_worker *worker = arg;
+	aes128gcm_pool *pool = worker->pool;
+	aes128gcm_pool_cell *cell;
+	aes128gcm_pool_record *r;
+	uint64_t pos;
+
+	for (;;)
+	{
+		if (Claim(pool, &pos) != 0)
+		{
+			if (__atomic_load_n(&pool->stop, __ATOMIC_ACQUIRE))
+				return NULL;
+			Await(pool, &pool->idle, Claimable);
+			continue;
+		}
+
+		cell = &pool->cells[pos & pool->mask];
+		r = cell->record;
+		if (r->decrypt)
+			r->result = aes128gcm_decrypt(r->out, r->tag, &worker->gk, r->IV, r->len_iv, r->in, r->len, r->add_data, r->len_ad);
+		else
+		{
+			aes128gcm_encrypt(r->out, r->tag, &worker->gk, r->IV, r->len_iv, r->in, r->len, r->add_data, r->len_ad);
+			r->result = 0;
+		}
+
+		__atomic_store_n(&cell->seq, pos + 2, __ATOMIC_RELEASE);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);		// Pairs with the collector moving on, then sleeping
+		if (pos == __atomic_load_n(&pool->complete_pos, __ATOMIC_RELAXED))
+			Wake(&pool->collector, 0);					// Only the oldest record can be what the collector waits for
+	}
+}
+
+/* Workers are stopped and joined; the first n were started */
+static void StopWorkers (aes128gcm_pool *pool, int n) {
+
+	__atomic_store_n(&pool->stop, 1, __ATOMIC_RELEASE);
+	Wake(&pool->idle, 1);
+	while (n--)
+	{
+		pthread_join(pool->workers[n].thread, NULL);
+	}
+}
+
+  // ************************************************************************ //
+ // Public functions                                                         //
+// ************************************************************************ //
+
+/* The key is expanded once and copied into every worker; the ring is allocated once */
+int aes128gcm_pool_init(aes128gcm_pool *pool, const unsigned char *k, int nthreads, unsigned long capacity) {
+
+	aes128gcm_key gk;
+	unsigned long cap, i;
+	int n;
+
+	memset(pool, 0, sizeof(*pool));
+	for (cap = MinimumCapacity; cap < capacity; cap <<= 1);
+
+	if (nthreads < 1)
+		return -1;
+	pool->cells = calloc(cap, sizeof(aes128gcm_pool_cell));
+	pool->workers = calloc((unsigned long)nthreads, sizeof(aes128gcm_pool_worker));
+	if (pool->cells == NULL || pool->workers == NULL)
+	{
+		free(pool->cells);
+		free(pool->workers);
+		return -1;
+	}
+	if (DoorbellInit(&pool->producers) != 0)
+		goto fail_producers;
+	if (DoorbellInit(&pool->idle) != 0)
+		goto fail_idle;
+	if (DoorbellInit(&pool->collector) != 0)
+		goto fail_collector;
+
+	for (i = 0; i < cap; i++)
+	{
+		pool->cells[i].seq = i;
+	}
+	pool->mask = cap - 1;
+	pool->nthreads = nthreads;
+
+	aes128gcm_setkey(&gk, k);
+	for (n = 0; n < nthreads; n++)
+	{
+		pool->workers[n].gk = gk;
+		pool->workers[n].pool = pool;
+		if (pthread_create(&pool->workers[n].thread, NULL, Worker, &pool->workers[n]) != 0)
+		{
+			Zeroize(&gk, sizeof(gk));
+			StopWorkers(pool, n);
+			DoorbellDestroy(&pool->collector);
+			goto fail_collector;
+		}
+	}
+	Zeroize(&gk, sizeof(gk));
+	return 0;
+
+fail_collector:
+	DoorbellDestroy(&pool->idle);
+fail_idle:
+	DoorbellDestroy(&pool->producers);
+fail_producers:
+	Zeroize(pool->workers, (unsigned long)nthreads * sizeof(aes128gcm_pool_worker));
+	free(pool->cells);
+	free(pool->workers);
+	return -1;
+}
+
+/* Workers drain the ring before they exit, so no record is left half processed */
+void aes128gcm_pool_destroy(aes128gcm_pool *pool) {
+
+	StopWorkers(pool, pool->nthreads);
+	DoorbellDestroy(&pool->producers);
+	DoorbellDestroy(&pool->idle);
+	DoorbellDestroy(&pool->collector);
+	Zeroize(pool->workers, (unsigned long)pool->nthreads * sizeof(aes128gcm_pool_worker));
+	free(pool->workers);
+	free(pool->cells);
+}
+
+/* Producers race for enqueue_pos; the winner owns the cell until it marks it submitted */
+int aes128gcm_pool_try_submit(aes128gcm_pool *pool, aes128gcm_pool_record *record) {
+
+	uint64_t pos = __atomic_load_n(&pool->enqueue_pos, __ATOMIC_RELAXED);
+	aes128gcm_pool_cell *cell;
+	int64_t turn;
+
+	for (;;)
+	{
+		turn = Turn(pool, pos, pos);
+		if (turn == 0)
+		{
+			if (__atomic_compare_exchange_n(&pool->enqueue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		}
+		else if (turn < 0)
+			return -1;									// Still in use a lap behind: full
+		else
+			pos = __atomic_load_n(&pool->enqueue_pos, __ATOMIC_RELAXED);	// Another producer took it
+	}
+
+	cell = &pool->cells[pos & pool->mask];
+	cell->record = record;
+	__atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+	Wake(&pool->idle, 0);
+	return 0;
+}
+
+void aes128gcm_pool_submit(aes128gcm_pool *pool, aes128gcm_pool_record *record) {
+
+	while (aes128gcm_pool_try_submit(pool, record) != 0)
+	{
+		Await(pool, &pool->producers, Writable);
+	}
+}
+
+/* The collector alone moves complete_pos, and hands the cell to the next lap's producer */
+aes128gcm_pool_record *aes128gcm_pool_complete(aes128gcm_pool *pool, int wait) {
+
+	uint64_t pos = pool->complete_pos;
+	aes128gcm_pool_cell *cell = &pool->cells[pos & pool->mask];
+	aes128gcm_pool_record *record;
+
+	if (!Collectable(pool))
+	{
+		if (!wait)
+			return NULL;
+		Await(pool, &pool->collector, Collectable);
+	}
+
+	record = cell->record;
+	__atomic_store_n(&pool->complete_pos, pos + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&cell->seq, pos + pool->mask + 1, __ATOMIC_RELEASE);
+	Wake(&pool->producers, 0);
+	return record;
+}
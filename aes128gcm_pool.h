@@ -0,0 +1,86 @@
+#ifndef AES128GCM_POOL_H
+#define AES128GCM_POOL_H
+
+/* Pool of worker threads that encrypt or decrypt independent records under one key.
+ * Any number of producer threads submit records into a bounded lock-free ring, each
+ * worker holds its own copy of the expanded key, and one collector thread takes the
+ * completed records back in submission order.
+ */
+
+#include <stdint.h>
+#include <pthread.h>
+#include "aes128gcm.h"
+
+/* One record. For encryption "in" is the plaintext and the tag is written; for
+ * decryption "in" is the ciphertext and the tag is read. "out" may be equal to "in".
+ * The buffers must stay valid until the record comes back from aes128gcm_pool_complete(). */
+typedef struct {
+	const unsigned char *IV;
+	unsigned long len_iv;
+	const unsigned char *add_data;
+	unsigned long len_ad;
+	const unsigned char *in;
+	unsigned long len;
+	unsigned char *out;
+	unsigned char *tag;
+	int decrypt;				/* 0 to encrypt, 1 to decrypt and verify */
+	int result;					/* Set by the pool: 0, or -1 if the tag is not authentic (out is then zeroed) */
+	void *user;					/* Left untouched by the pool */
+} aes128gcm_pool_record;
+
+/* Slot of the ring; seq tells whose turn it is (see aes128gcm_pool.c) */
+typedef struct {
+	uint64_t seq;
+	aes128gcm_pool_record *record;
+} aes128gcm_pool_cell;
+
+/* Sleeping threads of one kind, woken when the ring changes in their favour */
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	unsigned long sleepers;
+} aes128gcm_pool_doorbell;
+
+/* Per-worker state */
+typedef struct {
+	aes128gcm_key gk;			/* This worker's copy of the expanded key */
+	struct aes128gcm_pool *pool;
+	pthread_t thread;
+} aes128gcm_pool_worker;
+
+typedef struct aes128gcm_pool {
+	uint64_t enqueue_pos;		/* Next slot for producers */
+	unsigned char pad0[64 - sizeof(uint64_t)];
+	uint64_t dequeue_pos;		/* Next slot for workers */
+	unsigned char pad1[64 - sizeof(uint64_t)];
+	uint64_t complete_pos;		/* Next slot for the collector */
+	unsigned char pad2[64 - sizeof(uint64_t)];
+	aes128gcm_pool_cell *cells;
+	unsigned long mask;			/* Capacity - 1, the capacity being a power of two */
+	aes128gcm_pool_worker *workers;
+	int nthreads, stop;
+	aes128gcm_pool_doorbell producers, idle, collector;
+} aes128gcm_pool;
+
+/* Start nthreads workers under the 16-byte key k, with room for capacity records in flight
+ * (rounded up to a power of two, at least 4). Returns 0, or -1 if memory is exhausted or a
+ * thread could not be started. */
+int aes128gcm_pool_init(aes128gcm_pool *pool, const unsigned char *k, int nthreads, unsigned long capacity);
+
+/* Stop the workers once the records already submitted are processed, zero the key copies
+ * and free the pool. Records not yet taken by aes128gcm_pool_complete() are dropped. */
+void aes128gcm_pool_destroy(aes128gcm_pool *pool);
+
+/* Queue a record; safe from any number of threads. Blocks while capacity records are in
+ * flight, until the collector takes completed ones back. */
+void aes128gcm_pool_submit(aes128gcm_pool *pool, aes128gcm_pool_record *record);
+
+/* Same as aes128gcm_pool_submit() without blocking. Returns 0, or -1 if the ring is full. */
+int aes128gcm_pool_try_submit(aes128gcm_pool *pool, aes128gcm_pool_record *record);
+
+/* Take back the oldest submitted record once it is processed, waiting for it if wait is
+ * non-zero. Returns NULL if wait is 0 and it is not done yet. Only one thread at a time
+ * may collect. */
+aes128gcm_pool_record *aes128gcm_pool_complete(aes128gcm_pool *pool, int wait);
+
+#endif
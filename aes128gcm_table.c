@@ -0,0 +1,164 @@
+/*****************************************************************************/
+/* Table-driven GHASH (Shoup's 4-bit / 8-bit method)
+
+	Instead of 128 conditional shift/xor steps per block, the block is
+	consumed 4 or 8 bits at a time from the last byte to the first. Each step
+	shifts the accumulator Z right by 4 (or 8) bits, folds the bits shifted
+	out back in through a small constant reduction table, and adds the
+	precomputed multiple Htable[n] = n * H of the current nibble (or byte).
+
+	Memory footprint:
+	  4-bit: 16 products per key   = 256 bytes, plus a shared 128-byte table
+	  8-bit: 256 products per key  = 4 KiB,     plus a shared 2 KiB table
+	The 4-bit variant does 32 lookups per block, the 8-bit variant 16.
+
+																			 */
+/*****************************************************************************/
+
+  // ************************************************************************//
+ // Includes		                                                        //
+// ************************************************************************//
+#include <stdint.h>
+#include <string.h>
+#include "aes128gcm_table.h"
+
+  // ************************************************************************//
+ // Definitions		                                                        //
+// ************************************************************************//
+
+#if AES128GCM_TABLE_BITS != 4 && AES128GCM_TABLE_BITS != 8
+#error "AES128GCM_TABLE_BITS must be 4 or 8"
+#endif
+
+/* Reduction of the bits shifted out of Z: bit j of the shifted-out value stands for
+   x^(128 + width - 1 - j), which folds back as R = 11100001 shifted by (width - 1 - j) */
+#define REM4(i) ((uint64_t)(((i) & 1 ? 0x1C20 : 0) ^ ((i) & 2 ? 0x3840 : 0) ^ ((i) & 4 ? 0x7080 : 0) ^ ((i) & 8 ? 0xE100 : 0)) << 48),
+#define REM8(i) ((uint64_t)(((i) &   1 ? 0x01C2 : 0) ^ ((i) &   2 ? 0x0384 : 0) ^ ((i) &   4 ? 0x0708 : 0) ^ ((i) &   8 ? 0x0E10 : 0) ^ \
+                            ((i) &  16 ? 0x1C20 : 0) ^ ((i) &  32 ? 0x3840 : 0) ^ ((i) &  64 ? 0x7080 : 0) ^ ((i) & 128 ? 0xE100 : 0)) << 48),
+
+/* Enumerate 0..15 and 0..255 to generate the reduction tables at compile time */
+#define SEQ4(X, b)   X((b) + 0) X((b) + 1) X((b) + 2) X((b) + 3)
+#define SEQ16(X, b)  SEQ4(X, (b) + 0) SEQ4(X, (b) + 4) SEQ4(X, (b) + 8) SEQ4(X, (b) + 12)
+#define SEQ64(X, b)  SEQ16(X, (b) + 0) SEQ16(X, (b) + 16) SEQ16(X, (b) + 32) SEQ16(X, (b) + 48)
+#define SEQ256(X)    SEQ64(X, 0) SEQ64(X, 64) SEQ64(X, 128) SEQ64(X, 192)
+
+/* Big-endian 64-bit load and store */
+#define GETU64(p) (((uint64_t)(p)[0] << 56) | ((uint64_t)(p)[1] << 48) | ((uint64_t)(p)[2] << 40) | ((uint64_t)(p)[3] << 32) | \
+                   ((uint64_t)(p)[4] << 24) | ((uint64_t)(p)[5] << 16) | ((uint64_t)(p)[6] <<  8) |  (uint64_t)(p)[7])
+
+  // ************************************************************************ //
+ // Private constants                                                        //
+// ************************************************************************ //
+
+#if AES128GCM_TABLE_BITS == 4
+static const uint64_t rem_table[16] = { SEQ16(REM4, 0) };
+#else
+static const uint64_t rem_table[256] = { SEQ256(REM8) };
+#endif
+
+  // ************************************************************************ //
+ // Private functions                                                        //
+// ************************************************************************ //
+
+/* Multiply by x: V is shifted right by one bit and reduced with R when a bit falls off */
+static void ShiftRightReduce(uint64_t *hi, uint64_t *lo) {
+
+	uint64_t T = 0xe100000000000000ULL & (0 - (*lo & 1));	// R if the LSB of V is 1, else 0
+
+	*lo = (*hi << 63) | (*lo >> 1);
+	*hi = (*hi >> 1) ^ T;
+}
+
+/* Store a 64-bit value big-endian */
+static void PutU64(unsigned char *p, uint64_t v) {
+
+	for (int i = 7; i >= 0; i--)
+	{
+		p[i] = (unsigned char)v;
+		v >>= 8;
+	}
+}
+
+  // ************************************************************************ //
+ // Public functions                                                         //
+// ************************************************************************ //
+
+/* Fill Htable with every multiple of H by a 4-bit or 8-bit value */
+void aes128gcm_table_init(uint64_t Htable[][2], const unsigned char *H) {
+
+	const unsigned int entries = 1u << AES128GCM_TABLE_BITS;
+	uint64_t hi = GETU64(H), lo = GETU64(H + 8);
+
+	Htable[0][0] = Htable[0][1] = 0;
+	Htable[entries / 2][0] = hi;						// The top bit of the index is the coefficient of x^0
+	Htable[entries / 2][1] = lo;
+
+	for (unsigned int i = entries / 4; i > 0; i >>= 1)	// Every lower bit is one more multiplication by x
+	{
+		ShiftRightReduce(&hi, &lo);
+		Htable[i][0] = hi;
+		Htable[i][1] = lo;
+	}
+
+	for (unsigned int i = 2; i < entries; i <<= 1)		// Other entries are sums of the single-bit ones
+	{
+		for (unsigned int j = 1; j < i; j++)
+		{
+			Htable[i + j][0] = Htable[i][0] ^ Htable[j][0];
+			Htable[i + j][1] = Htable[i][1] ^ Htable[j][1];
+		}
+	}
+}
+
+/* Absorb nblocks blocks at X into Y, one table lookup per nibble (or byte) */
+void aes128gcm_table_ghash(unsigned char *Y, const uint64_t Htable[][2], const unsigned char *X, unsigned long nblocks) {
+
+	unsigned char Xi[16];
+	uint64_t Zhi, Zlo, rem;
+	unsigned int n;
+
+	memcpy(Xi, Y, 16);
+
+	for (; nblocks > 0; nblocks--, X += 16)
+	{
+		for (int j = 0; j < 16; j++)
+		{
+			Xi[j] ^= X[j];							// Y ^ Xi enters the multiplication
+		}
+
+		Zhi = Zlo = 0;
+
+		for (int j = 15; j >= 0; j--)				// The last byte holds the highest powers of x
+		{
+#if AES128GCM_TABLE_BITS == 4
+			for (int half = 0; half < 2; half++)	// Low nibble first, then high nibble
+			{
+				n = half ? (Xi[j] >> 4) : (Xi[j] & 0xf);
+				if (j != 15 || half)				// Shift Z by one nibble before every lookup but the first
+				{
+					rem = Zlo & 0xf;
+					Zlo = (Zhi << 60) | (Zlo >> 4);
+					Zhi = (Zhi >> 4) ^ rem_table[rem];
+				}
+				Zhi ^= Htable[n][0];
+				Zlo ^= Htable[n][1];
+			}
+#else
+			n = Xi[j];
+			if (j != 15)							// Shift Z by one byte before every lookup but the first
+			{
+				rem = Zlo & 0xff;
+				Zlo = (Zhi << 56) | (Zlo >> 8);
+				Zhi = (Zhi >> 8) ^ rem_table[rem];
+			}
+			Zhi ^= Htable[n][0];
+			Zlo ^= Htable[n][1];
+#endif
+		}
+
+		PutU64(Xi, Zhi);							// Z becomes the running hash
+		PutU64(Xi + 8, Zlo);
+	}
+
+	memcpy(Y, Xi, 16);
+}
@@ -0,0 +1,19 @@
+#ifndef AES128GCM_TABLE_H
+#define AES128GCM_TABLE_H
+
+/* Table-driven software GHASH (Shoup's method) for hosts without a carry-less
+ * multiply. The table width is fixed at build time by AES128GCM_TABLE_BITS.
+ */
+
+#include <stdint.h>
+#include "aes128gcm.h"
+
+/* Fill Htable[i] = i * H for every 4-bit or 8-bit value i, from the 16-byte hash subkey H.
+ * Each entry holds the product as two big-endian 64-bit halves. */
+void aes128gcm_table_init(uint64_t Htable[][2], const unsigned char *H);
+
+/* Absorb the nblocks 16-byte blocks at X into the GHASH accumulator Y (16 bytes, GCM
+ * byte order): Y = (...((Y ^ X1) * H ^ X2) * H ...) * H. */
+void aes128gcm_table_ghash(unsigned char *Y, const uint64_t Htable[][2], const unsigned char *X, unsigned long nblocks);
+
+#endif
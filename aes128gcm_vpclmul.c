@@ -0,0 +1,345 @@
+/*****************************************************************************/
+/* VPCLMULQDQ backend of GHASH
+
+	The PCLMULQDQ method of aes128gcm_clmul.c on 256-bit registers: each
+	register holds two consecutive byte-reflected blocks, and one
+	VPCLMULQDQ multiplies both by their powers of H. The Karatsuba products
+	of 16 blocks against H^16..H^1 are summed lane-wise, the two lanes are
+	folded, and a single reduction gives
+
+		Y' = (Y ^ X1) * H^16 ^ X2 * H^15 ^ ... ^ X16 * H
+
+	The stitched kernels run 16 counter blocks through VAES (8 registers)
+	while the 8 multiplies of the previous 16 ciphertext blocks are issued
+	between the rounds, one per round.
+
+	This file is compiled with -mvpclmulqdq -mvaes -mavx2, but nothing in it
+	runs unless CPUID reports them (see aes128gcm_setkey and aes128e_setkey).
+
+																			 */
+/*****************************************************************************/
+
+  // ************************************************************************//
+ // Includes		                                                        //
+// ************************************************************************//
+#include "aes128gcm_vpclmul.h"
+
+#ifdef AES128GCM_HAVE_VPCLMUL
+
+#include <stdint.h>
+#include <immintrin.h>
+
+  // ************************************************************************//
+ // Definitions		                                                        //
+// ************************************************************************//
+
+/* Reverses the 16 bytes of a block (GCM byte order <-> polynomial order) */
+#define BSWAP_MASK _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15)
+#define BSWAP_MASK256 _mm256_broadcastsi128_si256(BSWAP_MASK)
+
+/* Number of rounds of AES-128 */
+#define Nr 10
+
+/* Registers of two blocks per group */
+#define Registers (AES128GCM_VPCLMUL_POWERS / 2)
+
+/* Index in Hpow of H^m: pairs are stored in descending order */
+#define Power(m) ((m) % 2 ? (m) : (m) - 2)
+
+  // ************************************************************************ //
+ // Private functions                                                        //
+// ************************************************************************ //
+
+/* Accumulate the unreduced product a * h into lo, hi and the Karatsuba middle term mid */
+static inline void MulAcc(__m128i a, __m128i h, __m128i *lo, __m128i *hi, __m128i *mid) {
+
+	__m128i as = _mm_xor_si128(a, _mm_shuffle_epi32(a, 0x4e));
+	__m128i hs = _mm_xor_si128(h, _mm_shuffle_epi32(h, 0x4e));
+
+	*lo  = _mm_xor_si128(*lo,  _mm_clmulepi64_si128(a, h, 0x00));
+	*hi  = _mm_xor_si128(*hi,  _mm_clmulepi64_si128(a, h, 0x11));
+	*mid = _mm_xor_si128(*mid, _mm_clmulepi64_si128(as, hs, 0x00));
+}
+
+/* MulAcc() on both lanes at once */
+static inline void MulAcc256(__m256i a, __m256i h, __m256i *lo, __m256i *hi, __m256i *mid) {
+
+	__m256i as = _mm256_xor_si256(a, _mm256_shuffle_epi32(a, 0x4e));	// Per lane, low qword is a0 ^ a1
+	__m256i hs = _mm256_xor_si256(h, _mm256_shuffle_epi32(h, 0x4e));
+
+	*lo  = _mm256_xor_si256(*lo,  _mm256_clmulepi64_epi128(a, h, 0x00));
+	*hi  = _mm256_xor_si256(*hi,  _mm256_clmulepi64_epi128(a, h, 0x11));
+	*mid = _mm256_xor_si256(*mid, _mm256_clmulepi64_epi128(as, hs, 0x00));
+}
+
+/* The two lanes of an accumulator summed into one 128-bit value */
+static inline __m128i Fold(__m256i x) {
+
+	return _mm_xor_si128(_mm256_castsi256_si128(x), _mm256_extracti128_si256(x, 1));
+}
+
+/* Reduce a sum of Karatsuba products to a 128-bit field element, as in aes128gcm_clmul.c */
+static inline __m128i Reduce(__m128i lo, __m128i hi, __m128i mid) {
+
+	__m128i t1, t2, t3;
+
+	mid = _mm_xor_si128(mid, _mm_xor_si128(lo, hi));
+	lo = _mm_xor_si128(lo, _mm_slli_si128(mid, 8));
+	hi = _mm_xor_si128(hi, _mm_srli_si128(mid, 8));
+
+	// Shift of the 256-bit product left by one bit (the operands are bit-reflected)
+	t1 = _mm_srli_epi32(lo, 31);
+	t2 = _mm_srli_epi32(hi, 31);
+	lo = _mm_slli_epi32(lo, 1);
+	hi = _mm_slli_epi32(hi, 1);
+	t3 = _mm_srli_si128(t1, 12);
+	t2 = _mm_slli_si128(t2, 4);
+	t1 = _mm_slli_si128(t1, 4);
+	lo = _mm_or_si128(lo, t1);
+	hi = _mm_or_si128(hi, t2);
+	hi = _mm_or_si128(hi, t3);
+
+	// Reduction modulo x^128 + x^7 + x^2 + x + 1 in two phases
+	t1 = _mm_slli_epi32(lo, 31);
+	t2 = _mm_slli_epi32(lo, 30);
+	t3 = _mm_slli_epi32(lo, 25);
+	t1 = _mm_xor_si128(t1, t2);
+	t1 = _mm_xor_si128(t1, t3);
+	t2 = _mm_srli_si128(t1, 4);
+	t1 = _mm_slli_si128(t1, 12);
+	lo = _mm_xor_si128(lo, t1);
+
+	t1 = _mm_srli_epi32(lo, 1);
+	t3 = _mm_srli_epi32(lo, 2);
+	t1 = _mm_xor_si128(t1, t3);
+	t3 = _mm_srli_epi32(lo, 7);
+	t1 = _mm_xor_si128(t1, t3);
+	t1 = _mm_xor_si128(t1, t2);
+	lo = _mm_xor_si128(lo, t1);
+
+	return _mm_xor_si128(hi, lo);
+}
+
+/* Absorb n <= 16 blocks at X (GCM byte order) into y with a single reduction. Block i is
+   multiplied by H^(n - i); an odd first block is taken alone so the rest pair up evenly */
+static __m128i GhashGroup(__m128i y, const unsigned char *X, unsigned long n, const unsigned char Hpow[][16]) {
+
+	const __m256i bswap = BSWAP_MASK256;
+	__m256i lo = _mm256_setzero_si256(), hi = _mm256_setzero_si256(), mid = _mm256_setzero_si256();
+	__m128i lo1 = _mm_setzero_si128(), hi1 = _mm_setzero_si128(), mid1 = _mm_setzero_si128();
+	__m256i x;
+	unsigned long i = 0;
+
+	if (n % 2)
+	{
+		MulAcc(_mm_xor_si128(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)X), BSWAP_MASK), y), _mm_loadu_si128((const __m128i *)Hpow[Power(n)]), &lo1, &hi1, &mid1);
+		y = _mm_setzero_si128();
+		i = 1;
+	}
+	for (; i < n; i += 2)			// Blocks i and i + 1 take H^(n - i) and H^(n - i - 1)
+	{
+		x = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(X + 16 * i)), bswap);
+		if (i == 0)
+			x = _mm256_xor_si256(x, _mm256_inserti128_si256(_mm256_setzero_si256(), y, 0));	// The running hash enters with the first block
+		MulAcc256(x, _mm256_loadu_si256((const __m256i *)Hpow[Power(n - i)]), &lo, &hi, &mid);
+	}
+
+	return Reduce(_mm_xor_si128(Fold(lo), lo1), _mm_xor_si128(Fold(hi), hi1), _mm_xor_si128(Fold(mid), mid1));
+}
+
+/* Round keys in both lanes, and the counter pair (c, c + 1) from CB in polynomial order */
+static void LoadState(__m256i rk[Nr + 1], __m256i *counter, const unsigned char *roundKeys, const unsigned char *CB) {
+
+	for (int r = 0; r <= Nr; r++)
+	{
+		rk[r] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)roundKeys + r));
+	}
+	*counter = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)CB)), BSWAP_MASK256);
+	*counter = _mm256_add_epi32(*counter, _mm256_set_epi32(0, 0, 0, 1, 0, 0, 0, 0));
+}
+
+/* CB advanced by nblocks, modulo 2^32 */
+static void StoreCounter(unsigned char *CB, unsigned long nblocks) {
+
+	uint32_t c = ((uint32_t)CB[12] << 24 | (uint32_t)CB[13] << 16 | (uint32_t)CB[14] << 8 | CB[15]) + (uint32_t)nblocks;
+
+	CB[12] = (unsigned char)(c >> 24);
+	CB[13] = (unsigned char)(c >> 16);
+	CB[14] = (unsigned char)(c >> 8);
+	CB[15] = (unsigned char)c;
+}
+
+/* Up to 16 blocks of CTR from in to out, whole registers of keystream (an odd last block
+   uses one lane); the counter is advanced */
+static void CTRBlocks(unsigned char *out, const unsigned char *in, unsigned long nblocks, const __m256i rk[Nr + 1], __m256i *counter) {
+
+	const __m256i bswap = BSWAP_MASK256;
+	__m256i b[Registers];
+	unsigned long i, n = (nblocks + 1) / 2;
+	int r;
+
+	for (i = 0; i < n; i++)
+	{
+		b[i] = _mm256_xor_si256(_mm256_shuffle_epi8(*counter, bswap), rk[0]);
+		*counter = _mm256_add_epi32(*counter, _mm256_set_epi32(0, 0, 0, 2, 0, 0, 0, 2));
+	}
+	for (r = 1; r < Nr; r++)
+	{
+		for (i = 0; i < n; i++)
+		{
+			b[i] = _mm256_aesenc_epi128(b[i], rk[r]);
+		}
+	}
+	for (i = 0; i < n; i++)
+	{
+		b[i] = _mm256_aesenclast_epi128(b[i], rk[Nr]);
+	}
+	for (i = 0; i < nblocks / 2; i++)
+	{
+		_mm256_storeu_si256((__m256i *)out + i, _mm256_xor_si256(b[i], _mm256_loadu_si256((const __m256i *)in + i)));
+	}
+	if (nblocks % 2)
+		_mm_storeu_si128((__m128i *)out + nblocks - 1, _mm_xor_si128(_mm256_castsi256_si128(b[n - 1]), _mm_loadu_si128((const __m128i *)in + nblocks - 1)));
+}
+
+/* Shared by both directions: 16 counter blocks go through the AES rounds and are XORed
+   from in to out, while the 16 blocks at X (GCM byte order) are multiplied by H^16..H^1
+   between the rounds and reduced into y. X is read from memory (L1) rather than kept in
+   registers, and the whole group stays in one function, so that the 8 AES registers and
+   the accumulators fit in the 16 YMM registers of AVX2. X is read before out is written */
+static void StitchedGroup(const __m256i *rk, __m256i *counter, unsigned char *out, const unsigned char *in, const unsigned char *X, __m128i *y, const unsigned char Hpow[][16]) {
+
+	const __m256i bswap = BSWAP_MASK256;
+	const __m256i two = _mm256_set_epi32(0, 0, 0, 2, 0, 0, 0, 2);
+	__m256i lo = _mm256_setzero_si256(), hi = _mm256_setzero_si256(), mid = _mm256_setzero_si256();
+	__m256i b[Registers], x, c = *counter;
+	int i, r;
+
+	for (i = 0; i < Registers; i++)
+	{
+		b[i] = _mm256_xor_si256(_mm256_shuffle_epi8(c, bswap), rk[0]);
+		c = _mm256_add_epi32(c, two);
+	}
+	*counter = c;
+
+	x = _mm256_inserti128_si256(_mm256_setzero_si256(), *y, 0);	// The running hash enters with the first block
+	for (r = 1; r <= Registers; r++)				// Blocks 2r - 2 and 2r - 1 in round r
+	{
+		for (i = 0; i < Registers; i++)
+		{
+			b[i] = _mm256_aesenc_epi128(b[i], rk[r]);
+		}
+		x = _mm256_xor_si256(x, _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)X + r - 1), bswap));
+		MulAcc256(x, _mm256_loadu_si256((const __m256i *)Hpow[Power(AES128GCM_VPCLMUL_POWERS - 2 * (r - 1))]), &lo, &hi, &mid);
+		x = _mm256_setzero_si256();
+	}
+	for (; r < Nr; r++)
+	{
+		for (i = 0; i < Registers; i++)
+		{
+			b[i] = _mm256_aesenc_epi128(b[i], rk[r]);
+		}
+	}
+
+	for (i = 0; i < Registers; i++)
+	{
+		b[i] = _mm256_aesenclast_epi128(b[i], rk[Nr]);
+		_mm256_storeu_si256((__m256i *)out + i, _mm256_xor_si256(b[i], _mm256_loadu_si256((const __m256i *)in + i)));
+	}
+
+	*y = Reduce(Fold(lo), Fold(hi), Fold(mid));
+}
+
+  // ************************************************************************ //
+ // Public functions                                                         //
+// ************************************************************************ //
+
+/* H^1..H^16 with 128-bit multiplies, stored by pairs in descending order */
+void aes128gcm_vpclmul_init(unsigned char Hpow[][16], const unsigned char *H) {
+
+	__m128i h = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)H), BSWAP_MASK);
+	__m128i power = h, lo, hi, mid;
+
+	for (int m = 1; m <= AES128GCM_VPCLMUL_POWERS; m++)
+	{
+		_mm_storeu_si128((__m128i *)Hpow[Power(m)], power);
+		lo = hi = mid = _mm_setzero_si128();
+		MulAcc(power, h, &lo, &hi, &mid);
+		power = Reduce(lo, hi, mid);
+	}
+}
+
+/* Absorb nblocks blocks at X into Y, 16 blocks per reduction */
+void aes128gcm_vpclmul_ghash(unsigned char *Y, const unsigned char Hpow[][16], const unsigned char *X, unsigned long nblocks) {
+
+	__m128i y = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)Y), BSWAP_MASK);
+	unsigned long n;
+
+	for (; nblocks > 0; nblocks -= n, X += 16 * n)
+	{
+		n = nblocks < AES128GCM_VPCLMUL_POWERS ? nblocks : AES128GCM_VPCLMUL_POWERS;
+		y = GhashGroup(y, X, n, Hpow);
+	}
+
+	_mm_storeu_si128((__m128i *)Y, _mm_shuffle_epi8(y, BSWAP_MASK));
+}
+
+/* CTR encryption of nblocks blocks with the ciphertext hashed into Y in the same pass */
+void aes128gcm_vpclmul_encrypt(unsigned char *out, const unsigned char *in, unsigned long nblocks, unsigned char *CB, const unsigned char *roundKeys, unsigned char *Y, const unsigned char Hpow[][16]) {
+
+	__m256i rk[Nr + 1], counter;
+	__m128i y = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)Y), BSWAP_MASK);
+	unsigned long total = nblocks;
+
+	LoadState(rk, &counter, roundKeys, CB);
+
+	if (nblocks >= AES128GCM_VPCLMUL_POWERS)
+	{
+		CTRBlocks(out, in, AES128GCM_VPCLMUL_POWERS, rk, &counter);	// The first group has nothing to hash alongside
+		nblocks -= AES128GCM_VPCLMUL_POWERS;
+		in += 16 * AES128GCM_VPCLMUL_POWERS;
+		out += 16 * AES128GCM_VPCLMUL_POWERS;
+
+		for (; nblocks >= AES128GCM_VPCLMUL_POWERS; nblocks -= AES128GCM_VPCLMUL_POWERS, in += 16 * AES128GCM_VPCLMUL_POWERS, out += 16 * AES128GCM_VPCLMUL_POWERS)
+		{
+			StitchedGroup(rk, &counter, out, in, out - 16 * AES128GCM_VPCLMUL_POWERS, &y, Hpow);	// Hashes the previous group while encrypting this one
+		}
+
+		y = GhashGroup(y, out - 16 * AES128GCM_VPCLMUL_POWERS, AES128GCM_VPCLMUL_POWERS, Hpow);	// Last whole group
+	}
+
+	if (nblocks > 0)
+	{
+		CTRBlocks(out, in, nblocks, rk, &counter);
+		y = GhashGroup(y, out, nblocks, Hpow);
+	}
+
+	StoreCounter(CB, total);
+	_mm_storeu_si128((__m128i *)Y, _mm_shuffle_epi8(y, BSWAP_MASK));
+}
+
+/* CTR decryption of nblocks blocks with the ciphertext hashed into Y in the same pass */
+void aes128gcm_vpclmul_decrypt(unsigned char *out, const unsigned char *in, unsigned long nblocks, unsigned char *CB, const unsigned char *roundKeys, unsigned char *Y, const unsigned char Hpow[][16]) {
+
+	__m256i rk[Nr + 1], counter;
+	__m128i y = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)Y), BSWAP_MASK);
+	unsigned long total = nblocks;
+
+	LoadState(rk, &counter, roundKeys, CB);
+
+	for (; nblocks >= AES128GCM_VPCLMUL_POWERS; nblocks -= AES128GCM_VPCLMUL_POWERS, in += 16 * AES128GCM_VPCLMUL_POWERS, out += 16 * AES128GCM_VPCLMUL_POWERS)
+	{
+		StitchedGroup(rk, &counter, out, in, in, &y, Hpow);	// The ciphertext is already known, so it is hashed with its own group
+	}
+
+	if (nblocks > 0)
+	{
+		y = GhashGroup(y, in, nblocks, Hpow);				// Hashed before the plaintext is written
+		CTRBlocks(out, in, nblocks, rk, &counter);
+	}
+
+	StoreCounter(CB, total);
+	_mm_storeu_si128((__m128i *)Y, _mm_shuffle_epi8(y, BSWAP_MASK));
+}
+
+#endif
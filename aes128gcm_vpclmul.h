@@ -0,0 +1,34 @@
+#ifndef AES128GCM_VPCLMUL_H
+#define AES128GCM_VPCLMUL_H
+
+/* VPCLMULQDQ backend of GHASH: the carry-less multiplies of the PCLMULQDQ backend on
+ * 256-bit registers, two blocks per instruction. It is compiled on x86 only, and
+ * aes128gcm_setkey() only selects it when CPUID reports VPCLMULQDQ and AVX2. The
+ * stitched kernels also use VAES and are only called for keys whose AES backend is
+ * AES128E_VAES.
+ */
+
+#if defined(__x86_64__) || defined(__i386__)
+#define AES128GCM_HAVE_VPCLMUL 1
+
+/* Number of H powers kept per key, which is also the number of blocks absorbed per reduction */
+#define AES128GCM_VPCLMUL_POWERS 16
+
+/* Fill Hpow with H^1..H^16 from the 16-byte hash subkey H, by pairs in descending order
+ * (Hpow[2k] = H^(2k+2), Hpow[2k+1] = H^(2k+1)), so that one 32-byte load gives the powers
+ * of two consecutive blocks. */
+void aes128gcm_vpclmul_init(unsigned char Hpow[][16], const unsigned char *H);
+
+/* Absorb the nblocks 16-byte blocks at X into the GHASH accumulator Y (16 bytes, GCM
+ * byte order): Y = (...((Y ^ X1) * H ^ X2) * H ...) * H. */
+void aes128gcm_vpclmul_ghash(unsigned char *Y, const unsigned char Hpow[][16], const unsigned char *X, unsigned long nblocks);
+
+/* AES-CTR over nblocks blocks from in to out with the 32-bit counter in CB (advanced
+ * past the last block), fused with GHASH of the ciphertext into Y, 16 blocks per pass.
+ * roundKeys is the 176-byte AES-128 key schedule. out may equal in. */
+void aes128gcm_vpclmul_encrypt(unsigned char *out, const unsigned char *in, unsigned long nblocks, unsigned char *CB, const unsigned char *roundKeys, unsigned char *Y, const unsigned char Hpow[][16]);
+void aes128gcm_vpclmul_decrypt(unsigned char *out, const unsigned char *in, unsigned long nblocks, unsigned char *CB, const unsigned char *roundKeys, unsigned char *Y, const unsigned char Hpow[][16]);
+
+#endif
+
+#endif